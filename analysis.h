@@ -0,0 +1,291 @@
+// analysis.h
+// Streaming analysis of step3 runs:
+// - SpikeSummary: the statistics visualization.py derives from the csv rasters (PSTH, time to recover after the
+//   stimulus, baseline rate) are accumulated trial by trial and saved as a small binary summary (see summary_write()).
+// - EnsembleStats: per-time-bin mean/variance (Welford) and optional quantile sketches of traces across many cells,
+//   accumulated online in O(time bins) memory (see ensemble_write()).
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+#include "simulation.h"
+#include <math.h>
+
+#define SUMMARY_VERSION 1
+#define ENSEMBLE_VERSION 1
+
+typedef struct {
+    int num_trials;
+    int max_trials;
+    int num_bins;            // PSTH bins covering [0, duration)
+    double bin_size;         // ms
+    double stim_time;        // latency reference in ms, -1 without stimulation
+    double baseline_start;   // ms
+    double baseline_end;     // ms
+    double baseline_count;   // spikes in [baseline_start, baseline_end), pooled over trials
+    double *psth;            // spike counts per bin, pooled over trials
+    double *latency;         // first spike at or after stim_time minus stim_time, per trial (NAN if none)
+} SpikeSummary;
+
+
+SpikeSummary summary_init(int duration, double stim_time, int max_trials) {
+    SpikeSummary summary = {0};
+    summary.max_trials = max_trials;
+    summary.bin_size = SUMMARY_bin_size;
+    summary.num_bins = (int)ceil(duration / summary.bin_size);
+    summary.stim_time = stim_time;
+    summary.baseline_start = SUMMARY_baseline_start;
+    summary.baseline_end = SUMMARY_baseline_end;
+    summary.psth = (double *)calloc(summary.num_bins, sizeof(double));
+    summary.latency = (double *)malloc(max_trials * sizeof(double));
+    return summary;
+}
+
+void summary_add(SpikeSummary *summary, const Spikes *spikes) {
+    if (summary->num_trials >= summary->max_trials) return;
+    double latency = NAN;
+    for (int i = 0; i < spikes->num_spikes; i++) {
+        double t = spikes->spike_times[i];
+        int bin = (int)(t / summary->bin_size);
+        if (bin >= 0 && bin < summary->num_bins) summary->psth[bin] += 1;
+        if (t >= summary->baseline_start && t < summary->baseline_end) summary->baseline_count += 1;
+        if (summary->stim_time >= 0 && isnan(latency) && t >= summary->stim_time) latency = t - summary->stim_time;
+    }
+    summary->latency[summary->num_trials++] = latency;
+}
+
+// layout (all float64):
+//   version, num_trials, num_bins, bin_size, stim_time, baseline_start, baseline_end, baseline_count,
+//   psth[num_bins], latency[num_trials]
+int summary_write(const SpikeSummary *summary, const char *filename) {
+    double header[8] = {SUMMARY_VERSION, summary->num_trials, summary->num_bins, summary->bin_size,
+                        summary->stim_time, summary->baseline_start, summary->baseline_end, summary->baseline_count};
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        perror("Error opening file");
+        return 1;
+    }
+    size_t written = fwrite(header, sizeof(double), 8, file);
+    written += fwrite(summary->psth, sizeof(double), summary->num_bins, file);
+    written += fwrite(summary->latency, sizeof(double), summary->num_trials, file);
+    fclose(file);
+    if (written != (size_t)(8 + summary->num_bins + summary->num_trials)) {
+        perror("Error writing data to file");
+        return 1;
+    }
+    printf("Summary saved in %s \n", filename);
+    return 0;
+}
+
+void summary_free(SpikeSummary *summary) {
+    free(summary->psth);
+    free(summary->latency);
+}
+
+// ###################################################################
+// ############            Ensemble traces              ##############
+// ###################################################################
+
+// traced variables and the value range of their quantile sketches (values outside are clamped and counted)
+typedef struct {
+    const char *name;
+    double low;
+    double high;
+} EnsembleVar;
+
+enum {ENS_Vs, ENS_m_HCN_som, ENS_m_HCN_den, ENS_E_GABA_som, ENS_E_GABA_den, ENS_g_GABA_som, ENS_g_GABA_den,
+      ENS_D, ENS_F, NUM_ENSEMBLE_VARS};
+
+static const EnsembleVar ENSEMBLE_VARS[NUM_ENSEMBLE_VARS] = {
+    {"Vs", -100, 50},
+    {"m_HCN_som", 0, 1},
+    {"m_HCN_den", 0, 1},
+    {"E_GABA_som", -100, 0},
+    {"E_GABA_den", -100, 0},
+    {"g_GABA_som", 0, 1},
+    {"g_GABA_den", 0, 1},
+    {"D", 0, 1},
+    {"F", 0, 1},
+};
+
+#define NUM_ENSEMBLE_QUANTILES 5
+static const double ENSEMBLE_QUANTILES[NUM_ENSEMBLE_QUANTILES] = {0.05, 0.25, 0.5, 0.75, 0.95};
+
+typedef struct {
+    int num_cells;
+    int num_bins;               // time bins covering [0, duration)
+    int steps_per_bin;
+    int num_buckets;            // quantile sketch buckets per (variable, bin), 0 without sketches
+    double *mean;               // [var][bin]
+    double *m2;                 // [var][bin], sum of squared deviations
+    double *min;                // [var][bin]
+    double *max;                // [var][bin]
+    unsigned int *hist;         // [var][bin][bucket]
+    double out_of_range[NUM_ENSEMBLE_VARS][2];  // sketch samples below/above the variable range
+} EnsembleStats;
+
+
+EnsembleStats ensemble_init(int duration, int num_buckets) {
+    EnsembleStats stats = {0};
+    stats.steps_per_bin = (int)(ENSEMBLE_bin_size * CONFIG_1ms_step_num + 0.5);
+    if (stats.steps_per_bin < 1) stats.steps_per_bin = 1;
+    stats.num_bins = duration * CONFIG_1ms_step_num / stats.steps_per_bin;
+    stats.num_buckets = num_buckets;
+    size_t n = (size_t)NUM_ENSEMBLE_VARS * stats.num_bins;
+    stats.mean = (double *)calloc(n, sizeof(double));
+    stats.m2 = (double *)calloc(n, sizeof(double));
+    stats.min = (double *)malloc(n * sizeof(double));
+    stats.max = (double *)malloc(n * sizeof(double));
+    for (size_t k = 0; k < n; k++) {
+        stats.min[k] = INFINITY;
+        stats.max[k] = -INFINITY;
+    }
+    if (num_buckets > 0) stats.hist = (unsigned int *)calloc(n * num_buckets, sizeof(unsigned int));
+    return stats;
+}
+
+void ensemble_free(EnsembleStats *stats) {
+    free(stats->mean);
+    free(stats->m2);
+    free(stats->min);
+    free(stats->max);
+    free(stats->hist);
+}
+
+// record the traced variables of the current cell (the (num_cells + 1)-th) at time bin `bin`
+static inline void ensemble_add(EnsembleStats *restrict stats, int bin, const CellState *restrict s) {
+    double E_GABA_som = V_T * log((p_Cl * Cl_out + p_HCO3 * HCO3_out) / (p_Cl * s->Cl_som + p_HCO3 * HCO3_in)) / z_GABA;
+    double E_GABA_den = V_T * log((p_Cl * Cl_out + p_HCO3 * HCO3_out) / (p_Cl * s->Cl_den + p_HCO3 * HCO3_in)) / z_GABA;
+    const double values[NUM_ENSEMBLE_VARS] = {s->V_s, s->m_HCN_som, s->m_HCN_den, E_GABA_som, E_GABA_den,
+                                              s->g_GABA_som, s->g_GABA_den, s->D, s->F};
+    double n = stats->num_cells + 1;
+    for (int v = 0; v < NUM_ENSEMBLE_VARS; v++) {
+        size_t k = (size_t)v * stats->num_bins + bin;
+        double delta = values[v] - stats->mean[k];
+        stats->mean[k] += delta / n;
+        stats->m2[k] += delta * (values[v] - stats->mean[k]);
+        if (values[v] < stats->min[k]) stats->min[k] = values[v];
+        if (values[v] > stats->max[k]) stats->max[k] = values[v];
+        if (stats->num_buckets > 0) {
+            double x = (values[v] - ENSEMBLE_VARS[v].low) / (ENSEMBLE_VARS[v].high - ENSEMBLE_VARS[v].low);
+            int bucket = (int)floor(x * stats->num_buckets);
+            if (bucket < 0) {
+                bucket = 0;
+                stats->out_of_range[v][0] += 1;
+            } else if (bucket >= stats->num_buckets) {
+                bucket = stats->num_buckets - 1;
+                stats->out_of_range[v][1] += x > 1;
+            }
+            stats->hist[k * stats->num_buckets + bucket]++;
+        }
+    }
+}
+
+// simulate one cell as spike_simulation() and add its traces to `stats`, return the number of spikes; bins past
+// the duration of ensemble_init() are not recorded
+int ensemble_simulation(State *restrict s, int duration, double GPe_stim_time, double Str_stim_time,
+                        EnsembleStats *restrict stats) {
+    int num_spikes = 0;
+    int num_steps = duration * CONFIG_1ms_step_num;
+    const CellParams p = params_from_state(s);
+    CellState c = cell_from_state(s);
+    INSTR_TIMER_START(trace);
+    for (int i = 0; i < num_steps; i++) {
+        set_cell_stim(&c, i, GPe_stim_time, Str_stim_time);
+        num_spikes += kernel_step(&p, &c, CONFIG_dt);
+        int bin = i / stats->steps_per_bin;
+        if ((i + 1) % stats->steps_per_bin == 0 && bin < stats->num_bins) ensemble_add(stats, bin, &c);
+    }
+    INSTR_TIMER_STOP(trace, INSTR_TRACE);
+    cell_to_state(s, &c);
+    stats->num_cells++;
+    INSTR_COUNT(INSTR_STEPS, num_steps);
+    INSTR_COUNT(INSTR_SPIKES, num_spikes);
+    INSTR_COUNT(INSTR_SIMULATIONS, 1);
+    return num_spikes;
+}
+
+// merge `other` into `stats` (Chan et al. pairwise update), e.g. per-thread accumulators after a parallel run
+void ensemble_merge(EnsembleStats *restrict stats, const EnsembleStats *restrict other) {
+    if (other->num_cells == 0) return;
+    double n_a = stats->num_cells, n_b = other->num_cells, n = n_a + n_b;
+    size_t num = (size_t)NUM_ENSEMBLE_VARS * stats->num_bins;
+    for (size_t k = 0; k < num; k++) {
+        double delta = other->mean[k] - stats->mean[k];
+        stats->mean[k] += delta * n_b / n;
+        stats->m2[k] += other->m2[k] + delta * delta * n_a * n_b / n;
+        if (other->min[k] < stats->min[k]) stats->min[k] = other->min[k];
+        if (other->max[k] > stats->max[k]) stats->max[k] = other->max[k];
+    }
+    if (stats->num_buckets > 0) {
+        for (size_t k = 0; k < num * stats->num_buckets; k++) stats->hist[k] += other->hist[k];
+        for (int v = 0; v < NUM_ENSEMBLE_VARS; v++) {
+            stats->out_of_range[v][0] += other->out_of_range[v][0];
+            stats->out_of_range[v][1] += other->out_of_range[v][1];
+        }
+    }
+    stats->num_cells += other->num_cells;
+}
+
+// quantile `q` of (variable v, bin), interpolated linearly inside the sketch bucket and kept within the observed
+// min/max (exact for a constant trace)
+static double ensemble_quantile(const EnsembleStats *stats, int v, int bin, double q) {
+    size_t k = (size_t)v * stats->num_bins + bin;
+    const unsigned int *hist = stats->hist + k * stats->num_buckets;
+    double width = (ENSEMBLE_VARS[v].high - ENSEMBLE_VARS[v].low) / stats->num_buckets;
+    double target = q * stats->num_cells, cumulative = 0, value = stats->max[k];
+    for (int b = 0; b < stats->num_buckets; b++) {
+        if (hist[b] > 0 && cumulative + hist[b] >= target) {
+            value = ENSEMBLE_VARS[v].low + (b + (target - cumulative) / hist[b]) * width;
+            break;
+        }
+        cumulative += hist[b];
+    }
+    return fmin(fmax(value, stats->min[k]), stats->max[k]);
+}
+
+// layout (all float64):
+//   version, num_cells, num_bins, bin_size, num_vars, num_quantiles (0 without sketches), quantiles[num_quantiles],
+//   then per variable (ENSEMBLE_VARS order): mean[num_bins], variance[num_bins] (unbiased, NAN below 2 cells),
+//   min[num_bins], max[num_bins], out_of_range[2], quantile values[num_quantiles][num_bins]
+int ensemble_write(const EnsembleStats *stats, const char *filename) {
+    int num_quantiles = stats->num_buckets > 0 ? NUM_ENSEMBLE_QUANTILES : 0;
+    double header[6] = {ENSEMBLE_VERSION, stats->num_cells, stats->num_bins,
+                        (double)stats->steps_per_bin / CONFIG_1ms_step_num, NUM_ENSEMBLE_VARS, num_quantiles};
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        perror("Error opening file");
+        return 1;
+    }
+    size_t expected = 6 + num_quantiles, written = 0;
+    written += fwrite(header, sizeof(double), 6, file);
+    written += fwrite(ENSEMBLE_QUANTILES, sizeof(double), num_quantiles, file);
+    double *buffer = (double *)malloc(stats->num_bins * sizeof(double));
+    for (int v = 0; v < NUM_ENSEMBLE_VARS; v++) {
+        const double *mean = stats->mean + (size_t)v * stats->num_bins;
+        const double *m2 = stats->m2 + (size_t)v * stats->num_bins;
+        written += fwrite(mean, sizeof(double), stats->num_bins, file);
+        for (int bin = 0; bin < stats->num_bins; bin++) {
+            buffer[bin] = stats->num_cells > 1 ? m2[bin] / (stats->num_cells - 1) : NAN;
+        }
+        written += fwrite(buffer, sizeof(double), stats->num_bins, file);
+        written += fwrite(stats->min + (size_t)v * stats->num_bins, sizeof(double), stats->num_bins, file);
+        written += fwrite(stats->max + (size_t)v * stats->num_bins, sizeof(double), stats->num_bins, file);
+        written += fwrite(stats->out_of_range[v], sizeof(double), 2, file);
+        for (int j = 0; j < num_quantiles; j++) {
+            for (int bin = 0; bin < stats->num_bins; bin++) {
+                buffer[bin] = ensemble_quantile(stats, v, bin, ENSEMBLE_QUANTILES[j]);
+            }
+            written += fwrite(buffer, sizeof(double), stats->num_bins, file);
+        }
+        expected += (size_t)(4 + num_quantiles) * stats->num_bins + 2;
+    }
+    free(buffer);
+    fclose(file);
+    if (written != expected) {
+        perror("Error writing data to file");
+        return 1;
+    }
+    printf("Ensemble statistics saved in %s \n", filename);
+    return 0;
+}
+
+#endif
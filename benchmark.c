@@ -0,0 +1,465 @@
+#include "simulation.h"
+#include "dendrite.h"
+#include "sensitivity.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Benchmark suite for the model kernel and the pipeline stages.
+// Results are written as JSON and optionally compared with a stored baseline, e.g.
+//   benchmark.exe -o bench.json -baseline intermediate_result/benchmark_baseline.json -threshold 0.1
+// The process exits with 1 if any case regresses by more than the threshold.
+
+#define BENCH_MAX_RESULTS 48
+#define BENCH_MAX_CELLS 64
+#define BENCH_IDENTITY_ms 1000  // length of the bit-identity run of bench_identity()
+
+typedef struct {
+    char name[64];
+    char unit[16];
+    double value;
+    int higher_is_better;
+} BenchResult;
+
+typedef struct {
+    double I_app[BENCH_MAX_CELLS];
+    double g_HCN[BENCH_MAX_CELLS];
+    int num;
+} BenchCells;
+
+static const char *BENCH_HCN[3] = {"zero", "som", "den"};
+
+BenchResult bench_results[BENCH_MAX_RESULTS];
+int bench_num_results = 0;
+
+volatile double bench_sink;  // keeps the optimizer from dropping microbenchmark loops
+
+
+void bench_report(const char *name, double value, const char *unit, int higher_is_better) {
+    BenchResult *r = &bench_results[bench_num_results++];
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    snprintf(r->unit, sizeof(r->unit), "%s", unit);
+    r->value = value;
+    r->higher_is_better = higher_is_better;
+    printf("%-32s %12.3f %s\n", name, value, unit);
+}
+
+long file_size(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) return 0;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+// fixed parameter sets: the first `num` selected (I_app, g_HCN) pairs of step2
+int load_cells(const char *data_dir, const char *HCN, int num, BenchCells *cells) {
+    char filename[512];
+    double buffer[1024];
+    size_t N0 = 0, N1 = 0;
+
+    snprintf(filename, sizeof(filename), "%sselected_g_HCN_%s.bin", data_dir, HCN);
+    read_binary_file(filename, buffer, &N0);
+    for (int i = 0; i < num && i < (int)N0; i++) cells->g_HCN[i] = buffer[i];
+
+    snprintf(filename, sizeof(filename), "%sselected_I_HCN_%s.bin", data_dir, HCN);
+    read_binary_file(filename, buffer, &N1);
+    for (int i = 0; i < num && i < (int)N1; i++) cells->I_app[i] = buffer[i];
+
+    cells->num = (int)(N0 < N1 ? N0 : N1);
+    if (cells->num > num) cells->num = num;
+    return cells->num > 0 ? 0 : 1;
+}
+
+State cell_state(const char *HCN, const BenchCells *cells, int i) {
+    State s = init_state();
+    s.I_app = cells->I_app[i];
+    if (strcmp(HCN, "som") == 0) {
+        s.g_HCN_som = cells->g_HCN[i];
+    } else if (strcmp(HCN, "den") == 0) {
+        s.g_HCN_den = cells->g_HCN[i];
+    }
+    return s;
+}
+
+
+// ###################################################################
+// ############              Benchmark cases            ##############
+// ###################################################################
+
+void bench_dz(long num_steps) {
+    State s = init_state();
+    double z = s.h_Na_f, sum = 0;
+    double start = wall_time();
+    for (long i = 0; i < num_steps; i++) {
+        kernel_dz(&s.prop_h_Na_f, &z, -80. + (double)(i & 1023) * 0.1, CONFIG_dt);
+        sum += z;
+    }
+    double elapsed = wall_time() - start;
+    bench_sink = sum;
+    bench_report("dz", elapsed * 1e9 / num_steps, "ns/step", 0);
+}
+
+void bench_f(const char *HCN, const BenchCells *cells, long num_steps) {
+    State s = cell_state(HCN, cells, 0);
+    int num_spikes = 0;
+    double start = wall_time();
+    for (long i = 0; i < num_steps; i++) {
+        num_spikes += kernel_f(&s, CONFIG_dt);
+    }
+    double elapsed = wall_time() - start;
+    bench_sink = num_spikes + s.V_s;
+
+    char name[64];
+    snprintf(name, sizeof(name), "f_HCN_%s", HCN);
+    bench_report(name, elapsed * 1e9 / num_steps, "ns/step", 0);
+}
+
+// every kernel variant supported by this CPU, on the same cell
+void bench_kernel_variants(const BenchCells *cells, long num_steps) {
+    for (int k = 0; k < NUM_KERNELS; k++) {
+        if (!KERNELS[k].supported()) continue;
+        State s = cell_state("zero", cells, 0);
+        int num_spikes = 0;
+        double start = wall_time();
+        for (long i = 0; i < num_steps; i++) {
+            num_spikes += KERNELS[k].f(&s, CONFIG_dt);
+        }
+        double elapsed = wall_time() - start;
+        bench_sink = num_spikes + s.V_s;
+
+        char name[64];
+        snprintf(name, sizeof(name), "f_isa_%s", KERNELS[k].name);
+        bench_report(name, elapsed * 1e9 / num_steps, "ns/step", 0);
+
+        // the same on the split CellParams/CellState layout
+        s = cell_state("zero", cells, 0);
+        const CellParams params = params_from_state(&s);
+        CellState c = cell_from_state(&s);
+        num_spikes = 0;
+        start = wall_time();
+        for (long i = 0; i < num_steps; i++) {
+            num_spikes += KERNELS[k].step(&params, &c, CONFIG_dt);
+        }
+        elapsed = wall_time() - start;
+        bench_sink = num_spikes + c.V_s;
+
+        snprintf(name, sizeof(name), "step_isa_%s", KERNELS[k].name);
+        bench_report(name, elapsed * 1e9 / num_steps, "ns/step", 0);
+    }
+}
+
+// N-compartment dendrite of dendrite.h on chain morphologies: the explicit 2-compartment case (same operations as
+// step_isa_generic) and implicit (Hines) cables, steps scaled down with the size to keep the run time flat
+void bench_dendrite(const BenchCells *cells, long num_steps) {
+    const int sizes[] = {2, 10, 100, 1000};
+    for (int k = 0; k < 4; k++) {
+        State s = cell_state("den", cells, 0);
+        const CellParams params = params_from_state(&s);
+        CellState c = cell_from_state(&s);
+        Morphology m;
+        Dendrite d;
+        if (morphology_chain(&m, sizes[k]) || dendrite_init(&d, &m, &c)) return;
+        double theta = sizes[k] == 2 ? 0 : 1;
+        long steps = num_steps * 2 / sizes[k] > 1000 ? num_steps * 2 / sizes[k] : 1000;
+        int num_spikes = 0;
+        double start = wall_time();
+        for (long i = 0; i < steps; i++) {
+            num_spikes += dendrite_step(&params, &m, &c, &d, theta, CONFIG_dt);
+        }
+        double elapsed = wall_time() - start;
+        bench_sink = num_spikes + c.V_s;
+        dendrite_free(&d);
+        morphology_free(&m);
+
+        char name[64];
+        snprintf(name, sizeof(name), "dendrite_%d", sizes[k]);
+        bench_report(name, elapsed * 1e9 / steps, "ns/step", 0);
+    }
+}
+
+// the copies of the f() physics (cell_step, dendrite_step on the explicit 2-compartment chain, the values of
+// sens_step) against f() itself, step by step with both stimulations: V_s, V_d and the spike flag must be equal bit
+// for bit; return the number of copies that are not
+int bench_identity(const BenchCells *cells) {
+    const int num_steps = BENCH_IDENTITY_ms * CONFIG_1ms_step_num;
+    State ref = cell_state("den", cells, 0);
+    const CellParams params = params_from_state(&ref);
+    CellState c = cell_from_state(&ref), c_den = c;
+    Morphology m;
+    Dendrite d;
+    if (morphology_chain(&m, 2) || dendrite_init(&d, &m, &c_den)) return 1;
+    SensState sens = sens_from_cell(&params, &c);
+    int mismatch[3] = {-1, -1, -1};
+    for (int i = 0; i < num_steps; i++) {
+        set_stim(&ref, i, BENCH_IDENTITY_ms * 0.3, BENCH_IDENTITY_ms * 0.6);
+        set_cell_stim(&c, i, BENCH_IDENTITY_ms * 0.3, BENCH_IDENTITY_ms * 0.6);
+        set_cell_stim(&c_den, i, BENCH_IDENTITY_ms * 0.3, BENCH_IDENTITY_ms * 0.6);
+        sens.GPe_stim = c.GPe_stim;
+        sens.Str_stim = c.Str_stim;
+        Dual crossing;
+        int spike = f(&ref, CONFIG_dt);
+        int spikes[3] = {cell_step(&params, &c, CONFIG_dt),
+                         dendrite_step(&params, &m, &c_den, &d, 0, CONFIG_dt),
+                         sens_step(&params, &sens, CONFIG_dt, &crossing)};
+        double V_s[3] = {c.V_s, c_den.V_s, sens.V_s.x}, V_d[3] = {c.V_d, d.V[1], sens.V_d.x};
+        for (int k = 0; k < 3; k++) {
+            if (mismatch[k] < 0 && (spikes[k] != spike || V_s[k] != ref.V_s || V_d[k] != ref.V_d)) mismatch[k] = i;
+        }
+    }
+    dendrite_free(&d);
+    morphology_free(&m);
+
+    static const char *names[3] = {"cell_step", "dendrite_step_2", "sens_step"};
+    int num_failed = 0;
+    for (int k = 0; k < 3; k++) {
+        if (mismatch[k] < 0) {
+            printf("%-32s %12s (%d steps)\n", names[k], "= f()", num_steps);
+        } else {
+            printf("%-32s %12s at %.3f ms\n", names[k], "!= f()", (mismatch[k] + 1) * CONFIG_dt);
+            num_failed++;
+        }
+    }
+    return num_failed;
+}
+
+void bench_calculate_firing_rate(const char *HCN, const BenchCells *cells) {
+    double sum = 0;
+    double start = wall_time();
+    for (int i = 0; i < cells->num; i++) {
+        State s = cell_state(HCN, cells, i);
+        sum += calculate_firing_rate(&s);
+    }
+    double elapsed = wall_time() - start;
+    bench_sink = sum;
+
+    char name[64];
+    snprintf(name, sizeof(name), "calculate_firing_rate_HCN_%s", HCN);
+    bench_report(name, elapsed * 1e3 / cells->num, "ms/cell", 0);
+}
+
+void bench_spike_simulation(const char *HCN, const BenchCells *cells) {
+    int sum = 0;
+    double start = wall_time();
+    for (int i = 0; i < cells->num; i++) {
+        State s = cell_state(HCN, cells, i);
+        s.W_GPe = 0.06553587;
+        s.tau_GABA_som = 9.74779;
+        Spikes spikes = spike_simulation(&s, SIM_DURATION_total, 1000, -1);
+        sum += spikes.num_spikes;
+        free(spikes.spike_times);
+    }
+    double elapsed = wall_time() - start;
+    bench_sink = sum;
+
+    char name[64];
+    snprintf(name, sizeof(name), "spike_simulation_HCN_%s", HCN);
+    bench_report(name, elapsed * 1e3 / cells->num, "ms/trial", 0);
+}
+
+// full_simulation() of one cell followed by writing all of its traces, as in the `-num 1` path of step3
+void bench_full_simulation(const BenchCells *cells, const char *tmp_dir, int repeat) {
+    const int num = SIM_DURATION_total * CONFIG_1ms_step_num;
+    char filename[512];
+    double sim_time = 0, write_time = 0;
+    long bytes = 0;
+    for (int k = 0; k < repeat; k++) {
+        State s = cell_state("den", cells, 0);
+        s.W_GPe = 0.06553587;
+        s.tau_GABA_som = 9.74779;
+        double start = wall_time();
+        Spikes spikes = full_simulation(&s, SIM_DURATION_total, 1000, -1);
+        double middle = wall_time();
+
+        double *traces[18] = {spikes.I_HCN_som, spikes.m_HCN_som, spikes.g_HCN_som, spikes.I_app,
+                              spikes.I_TRPC3, spikes.I_HCN_den, spikes.m_HCN_den, spikes.g_HCN_den,
+                              spikes.Vs, spikes.Vd, spikes.I_GABA_som, spikes.E_GABA_som, spikes.g_GABA_som,
+                              spikes.D, spikes.I_GABA_den, spikes.E_GABA_den, spikes.g_GABA_den, spikes.F};
+        for (int i = 0; i < 18; i++) {
+            snprintf(filename, sizeof(filename), "%sbenchmark_trace_%02d.csv", tmp_dir, i);
+            write_csv(filename, traces[i], num);
+        }
+        double stop = wall_time();
+        sim_time += middle - start;
+        write_time += stop - middle;
+
+        for (int i = 0; i < 18; i++) {
+            snprintf(filename, sizeof(filename), "%sbenchmark_trace_%02d.csv", tmp_dir, i);
+            bytes += file_size(filename);
+            remove(filename);
+            free(traces[i]);
+        }
+        free(spikes.spike_times);
+    }
+    bench_report("full_simulation", (sim_time + write_time) * 1e3 / repeat, "ms/run", 0);
+    bench_report("trace_writer", bytes / write_time * 1e-6, "MB/s", 1);
+}
+
+void bench_raster_writer(const BenchCells *cells, const char *tmp_dir, int repeat) {
+    State s = cell_state("zero", cells, 0);
+    Spikes spikes = spike_simulation(&s, SIM_DURATION_total, -1, -1);
+
+    char filename[512];
+    snprintf(filename, sizeof(filename), "%sbenchmark_raster.csv", tmp_dir);
+    double start = wall_time();
+    FILE *file = fopen(filename, "w");
+    if (file == NULL) {
+        perror("Failed to open file");
+        free(spikes.spike_times);
+        return;
+    }
+    for (int k = 0; k < repeat * NUM_samples; k++) {
+        write_raster(file, &spikes);
+    }
+    fprintf(file, "END\n");
+    fclose(file);
+    double elapsed = wall_time() - start;
+
+    bench_report("raster_writer", file_size(filename) / elapsed * 1e-6, "MB/s", 1);
+    remove(filename);
+    free(spikes.spike_times);
+}
+
+
+// ###################################################################
+// ############             JSON and baseline           ##############
+// ###################################################################
+
+int write_json(const char *filename) {
+    FILE *file = fopen(filename, "w");
+    if (file == NULL) {
+        perror("Failed to open file");
+        return 1;
+    }
+    fprintf(file, "{\n  \"dt\": %g,\n  \"results\": [\n", CONFIG_dt);
+    for (int i = 0; i < bench_num_results; i++) {
+        const BenchResult *r = &bench_results[i];
+        fprintf(file, "    {\"name\": \"%s\", \"value\": %.6g, \"unit\": \"%s\", \"better\": \"%s\"}%s\n",
+                r->name, r->value, r->unit, r->higher_is_better ? "higher" : "lower",
+                i + 1 < bench_num_results ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    printf("Result saved in %s \n", filename);
+    return 0;
+}
+
+// looks up `"name": "<name>"` in a benchmark json and returns the value that follows it
+int baseline_value(const char *json, const char *name, double *value) {
+    char key[96];
+    snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+    const char *p = strstr(json, key);
+    if (p == NULL) return 1;
+    p = strstr(p, "\"value\":");
+    if (p == NULL) return 1;
+    *value = strtod(p + strlen("\"value\":"), NULL);
+    return 0;
+}
+
+// return the number of cases slower than baseline by more than `threshold` (relative)
+int compare_baseline(const char *filename, double threshold) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        perror("Error opening baseline");
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    char *json = (char *)malloc(size + 1);
+    size_t n = fread(json, 1, size, file);
+    json[n] = '\0';
+    fclose(file);
+
+    int num_regressions = 0;
+    printf("\nComparing with baseline %s (threshold %.1f%%)\n", filename, threshold * 100);
+    for (int i = 0; i < bench_num_results; i++) {
+        const BenchResult *r = &bench_results[i];
+        double base;
+        if (baseline_value(json, r->name, &base) || base <= 0) {
+            printf("%-32s %12s\n", r->name, "no baseline");
+            continue;
+        }
+        // positive change = slower
+        double change = r->higher_is_better ? (base - r->value) / base : (r->value - base) / base;
+        int regressed = change > threshold;
+        num_regressions += regressed;
+        printf("%-32s %12.3f -> %12.3f %s  %+6.1f%% %s\n", r->name, base, r->value, r->unit,
+               -change * 100, regressed ? "REGRESSION" : "");
+    }
+    free(json);
+    return num_regressions;
+}
+
+
+int main(int argc, char *argv[]) {
+    char data_dir[512] = SAVE_DIR, tmp_dir[512] = RESULT_DIR;
+    char output[512] = RESULT_DIR "benchmark.json", baseline[512] = "", isa[16] = "auto";
+    double threshold = 0.1;
+    int num_cells = 4, repeat = 3;
+    long num_steps = 2000000;
+
+    for (int i = 1; i + 1 < argc; i+=2) {
+        if (strcmp(argv[i], "-data") == 0) {
+            snprintf(data_dir, sizeof(data_dir), "%s", argv[i + 1]);
+        } else if (strcmp(argv[i], "-tmp") == 0) {
+            snprintf(tmp_dir, sizeof(tmp_dir), "%s", argv[i + 1]);
+        } else if (strcmp(argv[i], "-o") == 0) {
+            snprintf(output, sizeof(output), "%s", argv[i + 1]);
+        } else if (strcmp(argv[i], "-baseline") == 0) {
+            snprintf(baseline, sizeof(baseline), "%s", argv[i + 1]);
+        } else if (strcmp(argv[i], "-threshold") == 0) {
+            threshold = strtod(argv[i + 1], NULL);
+        } else if (strcmp(argv[i], "-cells") == 0) {
+            num_cells = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-repeat") == 0) {
+            repeat = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-steps") == 0) {
+            num_steps = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-isa") == 0) {
+            snprintf(isa, sizeof(isa), "%s", argv[i + 1]);
+        } else {
+            printf("Unimplemented option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (num_cells < 1) num_cells = 1;
+    if (num_cells > BENCH_MAX_CELLS) num_cells = BENCH_MAX_CELLS;
+    if (repeat < 1) repeat = 1;
+    if (select_kernel(isa)) return 1;
+
+    BenchCells cells[3];
+    for (int k = 0; k < 3; k++) {
+        if (load_cells(data_dir, BENCH_HCN[k], num_cells, &cells[k])) {
+            printf("No parameter sets found for HCN_%s in %s\n", BENCH_HCN[k], data_dir);
+            return 1;
+        }
+    }
+
+    printf("##########################\n");
+    printf("############# Benchmark \n");
+    printf("##########################\n");
+    bench_dz(num_steps * 10);
+    for (int k = 0; k < 3; k++) bench_f(BENCH_HCN[k], &cells[k], num_steps);
+    bench_kernel_variants(&cells[0], num_steps);
+    bench_dendrite(&cells[2], num_steps);
+    int num_identity_failed = bench_identity(&cells[2]);
+    for (int k = 0; k < 3; k++) bench_calculate_firing_rate(BENCH_HCN[k], &cells[k]);
+    for (int k = 0; k < 3; k++) bench_spike_simulation(BENCH_HCN[k], &cells[k]);
+    bench_full_simulation(&cells[2], tmp_dir, repeat);
+    bench_raster_writer(&cells[0], tmp_dir, repeat);
+
+    if (write_json(output)) return 1;
+    if (num_identity_failed > 0) {
+        printf("Bit-identity check: %d of 3 copies of f() differ from it\n", num_identity_failed);
+        return 1;
+    }
+    if (baseline[0] != '\0') {
+        int num_regressions = compare_baseline(baseline, threshold);
+        if (num_regressions > 0) {
+            printf("%d case(s) regressed by more than %.1f%%\n", num_regressions, threshold * 100);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,258 @@
+// cell.h
+// Split cell layout: State of bio_data/SNrModel.h keeps the 10 Gate structs and the constant parameters next to the
+// evolving variables (~900 bytes per cell). Here the read-only part is a CellParams block shared by every cell of a
+// condition (gate parameters packed as in gates.h), and each cell is a compact CellState (~200 bytes) holding the
+// evolving variables plus its own I_app / g_HCN_*. cell_step() is f() on that layout and bit-identical to it;
+// cell_step_packed() uses the vectorized gate update of gates.h.
+#ifndef CELL_H
+#define CELL_H
+#include "bio_data/SNrModel.h"
+#include "gates.h"
+
+typedef struct {
+    GatePack gates;  // in the order of the dz() calls of f(), m_HCN twice (som, den)
+
+    // Synapse plasticity, dimensionless
+    double D_0;
+    double F_0;
+    double D_m;
+    double F_m;
+
+    // Synaptic weights and time constants
+    double W_GPe;
+    double W_Str;
+    double W_SNr;
+    double tau_GABA_som;
+    double tau_GABA_den;
+
+    // Electrical parameters in mV
+    double V_th;
+    double I_den;
+    double E_leak;
+} CellParams;
+
+typedef struct {
+    // Simulation time in ms
+    double time;
+
+    // Membrane potentials in mV
+    double V_s;
+    double V_d;
+
+    // Gate activation levels, same order as State (consecutive, see gates.h)
+    double m_Na_f;
+    double h_Na_f;
+    double s_Na_f;
+    double m_Na_p;
+    double h_Na_p;
+    double m_K;
+    double h_K;
+    double m_Ca;
+    double h_Ca;
+    double m_HCN_som;
+    double m_HCN_den;
+
+    // Synapse plasticity, ion concentrations and synaptic conductances
+    double D;
+    double F;
+    double Ca_in;
+    double Cl_som;
+    double Cl_den;
+    double g_GABA_som;
+    double g_GABA_den;
+
+    // Per-cell parameters (varied across the cells of a condition)
+    double I_app;
+    double g_HCN_som;
+    double g_HCN_den;
+
+    // Stimulations, boolean
+    int GPe_stim;
+    int Str_stim;
+    int SNr_stim;
+} CellState;
+
+_Static_assert(offsetof(CellState, m_HCN_den) - offsetof(CellState, m_Na_f) == (NUM_PACKED_GATES - 1) * sizeof(double),
+               "gate activation levels must be contiguous in CellState");
+
+
+// ###################################################################
+// ############              Conversion                 ##############
+// ###################################################################
+
+CellParams params_from_state(const State *restrict s) {
+    CellParams p;
+    gate_pack(&p.gates, s);
+    p.D_0 = s->D_0;
+    p.F_0 = s->F_0;
+    p.D_m = s->D_m;
+    p.F_m = s->F_m;
+    p.W_GPe = s->W_GPe;
+    p.W_Str = s->W_Str;
+    p.W_SNr = s->W_SNr;
+    p.tau_GABA_som = s->tau_GABA_som;
+    p.tau_GABA_den = s->tau_GABA_den;
+    p.V_th = s->V_th;
+    p.I_den = s->I_den;
+    p.E_leak = s->E_leak;
+    return p;
+}
+
+CellState cell_from_state(const State *restrict s) {
+    CellState c;
+    c.time = s->time;
+    c.V_s = s->V_s;
+    c.V_d = s->V_d;
+    memcpy(&c.m_Na_f, &s->m_Na_f, NUM_PACKED_GATES * sizeof(double));
+    c.D = s->D;
+    c.F = s->F;
+    c.Ca_in = s->Ca_in;
+    c.Cl_som = s->Cl_som;
+    c.Cl_den = s->Cl_den;
+    c.g_GABA_som = s->g_GABA_som;
+    c.g_GABA_den = s->g_GABA_den;
+    c.I_app = s->I_app;
+    c.g_HCN_som = s->g_HCN_som;
+    c.g_HCN_den = s->g_HCN_den;
+    c.GPe_stim = s->GPe_stim;
+    c.Str_stim = s->Str_stim;
+    c.SNr_stim = s->SNr_stim;
+    return c;
+}
+
+// write the variables of `c` back into `s` (the parameters of `s` are left as they are)
+void cell_to_state(State *restrict s, const CellState *restrict c) {
+    s->time = c->time;
+    s->V_s = c->V_s;
+    s->V_d = c->V_d;
+    memcpy(&s->m_Na_f, &c->m_Na_f, NUM_PACKED_GATES * sizeof(double));
+    s->D = c->D;
+    s->F = c->F;
+    s->Ca_in = c->Ca_in;
+    s->Cl_som = c->Cl_som;
+    s->Cl_den = c->Cl_den;
+    s->g_GABA_som = c->g_GABA_som;
+    s->g_GABA_den = c->g_GABA_den;
+    s->I_app = c->I_app;
+    s->g_HCN_som = c->g_HCN_som;
+    s->g_HCN_den = c->g_HCN_den;
+    s->GPe_stim = c->GPe_stim;
+    s->Str_stim = c->Str_stim;
+    s->SNr_stim = c->SNr_stim;
+}
+
+
+// ###################################################################
+// ############                 Kernel                  ##############
+// ###################################################################
+
+// dz() of lane i of a GatePack, same operations as dz()
+static inline void dz_lane(const GatePack *restrict pack, int i, double *restrict z, double V, double dt) {
+    double z_0 = (1. - pack->x_min[i]) / (1. + exp((pack->V_z[i] - V) / pack->k_z[i])); // logistic function
+    double tau = pack->tau_0[i] + (pack->tau_1[i] - pack->tau_0[i]) /
+                 (exp((pack->V_tau[i] - V) / pack->sig_0[i]) + exp((pack->V_tau[i] - V) / pack->sig_1[i]));
+    double dz = (z_0 - *z) * (1 - exp(-dt / tau));
+    *z += dz;
+}
+
+// f() of bio_data/SNrModel.h on the split layout, `packed` (a constant after inlining) selects dz_packed()
+static inline int cell_step_impl(const CellParams *restrict p, CellState *restrict c, double dt, int packed) {
+    // Reversal potentials in mV
+    double E_Ca = V_T * log(Ca_out / c->Ca_in) / z_Ca;
+    double E_Cl_som = V_T * log(Cl_out / c->Cl_som) / z_Cl;
+    double E_Cl_den = V_T * log(Cl_out / c->Cl_den) / z_Cl;
+    double E_GABA_som = V_T * log((p_Cl * Cl_out + p_HCO3 * HCO3_out) / (p_Cl * c->Cl_som + p_HCO3 * HCO3_in)) / z_GABA;
+    double E_GABA_den = V_T * log((p_Cl * Cl_out + p_HCO3 * HCO3_out) / (p_Cl * c->Cl_den + p_HCO3 * HCO3_in)) / z_GABA;
+
+    // Outward currents in pA/pF = mV/ms
+    double I_Na_f = g_Na_f * pow(c->m_Na_f, 3) * c->h_Na_f * c->s_Na_f * (c->V_s - E_Na);
+    double I_Na_p = g_Na_p * pow(c->m_Na_p, 3) * c->h_Na_p * (c->V_s - E_Na);
+    double I_K = g_K * pow(c->m_K, 4) * c->h_K * (c->V_s - E_K);
+    double I_Ca = g_Ca * c->m_Ca * c->h_Ca * (c->V_s - E_Ca);
+    double I_leak = g_leak * (c->V_s - p->E_leak);
+    double I_DS = g_C / C_som * (c->V_s - c->V_d);
+    double I_HCN_som = c->g_HCN_som * c->m_HCN_som * (c->V_s - E_HCN);
+    double I_GABA_som = c->g_GABA_som * (c->V_s - E_GABA_som);
+
+    double m_SK = 1. / (1. + pow(k_SK / c->Ca_in, n_SK));
+    double I_SK = g_SK * m_SK * (c->V_s - E_K);
+
+    double I_SD = g_C / C_den * (c->V_d - c->V_s);
+    double I_TRPC3 = g_TRPC3 * (c->V_d - E_TRPC3);
+    double I_HCN_den = c->g_HCN_den * c->m_HCN_den * (c->V_d - E_HCN);
+    double I_GABA_den = c->g_GABA_den * (c->V_d - E_GABA_den);
+
+    double chi_som = (E_HCO3 - E_GABA_som) / (E_HCO3 - E_Cl_som);
+    double chi_den = (E_HCO3 - E_GABA_den) / (E_HCO3 - E_Cl_den);
+    double I_chi_som = chi_som * (c->g_GABA_som + g_ton_som) * (c->V_s - E_Cl_som);
+    double I_chi_den = chi_den * (c->g_GABA_den + g_ton_den) * (c->V_d - E_Cl_den);
+    double I_KCC2_som = g_KCC2_som * (E_K - E_Cl_som);
+    double I_KCC2_den = g_KCC2_den * (E_K - E_Cl_den);
+
+    double dVs_dt = -(I_Na_f + I_Na_p + I_K + I_Ca + I_leak + I_SK + I_DS + I_HCN_som + I_GABA_som) + c->I_app / C_som;
+    double dVd_dt = -(I_SD + I_TRPC3 + I_HCN_den + I_GABA_den) + p->I_den / C_den;
+
+    // State variable updates
+    c->time += dt;
+    double *z = &c->m_Na_f;
+    if (packed) {
+        double z_pack[GATE_PACK_WIDTH], V[GATE_PACK_WIDTH];
+        memcpy(z_pack, z, NUM_PACKED_GATES * sizeof(double));
+        for (int i = NUM_PACKED_GATES; i < GATE_PACK_WIDTH; i++) z_pack[i] = z[0];
+        for (int i = 0; i < GATE_PACK_WIDTH; i++) V[i] = c->V_s;
+        V[NUM_PACKED_GATES - 1] = c->V_d;  // m_HCN_den
+        dz_packed(&p->gates, z_pack, V, dt);
+        memcpy(z, z_pack, NUM_PACKED_GATES * sizeof(double));
+    } else {
+        for (int i = 0; i < NUM_PACKED_GATES - 1; i++) dz_lane(&p->gates, i, &z[i], c->V_s, dt);
+        dz_lane(&p->gates, NUM_PACKED_GATES - 1, &z[NUM_PACKED_GATES - 1], c->V_d, dt);
+    }
+
+    c->Ca_in += dt * (Ca_min - c->Ca_in) / tau_Ca;
+    c->Ca_in -= dt * alpha_Ca * C_som * I_Ca;
+
+    c->Cl_som += dt * (c->Cl_den - c->Cl_som) / tau_SD;
+    c->Cl_den += dt * (c->Cl_som - c->Cl_den) / tau_DS;
+    c->Cl_som += dt * alpha_Cl_som * C_som * (I_KCC2_som + I_chi_som);
+    c->Cl_den += dt * alpha_Cl_den * C_den * (I_KCC2_den + I_chi_den);
+
+    c->g_GABA_som *= exp(-dt / p->tau_GABA_som);
+    c->g_GABA_den *= exp(-dt / p->tau_GABA_den);
+    c->D += (p->D_0 - c->D) * (1 - exp(-dt / tau_D));
+    c->F += (p->F_0 - c->F) * (1 - exp(-dt / tau_F));
+
+    c->g_GABA_som += p->W_SNr * c->SNr_stim;
+    if (c->GPe_stim) {
+        c->g_GABA_som += p->W_GPe * c->D;
+        c->D += alpha_D * (p->D_m - c->D);
+    }
+    if (c->Str_stim) {
+        c->g_GABA_den += p->W_Str * c->F;
+        c->F += alpha_F * (p->F_m - c->F);
+    }
+
+    double V_0 = c->V_s;
+    c->V_s += dt * dVs_dt;
+    c->V_d += dt * dVd_dt;
+    return (V_0 < p->V_th) && (c->V_s >= p->V_th);
+}
+
+int cell_step(const CellParams *restrict p, CellState *restrict c, double dt) {
+    return cell_step_impl(p, c, dt, 0);
+}
+
+int cell_step_packed(const CellParams *restrict p, CellState *restrict c, double dt) {
+    return cell_step_impl(p, c, dt, 1);
+}
+
+// f() with the packed gate update on a State, for the State-based kernel dispatch (splits the State every step, so
+// only single steps use it: the benchmark; the runs of simulation.h and check.h split once and use kernel_step)
+static inline int f_packed(State *restrict x, double dt) {
+    CellParams p = params_from_state(x);
+    CellState c = cell_from_state(x);
+    int spike = cell_step_impl(&p, &c, dt, 1);
+    cell_to_state(x, &c);
+    return spike;
+}
+
+#endif
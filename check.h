@@ -0,0 +1,81 @@
+// check.h
+// Differential check of the selected (fast) kernel against the reference f() of bio_data/SNrModel.h.
+// Both kernels integrate copies of the same cell side by side with the same stimulation protocol: f() on the State,
+// the kernel step (KernelStep, as used by the runs of simulation.h) on its CellParams/CellState split.
+#ifndef CHECK_H
+#define CHECK_H
+#include "simulation.h"
+#include <math.h>
+
+#define CHECK_DIVERGENCE_mV 1.0  // |V_s(reference) - V_s(fast)| that counts as diverged
+
+typedef struct {
+    int num_spikes_ref;
+    int num_spikes_fast;
+    double rms;               // spike-time RMS error over index-matched spikes, in ms
+    double first_divergence;  // first time the somatic voltages differ by CHECK_DIVERGENCE_mV, -1 if never
+} CheckResult;
+
+typedef struct {
+    int max_spike_diff;  // tolerated |num_spikes_ref - num_spikes_fast|
+    double max_rms;      // tolerated spike-time RMS error in ms
+} CheckTolerance;
+
+
+CheckResult compare_kernels(const State *cell, KernelStep fast, int duration, double GPe_stim_time,
+                            double Str_stim_time) {
+    State ref = *cell;
+    const CellParams p = params_from_state(cell);
+    CellState test = cell_from_state(cell);
+    Spikes ref_spikes = spikes_new(), fast_spikes = spikes_new();
+
+    CheckResult result = {0, 0, 0, -1};
+    for (int i = 0; i < duration*CONFIG_1ms_step_num; i++) {
+        set_stim(&ref, i, GPe_stim_time, Str_stim_time);
+        set_cell_stim(&test, i, GPe_stim_time, Str_stim_time);
+        if (f(&ref, CONFIG_dt)) {
+            spikes_append(&ref_spikes, ref.time);
+        }
+        if (fast(&p, &test, CONFIG_dt)) {
+            spikes_append(&fast_spikes, test.time);
+        }
+        if (result.first_divergence < 0 && fabs(ref.V_s - test.V_s) >= CHECK_DIVERGENCE_mV) {
+            result.first_divergence = ref.time;
+        }
+    }
+
+    int num_matched = ref_spikes.num_spikes < fast_spikes.num_spikes ? ref_spikes.num_spikes : fast_spikes.num_spikes;
+    double sum = 0;
+    for (int i = 0; i < num_matched; i++) {
+        double diff = ref_spikes.spike_times[i] - fast_spikes.spike_times[i];
+        sum += diff * diff;
+    }
+    result.num_spikes_ref = ref_spikes.num_spikes;
+    result.num_spikes_fast = fast_spikes.num_spikes;
+    result.rms = num_matched > 0 ? sqrt(sum / num_matched) : 0;
+    free(ref_spikes.spike_times);
+    free(fast_spikes.spike_times);
+    return result;
+}
+
+// run every cell through both kernels, print one line per cell
+// return the number of cells outside the tolerance
+int check_against_reference(const State *cells, int num_cells, int duration, double GPe_stim_time,
+                            double Str_stim_time, CheckTolerance tol) {
+    int num_failed = 0;
+    printf("Checking kernel %s against reference on %d cell(s) \n", kernel_name, num_cells);
+    for (int j = 0; j < num_cells; j++) {
+        CheckResult r = compare_kernels(&cells[j], kernel_step, duration, GPe_stim_time, Str_stim_time);
+        int failed = abs(r.num_spikes_ref - r.num_spikes_fast) > tol.max_spike_diff || r.rms > tol.max_rms;
+        num_failed += failed;
+        printf("check #%d: I_app: %f, g_HCN_som: %f, g_HCN_den: %f, spikes ref/fast: %d/%d, RMS: %f ms, "
+               "first divergence: %.3f ms %s\n", j, cells[j].I_app, cells[j].g_HCN_som, cells[j].g_HCN_den,
+               r.num_spikes_ref, r.num_spikes_fast, r.rms, r.first_divergence,
+               failed ? "FAILED" : "ok");
+    }
+    printf("Kernel check: %d/%d cell(s) within tolerance (spikes: %d, RMS: %f ms) \n",
+           num_cells - num_failed, num_cells, tol.max_spike_diff, tol.max_rms);
+    return num_failed;
+}
+
+#endif
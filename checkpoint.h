@@ -0,0 +1,213 @@
+// checkpoint.h
+// Checkpoint/restore of step3 batch runs, so that a run that was stopped (e.g. a preempted node) continues with
+// -resume 1 and produces the same raster and summary, bit for bit, as an uninterrupted one. A checkpoint holds the
+// cell in progress as a complete State (every field of params.h, gate parameters included) with its spikes so far
+// and its step, the raster file length after the last finished cell and the streaming summary. Checkpoints are due
+// after a simulated-time or a wall-time interval, checked once per simulated ms, and written atomically (temporary
+// file + rename). A checkpoint only restores a run with the same setup and kernel (see the fingerprint).
+// utils.py checkpoint_reader() loads it for inspection.
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#include "simulation.h"
+#include "analysis.h"
+#include "params.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef _WIN32
+    #include <io.h>
+    #define CHECKPOINT_TRUNCATE(file, size) _chsize_s(_fileno(file), size)
+#else
+    #include <unistd.h>
+    #define CHECKPOINT_TRUNCATE(file, size) ftruncate(fileno(file), size)
+#endif
+
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_HEADER 14
+
+typedef struct {
+    char filename[512];
+    uint64_t fingerprint;       // setup of the run, see checkpoint_hash()
+    double interval_sim;        // ms of simulated time between checkpoints, 0: not by simulated time
+    double interval_wall;       // s of wall time between checkpoints, 0: not by wall time
+    double simulated_ms;        // since the start of the run, restored on resume
+    double last_sim;            // simulated_ms and wall time of the last checkpoint
+    double last_wall;
+    int num_sim;
+    FILE *raster;               // NULL without raster
+    long raster_offset;         // raster length after the last finished cell
+    SpikeSummary *summary;      // NULL without summary
+} Checkpoint;
+
+// position of a run, the cell in progress and its spikes so far
+typedef struct {
+    int cell;
+    long step;
+    State state;
+    Spikes spikes;
+} CheckpointPosition;
+
+
+// FNV-1a
+static inline uint64_t checkpoint_hash(const void *data, size_t size, uint64_t hash) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t i = 0; i < size; i++) hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    return hash;
+}
+
+// checkpoint_hash() of every field of params.h, the model of a run
+static inline uint64_t checkpoint_hash_state(const State *s, uint64_t hash) {
+    for (int k = 0; k < NUM_STATE_FIELDS; k++) {
+        hash = checkpoint_hash((const char *)s + STATE_FIELDS[k].offset, sizeof(double), hash);
+    }
+    return hash;
+}
+
+// layout (all float64):
+//   version, fingerprint >> 32, fingerprint & 0xffffffff, num_fields, num_sim, cell, step, simulated_ms,
+//   raster_offset (-1 without raster), num_spikes, num_bins, num_trials (0 without summary), baseline_count, stim_time,
+//   state[num_fields] (in the order of STATE_FIELDS), spike_times[num_spikes], psth[num_bins], latency[num_trials]
+int checkpoint_write(Checkpoint *ck, const CheckpointPosition *pos) {
+    INSTR_TIMER_START(writer);
+    const SpikeSummary *summary = ck->summary;
+    int num_bins = summary ? summary->num_bins : 0, num_trials = summary ? summary->num_trials : 0;
+    size_t size = CHECKPOINT_HEADER + NUM_STATE_FIELDS + pos->spikes.num_spikes + num_bins + num_trials;
+    double *data = (double *)malloc(size * sizeof(double));
+    double header[CHECKPOINT_HEADER] = {CHECKPOINT_VERSION, (double)(ck->fingerprint >> 32),
+                                        (double)(ck->fingerprint & 0xffffffffULL), NUM_STATE_FIELDS, ck->num_sim,
+                                        pos->cell, pos->step, ck->simulated_ms, ck->raster ? ck->raster_offset : -1,
+                                        pos->spikes.num_spikes, num_bins, num_trials,
+                                        summary ? summary->baseline_count : 0, summary ? summary->stim_time : -1};
+    memcpy(data, header, sizeof(header));
+    double *values = data + CHECKPOINT_HEADER;
+    for (int k = 0; k < NUM_STATE_FIELDS; k++) {
+        values[k] = *(const double *)((const char *)&pos->state + STATE_FIELDS[k].offset);
+    }
+    values += NUM_STATE_FIELDS;
+    memcpy(values, pos->spikes.spike_times, pos->spikes.num_spikes * sizeof(double));
+    values += pos->spikes.num_spikes;
+    if (summary) {
+        memcpy(values, summary->psth, num_bins * sizeof(double));
+        memcpy(values + num_bins, summary->latency, num_trials * sizeof(double));
+    }
+
+    // the raster up to raster_offset must be on disk before the checkpoint refers to it
+    if (ck->raster) fflush(ck->raster);
+    int status = atomic_write(ck->filename, data, size);
+    if (status) perror("Error writing checkpoint");
+    INSTR_COUNT(INSTR_BYTES_WRITTEN, size * sizeof(double));
+    INSTR_TIMER_STOP(writer, INSTR_WRITER);
+    free(data);
+    ck->last_sim = ck->simulated_ms;
+    ck->last_wall = wall_time();
+    return status;
+}
+
+// restore the position and summary of a checkpoint of the same setup, truncate the raster to its length; 0 on success
+// (`pos->state` must hold the setup state of the run, the fields of the checkpoint are written over it)
+int checkpoint_read(Checkpoint *ck, CheckpointPosition *pos) {
+    FILE *file = fopen(ck->filename, "rb");
+    if (file == NULL) {
+        perror("Error opening checkpoint");
+        return 1;
+    }
+    double header[CHECKPOINT_HEADER];
+    int status = fread(header, sizeof(double), CHECKPOINT_HEADER, file) != CHECKPOINT_HEADER;
+    uint64_t fingerprint = ((uint64_t)header[1] << 32) | (uint64_t)header[2];
+    if (status || (int)header[0] != CHECKPOINT_VERSION || (int)header[3] != NUM_STATE_FIELDS) {
+        printf("Unsupported checkpoint %s \n", ck->filename);
+        fclose(file);
+        return 1;
+    }
+    if (fingerprint != ck->fingerprint || (int)header[4] != ck->num_sim) {
+        printf("Checkpoint %s belongs to a different setup or kernel \n", ck->filename);
+        fclose(file);
+        return 1;
+    }
+    int num_bins = (int)header[10], num_trials = (int)header[11];
+    if ((ck->raster != NULL) != (header[8] >= 0) || (ck->summary != NULL) != (num_bins > 0) ||
+        (ck->summary && num_bins != ck->summary->num_bins)) {
+        printf("Checkpoint %s was written with other outputs \n", ck->filename);
+        fclose(file);
+        return 1;
+    }
+    // at most one spike per step of the cell in progress
+    if (header[5] < 0 || header[5] >= ck->num_sim || header[6] < 0 || header[9] < 0 || header[9] > header[6]) {
+        printf("Corrupt checkpoint %s \n", ck->filename);
+        fclose(file);
+        return 1;
+    }
+    pos->cell = (int)header[5];
+    pos->step = (long)header[6];
+    ck->simulated_ms = ck->last_sim = header[7];
+    ck->raster_offset = (long)header[8];
+    pos->spikes = spikes_new();
+    spikes_reserve(&pos->spikes, (int)header[9]);
+    pos->spikes.num_spikes = (int)header[9];
+
+    double values[NUM_STATE_FIELDS];
+    status = fread(values, sizeof(double), NUM_STATE_FIELDS, file) != (size_t)NUM_STATE_FIELDS;
+    for (int k = 0; k < NUM_STATE_FIELDS; k++) {
+        *(double *)((char *)&pos->state + STATE_FIELDS[k].offset) = values[k];
+    }
+    status |= fread(pos->spikes.spike_times, sizeof(double), pos->spikes.num_spikes, file) !=
+              (size_t)pos->spikes.num_spikes;
+    if (ck->summary) {
+        ck->summary->num_trials = num_trials;
+        ck->summary->baseline_count = header[12];
+        status |= fread(ck->summary->psth, sizeof(double), num_bins, file) != (size_t)num_bins;
+        status |= fread(ck->summary->latency, sizeof(double), num_trials, file) != (size_t)num_trials;
+    }
+    fclose(file);
+    if (status) {
+        printf("Truncated checkpoint %s \n", ck->filename);
+        free(pos->spikes.spike_times);
+        return 1;
+    }
+    if (ck->raster) {
+        fflush(ck->raster);
+        status = CHECKPOINT_TRUNCATE(ck->raster, ck->raster_offset) != 0 ||
+                 fseek(ck->raster, ck->raster_offset, SEEK_SET) != 0;
+        if (status) perror("Error restoring the raster");
+    }
+    ck->last_wall = wall_time();
+    return status;
+}
+
+// whether a checkpoint is due after one more simulated ms
+static inline int checkpoint_due(Checkpoint *ck) {
+    ck->simulated_ms += 1;
+    return (ck->interval_sim > 0 && ck->simulated_ms - ck->last_sim >= ck->interval_sim) ||
+           (ck->interval_wall > 0 && wall_time() - ck->last_wall >= ck->interval_wall);
+}
+
+// cell_spike_simulation() of the cell `pos` (pos->state is its setup state, `c` its variables, continued from
+// pos->step with pos->spikes), writing checkpoints when due; `duration` is the whole run of the cell in ms
+void checkpoint_simulation(const CellParams *restrict p, CellState *restrict c, CheckpointPosition *pos, Checkpoint *ck,
+                           int duration, double GPe_stim_time, double Str_stim_time) {
+    long num_steps = (long)duration * CONFIG_1ms_step_num, start = pos->step;
+    for (long i = start; i < num_steps;) {
+        // up to the next ms boundary
+        long end = (i / CONFIG_1ms_step_num + 1) * CONFIG_1ms_step_num;
+        if (end > num_steps) end = num_steps;
+        INSTR_TIMER_START(kernel);
+        for (; i < end; i++) {
+            set_cell_stim(c, i, GPe_stim_time, Str_stim_time);
+            if (kernel_step(p, c, CONFIG_dt)) {
+                spikes_append(&pos->spikes, c->time);
+            }
+        }
+        INSTR_TIMER_STOP(kernel, INSTR_KERNEL);
+        if (i % CONFIG_1ms_step_num == 0 && checkpoint_due(ck)) {
+            pos->step = i;
+            cell_to_state(&pos->state, c);
+            checkpoint_write(ck, pos);
+        }
+    }
+    INSTR_COUNT(INSTR_STEPS, num_steps - start);
+    INSTR_COUNT(INSTR_SPIKES, pos->spikes.num_spikes);
+    INSTR_COUNT(INSTR_SIMULATIONS, 1);
+    pos->step = num_steps;
+}
+
+#endif
@@ -0,0 +1,361 @@
+// dendrite.h
+// N-compartment generalization of the dendrite: compartment 0 is the soma of f() (CellState), compartments 1..N-1
+// form a dendritic tree, each with its own voltage, HCN gate and density, TRPC3, Str GABA synapse and chloride pool.
+// The tree is read from a morphology file (see morphology_read()) or generated (morphology_chain()).
+//
+// Axial coupling is integrated with the theta method: theta = 0 is explicit and performs the operations of f() in
+// the same order, so the 2-compartment morphology (bio_data/morphology_2comp.txt) reproduces f() bit for bit;
+// theta > 0 solves the coupled voltages with Hines elimination (parents numbered before their children), which stays
+// stable for fine discretizations. Every step is O(N).
+// The dendritic members of CellState (V_d, m_HCN_den, Cl_den, g_GABA_den) are replaced by the Dendrite arrays.
+#ifndef DENDRITE_H
+#define DENDRITE_H
+#include "simulation.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+    int num;            // compartments, 0 is the soma
+    int *parent;        // parent[k] < k, -1 for the soma
+    double *C;          // capacitance in pF
+    double *g_axial;    // coupling conductance to the parent in nS
+    double *HCN;        // HCN density relative to CellState.g_HCN_den (dendritic compartments)
+    double *TRPC3;      // TRPC3 conductance in nS/pF (dendritic compartments)
+    double *w_Str;      // share of the Str synaptic weight W_Str
+    double *w_I_den;    // share of the injected dendritic current I_den
+    double *alpha_Cl;   // charge to chloride concentration conversion in mM/fC
+    double *tau_up;     // chloride exchange time constant, parent pool towards this compartment, in ms
+    double *tau_down;   // chloride exchange time constant, this pool towards the parent, in ms
+    // derived coupling rates in 1/ms
+    double *a_up;       // g_axial / C (this compartment)
+    double *a_down;     // g_axial / C (parent)
+} Morphology;
+
+typedef struct {
+    double *V;          // membrane potential in mV, V[0] mirrors CellState.V_s
+    double *m_HCN;      // HCN activation
+    double *g_GABA;     // Str synaptic conductance in nS/pF
+    double *Cl;         // chloride concentration in mM
+    // per-step work arrays
+    double *E_Cl;
+    double *E_GABA;
+    double *I_chi;
+    double *I_axial;
+    double *dV_dt;      // non-axial part (theta > 0) or full derivative (theta = 0)
+    double *diag;
+    double *rhs;
+} Dendrite;
+
+
+// ###################################################################
+// ############               Morphology                ##############
+// ###################################################################
+
+int morphology_alloc(Morphology *m, int num) {
+    m->num = num;
+    m->parent = (int *)malloc(num * sizeof(int));
+    double **columns[] = {&m->C, &m->g_axial, &m->HCN, &m->TRPC3, &m->w_Str, &m->w_I_den, &m->alpha_Cl,
+                          &m->tau_up, &m->tau_down, &m->a_up, &m->a_down};
+    int failed = m->parent == NULL;
+    for (size_t i = 0; i < sizeof(columns) / sizeof(columns[0]); i++) {
+        *columns[i] = (double *)calloc(num, sizeof(double));
+        failed |= *columns[i] == NULL;
+    }
+    return failed;
+}
+
+void morphology_free(Morphology *m) {
+    free(m->parent);
+    free(m->C);
+    free(m->g_axial);
+    free(m->HCN);
+    free(m->TRPC3);
+    free(m->w_Str);
+    free(m->w_I_den);
+    free(m->alpha_Cl);
+    free(m->tau_up);
+    free(m->tau_down);
+    free(m->a_up);
+    free(m->a_down);
+}
+
+// check the tree and derive the coupling rates, return 0 on success
+int morphology_finalize(Morphology *m) {
+    if (m->num < 2 || m->parent[0] != -1) {
+        printf("Morphology: compartment 0 must be the soma (parent -1) with at least one dendritic compartment\n");
+        return 1;
+    }
+    for (int k = 1; k < m->num; k++) {
+        if (m->parent[k] < 0 || m->parent[k] >= k) {
+            printf("Morphology: compartment %d must have a parent numbered before it\n", k);
+            return 1;
+        }
+        if (m->C[k] <= 0 || m->g_axial[k] <= 0) {
+            printf("Morphology: compartment %d needs positive C and g_axial\n", k);
+            return 1;
+        }
+        m->a_up[k] = m->g_axial[k] / m->C[k];
+        m->a_down[k] = m->g_axial[k] / m->C[m->parent[k]];
+    }
+    return 0;
+}
+
+// text file, one compartment per line in order, '#' starts a comment:
+//   id parent C g_axial HCN g_TRPC3 w_Str w_I_den alpha_Cl tau_up tau_down
+// the soma line (id 0, parent -1) only uses C and alpha_Cl
+int morphology_read(const char *filename, Morphology *m) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        perror("Error opening morphology");
+        return 1;
+    }
+    char line[1024];
+    int num = 0;
+    while (fgets(line, sizeof(line), file)) {
+        int id;
+        if (line[0] != '#' && sscanf(line, "%d", &id) == 1) num++;
+    }
+    if (num == 0 || morphology_alloc(m, num)) {
+        printf("Morphology: no compartments in %s\n", filename);
+        fclose(file);
+        return 1;
+    }
+    rewind(file);
+    int k = 0;
+    while (k < num && fgets(line, sizeof(line), file)) {
+        int id, parent;
+        if (line[0] == '#' || sscanf(line, "%d", &id) != 1) continue;
+        int n = sscanf(line, "%d %d %lf %lf %lf %lf %lf %lf %lf %lf %lf", &id, &parent, &m->C[k], &m->g_axial[k],
+                       &m->HCN[k], &m->TRPC3[k], &m->w_Str[k], &m->w_I_den[k], &m->alpha_Cl[k],
+                       &m->tau_up[k], &m->tau_down[k]);
+        if (n != 11 || id != k) {
+            printf("Morphology: malformed line for compartment %d in %s\n", k, filename);
+            fclose(file);
+            morphology_free(m);
+            return 1;
+        }
+        m->parent[k++] = parent;
+    }
+    fclose(file);
+    if (morphology_finalize(m)) {
+        morphology_free(m);
+        return 1;
+    }
+    printf("Morphology: %d compartments from %s\n", m->num, filename);
+    return 0;
+}
+
+// unbranched cable of num - 1 equal segments splitting the dendrite of f(): capacitance, synaptic weight and
+// injected current are divided among the segments, axial conductance and chloride conversion scale with the count.
+// num = 2 gives the 2-compartment model.
+int morphology_chain(Morphology *m, int num) {
+    if (num < 2 || morphology_alloc(m, num)) return 1;
+    int n = num - 1;
+    m->parent[0] = -1;
+    m->C[0] = C_som;
+    m->alpha_Cl[0] = alpha_Cl_som;
+    for (int k = 1; k < num; k++) {
+        m->parent[k] = k - 1;
+        m->C[k] = (double)C_den / n;
+        m->g_axial[k] = g_C * n;
+        m->HCN[k] = 1;
+        m->TRPC3[k] = g_TRPC3;
+        m->w_Str[k] = 1. / n;
+        m->w_I_den[k] = 1. / n;
+        m->alpha_Cl[k] = alpha_Cl_den * n;
+        m->tau_up[k] = tau_SD;
+        m->tau_down[k] = tau_DS;
+    }
+    return morphology_finalize(m);
+}
+
+
+// ###################################################################
+// ############               Dendrite                  ##############
+// ###################################################################
+
+// all dendritic compartments start from the dendrite of `c`
+int dendrite_init(Dendrite *d, const Morphology *m, const CellState *c) {
+    double **arrays[] = {&d->V, &d->m_HCN, &d->g_GABA, &d->Cl, &d->E_Cl, &d->E_GABA, &d->I_chi, &d->I_axial,
+                         &d->dV_dt, &d->diag, &d->rhs};
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); i++) {
+        *arrays[i] = (double *)calloc(m->num, sizeof(double));
+        failed |= *arrays[i] == NULL;
+    }
+    if (failed) return 1;
+    d->V[0] = c->V_s;
+    d->Cl[0] = c->Cl_som;
+    for (int k = 1; k < m->num; k++) {
+        d->V[k] = c->V_d;
+        d->m_HCN[k] = c->m_HCN_den;
+        d->g_GABA[k] = c->g_GABA_den;
+        d->Cl[k] = c->Cl_den;
+    }
+    return 0;
+}
+
+void dendrite_free(Dendrite *d) {
+    free(d->V);
+    free(d->m_HCN);
+    free(d->g_GABA);
+    free(d->Cl);
+    free(d->E_Cl);
+    free(d->E_GABA);
+    free(d->I_chi);
+    free(d->I_axial);
+    free(d->dV_dt);
+    free(d->diag);
+    free(d->rhs);
+}
+
+// solve (1/dt - theta L) V' = V/dt + dV_dt + (1 - theta) L V on the tree, L the axial coupling (Hines elimination)
+static void dendrite_solve(const Morphology *restrict m, Dendrite *restrict d, double theta, double dt) {
+    int num = m->num;
+    for (int k = 0; k < num; k++) {
+        d->diag[k] = 1. / dt;
+        d->rhs[k] = d->V[k] / dt + d->dV_dt[k] - (1. - theta) * d->I_axial[k];
+    }
+    for (int k = 1; k < num; k++) {
+        d->diag[k] += theta * m->a_up[k];
+        d->diag[m->parent[k]] += theta * m->a_down[k];
+    }
+    // eliminate the children from their parents, leaves first
+    for (int k = num - 1; k > 0; k--) {
+        int p = m->parent[k];
+        double factor = theta * m->a_down[k] / d->diag[k];  // A[p][k] / A[k][k]
+        d->diag[p] -= factor * theta * m->a_up[k];         // A[p][k] A[k][p] / A[k][k]
+        d->rhs[p] += factor * d->rhs[k];
+    }
+    // back substitution, root first
+    d->V[0] = d->rhs[0] / d->diag[0];
+    for (int k = 1; k < num; k++) {
+        d->V[k] = (d->rhs[k] + theta * m->a_up[k] * d->V[m->parent[k]]) / d->diag[k];
+    }
+}
+
+// one step of the cell with the dendritic tree of `m`, soma variables in `c`, dendritic ones in `d`
+// theta = 0: explicit (f() for the 2-compartment morphology), theta > 0: implicit axial coupling
+int dendrite_step(const CellParams *restrict p, const Morphology *restrict m, CellState *restrict c,
+                  Dendrite *restrict d, double theta, double dt) {
+    int num = m->num;
+    d->V[0] = c->V_s;
+    d->Cl[0] = c->Cl_som;
+
+    // Reversal potentials in mV
+    double E_Ca = V_T * log(Ca_out / c->Ca_in) / z_Ca;
+    for (int k = 0; k < num; k++) {
+        d->E_Cl[k] = V_T * log(Cl_out / d->Cl[k]) / z_Cl;
+        d->E_GABA[k] = V_T * log((p_Cl * Cl_out + p_HCO3 * HCO3_out) / (p_Cl * d->Cl[k] + p_HCO3 * HCO3_in)) / z_GABA;
+    }
+
+    // axial currents in pA/pF, a compartment's own coupling to its parent first, then its children
+    for (int k = 0; k < num; k++) d->I_axial[k] = 0;
+    for (int k = 1; k < num; k++) d->I_axial[k] = m->a_up[k] * (d->V[k] - d->V[m->parent[k]]);
+    for (int k = 1; k < num; k++) d->I_axial[m->parent[k]] += m->a_down[k] * (d->V[m->parent[k]] - d->V[k]);
+
+    // Somatic currents in pA/pF = mV/ms
+    double I_Na_f = g_Na_f * pow(c->m_Na_f, 3) * c->h_Na_f * c->s_Na_f * (c->V_s - E_Na);
+    double I_Na_p = g_Na_p * pow(c->m_Na_p, 3) * c->h_Na_p * (c->V_s - E_Na);
+    double I_K = g_K * pow(c->m_K, 4) * c->h_K * (c->V_s - E_K);
+    double I_Ca = g_Ca * c->m_Ca * c->h_Ca * (c->V_s - E_Ca);
+    double I_leak = g_leak * (c->V_s - p->E_leak);
+    double I_DS = theta == 0 ? d->I_axial[0] : 0;
+    double I_HCN_som = c->g_HCN_som * c->m_HCN_som * (c->V_s - E_HCN);
+    double I_GABA_som = c->g_GABA_som * (c->V_s - d->E_GABA[0]);
+
+    double m_SK = 1. / (1. + pow(k_SK / c->Ca_in, n_SK));
+    double I_SK = g_SK * m_SK * (c->V_s - E_K);
+
+    double chi_som = (E_HCO3 - d->E_GABA[0]) / (E_HCO3 - d->E_Cl[0]);
+    d->I_chi[0] = chi_som * (c->g_GABA_som + g_ton_som) * (c->V_s - d->E_Cl[0]);
+    double I_KCC2_som = g_KCC2_som * (E_K - d->E_Cl[0]);
+    d->dV_dt[0] = -(I_Na_f + I_Na_p + I_K + I_Ca + I_leak + I_SK + I_DS + I_HCN_som + I_GABA_som) + c->I_app / m->C[0];
+
+    // Dendritic currents
+    for (int k = 1; k < num; k++) {
+        double I_SD = theta == 0 ? d->I_axial[k] : 0;
+        double I_TRPC3 = m->TRPC3[k] * (d->V[k] - E_TRPC3);
+        double I_HCN_den = c->g_HCN_den * m->HCN[k] * d->m_HCN[k] * (d->V[k] - E_HCN);
+        double I_GABA_den = d->g_GABA[k] * (d->V[k] - d->E_GABA[k]);
+        double chi_den = (E_HCO3 - d->E_GABA[k]) / (E_HCO3 - d->E_Cl[k]);
+        d->I_chi[k] = chi_den * (d->g_GABA[k] + g_ton_den) * (d->V[k] - d->E_Cl[k]);
+        d->dV_dt[k] = -(I_SD + I_TRPC3 + I_HCN_den + I_GABA_den) + p->I_den * m->w_I_den[k] / m->C[k];
+    }
+
+    // State variable updates
+    c->time += dt;
+    double *z = &c->m_Na_f;
+    for (int i = 0; i < NUM_PACKED_GATES - 1; i++) dz_lane(&p->gates, i, &z[i], c->V_s, dt);
+    for (int k = 1; k < num; k++) dz_lane(&p->gates, NUM_PACKED_GATES - 1, &d->m_HCN[k], d->V[k], dt);
+
+    c->Ca_in += dt * (Ca_min - c->Ca_in) / tau_Ca;
+    c->Ca_in -= dt * alpha_Ca * C_som * I_Ca;
+
+    // chloride exchange along the tree, parent pool first
+    for (int k = 1; k < num; k++) {
+        int q = m->parent[k];
+        d->Cl[q] += dt * (d->Cl[k] - d->Cl[q]) / m->tau_up[k];
+        d->Cl[k] += dt * (d->Cl[q] - d->Cl[k]) / m->tau_down[k];
+    }
+    d->Cl[0] += dt * m->alpha_Cl[0] * m->C[0] * (I_KCC2_som + d->I_chi[0]);
+    for (int k = 1; k < num; k++) {
+        double I_KCC2_den = g_KCC2_den * (E_K - d->E_Cl[k]);
+        d->Cl[k] += dt * m->alpha_Cl[k] * m->C[k] * (I_KCC2_den + d->I_chi[k]);
+    }
+    c->Cl_som = d->Cl[0];
+
+    c->g_GABA_som *= exp(-dt / p->tau_GABA_som);
+    double decay_den = exp(-dt / p->tau_GABA_den);
+    for (int k = 1; k < num; k++) d->g_GABA[k] *= decay_den;
+    c->D += (p->D_0 - c->D) * (1 - exp(-dt / tau_D));
+    c->F += (p->F_0 - c->F) * (1 - exp(-dt / tau_F));
+
+    c->g_GABA_som += p->W_SNr * c->SNr_stim;
+    if (c->GPe_stim) {
+        c->g_GABA_som += p->W_GPe * c->D;
+        c->D += alpha_D * (p->D_m - c->D);
+    }
+    if (c->Str_stim) {
+        for (int k = 1; k < num; k++) d->g_GABA[k] += p->W_Str * c->F * m->w_Str[k];
+        c->F += alpha_F * (p->F_m - c->F);
+    }
+
+    double V_0 = c->V_s;
+    if (theta == 0) {
+        for (int k = 0; k < num; k++) d->V[k] += dt * d->dV_dt[k];
+    } else {
+        dendrite_solve(m, d, theta, dt);
+    }
+    c->V_s = d->V[0];
+    return (V_0 < p->V_th) && (c->V_s >= p->V_th);
+}
+
+// cell_spike_simulation() with the dendritic tree of `m`, the tree starts from the dendrite of `c`
+Spikes dendrite_spike_simulation(const CellParams *restrict p, const Morphology *restrict m, CellState *restrict c,
+                                 double theta, int duration, double GPe_stim_time, double Str_stim_time) {
+    Spikes spikes = {0};
+    Dendrite d;
+    if (dendrite_init(&d, m, c)) return spikes;
+    spikes = spikes_new();
+    INSTR_TIMER_START(kernel);
+    for (int i = 0; i < duration*CONFIG_1ms_step_num; i++) {
+        set_cell_stim(c, i, GPe_stim_time, Str_stim_time);
+        if (dendrite_step(p, m, c, &d, theta, CONFIG_dt)) {
+            spikes_append(&spikes, c->time);
+        }
+    }
+    INSTR_TIMER_STOP(kernel, INSTR_KERNEL);
+    INSTR_COUNT(INSTR_STEPS, duration*CONFIG_1ms_step_num);
+    INSTR_COUNT(INSTR_SPIKES, spikes.num_spikes);
+    INSTR_COUNT(INSTR_SIMULATIONS, 1);
+    // the first dendritic compartment stands in for the dendrite of f()
+    c->V_d = d.V[1];
+    c->m_HCN_den = d.m_HCN[1];
+    c->g_GABA_den = d.g_GABA[1];
+    c->Cl_den = d.Cl[1];
+    dendrite_free(&d);
+    return spikes;
+}
+
+#endif
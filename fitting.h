@@ -0,0 +1,343 @@
+// fitting.h
+// Evaluation side of the parameter fit (step4_fit_params.c): a candidate is a set of values for named State fields
+// (params.h), applied to a fixed population of model cells (selected I_app / g_HCN pairs) which is stimulated once
+// per recorded condition (GPe, Str). The loss compares the model's normalized PSTH and time-to-recover curve with the
+// recordings exported by step4_export_fit_targets.py.
+// Parameters that only act at or after the stimulation (weights, GABA time constants) leave the trajectory before
+// the stimulation unchanged (g_GABA stays 0), so each cell is then settled to the stimulation once and every candidate
+// only simulates the response. Other parameters (e.g. the HCN gate) need the whole run per candidate.
+#ifndef FITTING_H
+#define FITTING_H
+#include "simulation.h"
+#include "params.h"
+#include <math.h>
+#include <string.h>
+
+#define FIT_TARGET_VERSION 1
+#define FIT_MAX_PARAMS 16
+#define FIT_MAX_BINS 256
+#define FIT_NUM_CONDITIONS 2  // GPe, Str
+
+typedef struct {
+    const char *name;
+    double low;
+    double high;
+    int log_scale;   // search in log(value)
+    int after_stim;  // no effect before the stimulation
+} FitParamDefault;
+
+// default ranges; any other State field (params.h) can be fitted with explicit bounds
+static const FitParamDefault FIT_PARAM_DEFAULTS[] = {
+    {"W_GPe", 1e-3, 0.5, 1, 1},
+    {"W_Str", 1e-3, 1, 1, 1},
+    {"tau_GABA_som", 1, 50, 1, 1},
+    {"tau_GABA_den", 1, 100, 1, 1},
+    {"prop_m_HCN.V_z", -90, -50, 0, 0},
+    {"prop_m_HCN.k_z", -10, -1, 0, 0},
+    {"prop_m_HCN.V_tau", -90, -50, 0, 0},
+    {"prop_m_HCN.tau_1", 300, 10000, 1, 0},
+    {"prop_m_HCN.sig_0", 2, 20, 0, 0},
+    {"prop_m_HCN.sig_1", -20, -2, 0, 0},
+};
+#define FIT_NUM_DEFAULTS ((int)(sizeof(FIT_PARAM_DEFAULTS) / sizeof(FIT_PARAM_DEFAULTS[0])))
+
+typedef struct {
+    char name[64];
+    double low;
+    double high;
+    int log_scale;
+    int after_stim;
+    size_t offset;   // in State
+} FitParam;
+
+// recorded response to one stimulation, see step4_export_fit_targets.py for the layout
+typedef struct {
+    int present;
+    double stim_time;
+    double baseline_start;
+    double baseline_end;
+    double psth_start;
+    double psth_step;
+    double psth_window;
+    int num_psth;
+    double cdf_start;
+    double cdf_step;
+    int num_cdf;
+    double psth[FIT_MAX_BINS];
+    double cdf[FIT_MAX_BINS];
+} FitTarget;
+
+typedef struct {
+    int num_params;
+    FitParam params[FIT_MAX_PARAMS];
+    FitTarget targets[FIT_NUM_CONDITIONS];
+    double cdf_weight;     // weight of the time-to-recover term against the PSTH term
+    int num_cells;
+    State *cells;          // model population with the default parameters, I_app / g_HCN per cell
+    CellState *settled;    // cells at the stimulation step (only when every parameter is after_stim)
+    Spikes *settled_spikes;  // their spikes before the stimulation
+    int stim_step;         // first step of the stimulation
+    int num_steps;         // simulation length in steps
+    long simulated_ms;     // model time simulated by fit_evaluate(), all threads
+} FitProblem;
+
+
+// ###################################################################
+// ############               Setup                     ##############
+// ###################################################################
+
+// "name" or "name:low:high", log scale for positive default ranges; 0 on success
+int fit_param_parse(FitParam *param, const char *spec) {
+    char name[64];
+    double low = NAN, high = NAN;
+    const char *colon = strchr(spec, ':');
+    size_t length = colon ? (size_t)(colon - spec) : strlen(spec);
+    if (length == 0 || length >= sizeof(name)) return 1;
+    memcpy(name, spec, length);
+    name[length] = '\0';
+    if (colon && sscanf(colon + 1, "%lf:%lf", &low, &high) != 2) {
+        printf("Fit: expected name:low:high, got %s\n", spec);
+        return 1;
+    }
+    State s = init_state();
+    double *field = state_field(&s, name);
+    if (field == NULL) {
+        printf("Fit: %s is not a State parameter\n", name);
+        return 1;
+    }
+    memset(param, 0, sizeof(FitParam));
+    strcpy(param->name, name);
+    param->offset = (size_t)((char *)field - (char *)&s);
+    for (int k = 0; k < FIT_NUM_DEFAULTS; k++) {
+        if (strcmp(FIT_PARAM_DEFAULTS[k].name, name) == 0) {
+            param->low = FIT_PARAM_DEFAULTS[k].low;
+            param->high = FIT_PARAM_DEFAULTS[k].high;
+            param->log_scale = FIT_PARAM_DEFAULTS[k].log_scale;
+            param->after_stim = FIT_PARAM_DEFAULTS[k].after_stim;
+            if (!colon) return 0;
+        }
+    }
+    if (!colon) {
+        printf("Fit: no default range for %s, give name:low:high\n", name);
+        return 1;
+    }
+    if (!(low < high)) {
+        printf("Fit: empty range for %s\n", name);
+        return 1;
+    }
+    param->low = low;
+    param->high = high;
+    param->log_scale = param->log_scale && low > 0;
+    return 0;
+}
+
+// parameter value at the normalized coordinate u in [0, 1]
+static inline double fit_param_value(const FitParam *param, double u) {
+    if (param->log_scale) return exp(log(param->low) + u * (log(param->high) - log(param->low)));
+    return param->low + u * (param->high - param->low);
+}
+
+// 0 on success, target->present stays 0 for an empty filename
+int fit_target_read(FitTarget *target, const char *filename) {
+    memset(target, 0, sizeof(FitTarget));
+    if (filename[0] == '\0') return 0;
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        perror("Error opening fit target");
+        return 1;
+    }
+    double header[12], data[2 * FIT_MAX_BINS];
+    int status = fread(header, sizeof(double), 12, file) != 12 || header[0] != FIT_TARGET_VERSION ||
+                 header[8] < 1 || header[8] > FIT_MAX_BINS || header[11] < 1 || header[11] > FIT_MAX_BINS;
+    if (!status) {
+        target->stim_time = header[1];
+        target->baseline_start = header[3];
+        target->baseline_end = header[4];
+        target->psth_start = header[5];
+        target->psth_step = header[6];
+        target->psth_window = header[7];
+        target->num_psth = (int)header[8];
+        target->cdf_start = header[9];
+        target->cdf_step = header[10];
+        target->num_cdf = (int)header[11];
+        size_t n = target->num_psth + target->num_cdf;
+        status = fread(data, sizeof(double), n, file) != n;
+        memcpy(target->psth, data, target->num_psth * sizeof(double));
+        memcpy(target->cdf, data + target->num_psth, target->num_cdf * sizeof(double));
+    }
+    fclose(file);
+    if (status) {
+        printf("Fit: %s is not a version %d fit target\n", filename, FIT_TARGET_VERSION);
+        return 1;
+    }
+    target->present = 1;
+    return 0;
+}
+
+// steps [start, end) with the stimulation of `condition` (0 GPe, 1 Str, -1 none) at stim_time, spikes appended
+static void fit_run(const CellParams *restrict p, CellState *restrict c, int start, int end, int condition,
+                    double stim_time, Spikes *restrict spikes) {
+    for (int i = start; i < end; i++) {
+        set_cell_stim(c, i, condition == 0 ? stim_time : -1, condition == 1 ? stim_time : -1);
+        if (kernel_step(p, c, CONFIG_dt) && spikes->num_spikes < CONFIG_spikes_init_size) {
+            spikes->spike_times[spikes->num_spikes++] = c->time;
+        }
+    }
+    INSTR_COUNT(INSTR_STEPS, end - start);
+    INSTR_COUNT(INSTR_SIMULATIONS, 1);
+}
+
+// the model population and, if every parameter acts after the stimulation only, the cells settled up to it
+void fit_setup(FitProblem *problem, const double *I, const double *g_HCN, const char *HCN, int num_cells) {
+    double stim_time = -1, end_time = 0;
+    for (int k = 0; k < FIT_NUM_CONDITIONS; k++) {
+        const FitTarget *t = &problem->targets[k];
+        if (!t->present) continue;
+        stim_time = t->stim_time;
+        end_time = fmax(end_time, t->psth_start + (t->num_psth - 1) * t->psth_step + t->psth_window / 2);
+        end_time = fmax(end_time, t->cdf_start + (t->num_cdf - 1) * t->cdf_step);
+    }
+    problem->stim_step = (int)ceil(stim_time * CONFIG_1ms_step_num);
+    problem->num_steps = (int)ceil(end_time) * CONFIG_1ms_step_num;
+    problem->num_cells = num_cells;
+    problem->cells = (State *)malloc(num_cells * sizeof(State));
+    for (int j = 0; j < num_cells; j++) {
+        State s = init_state();
+        s.I_app = I[j];
+        if (strcmp(HCN, "som") == 0) s.g_HCN_som = g_HCN[j];
+        if (strcmp(HCN, "den") == 0) s.g_HCN_den = g_HCN[j];
+        problem->cells[j] = s;
+    }
+
+    int after_stim = 1;
+    for (int k = 0; k < problem->num_params; k++) after_stim &= problem->params[k].after_stim;
+    problem->settled = NULL;
+    problem->settled_spikes = NULL;
+    if (!after_stim) return;
+    problem->settled = (CellState *)malloc(num_cells * sizeof(CellState));
+    problem->settled_spikes = (Spikes *)calloc(num_cells, sizeof(Spikes));
+    #pragma omp parallel for schedule(dynamic)
+    for (int j = 0; j < num_cells; j++) {
+        const CellParams p = params_from_state(&problem->cells[j]);
+        CellState c = cell_from_state(&problem->cells[j]);
+        problem->settled_spikes[j].spike_times = (double *)malloc(CONFIG_spikes_init_size * sizeof(double));
+        fit_run(&p, &c, 0, problem->stim_step, -1, -1, &problem->settled_spikes[j]);
+        problem->settled[j] = c;
+    }
+    problem->simulated_ms += (long)num_cells * problem->stim_step / CONFIG_1ms_step_num;
+}
+
+void fit_free(FitProblem *problem) {
+    if (problem->settled_spikes) {
+        for (int j = 0; j < problem->num_cells; j++) free(problem->settled_spikes[j].spike_times);
+    }
+    free(problem->settled_spikes);
+    free(problem->settled);
+    free(problem->cells);
+}
+
+
+// ###################################################################
+// ############              Evaluation                 ##############
+// ###################################################################
+
+// per-cell response features of one condition
+typedef struct {
+    double baseline_count;
+    double first_spike;    // first spike at or after the stimulation, INFINITY if none
+    double psth[FIT_MAX_BINS];
+} FitResponse;
+
+static void fit_response(const FitTarget *t, const double *spike_times, int num_spikes, FitResponse *r) {
+    r->baseline_count = 0;
+    r->first_spike = INFINITY;
+    for (int b = 0; b < t->num_psth; b++) r->psth[b] = 0;
+    for (int i = 0; i < num_spikes; i++) {
+        double time = spike_times[i];
+        if (time >= t->baseline_start && time < t->baseline_end) r->baseline_count += 1;
+        if (time >= t->stim_time && time < r->first_spike) r->first_spike = time;
+        for (int b = 0; b < t->num_psth; b++) {
+            double center = t->psth_start + b * t->psth_step;
+            if (time >= center - t->psth_window / 2 && time < center + t->psth_window / 2) r->psth[b] += 1;
+        }
+    }
+}
+
+// PSTH and time-to-recover loss of each of the `num` candidates (parameter values, num x num_params), candidates
+// and cells are evaluated in parallel
+void fit_evaluate(FitProblem *problem, const double *values, int num, double *loss) {
+    int num_cells = problem->num_cells;
+    FitResponse *responses = (FitResponse *)malloc((size_t)num * num_cells * FIT_NUM_CONDITIONS * sizeof(FitResponse));
+    long simulated_steps = 0;
+    #pragma omp parallel for schedule(dynamic) reduction(+:simulated_steps)
+    for (long task = 0; task < (long)num * num_cells; task++) {
+        int n = (int)(task / num_cells), j = (int)(task % num_cells);
+        State s = problem->cells[j];
+        for (int k = 0; k < problem->num_params; k++) {
+            *(double *)((char *)&s + problem->params[k].offset) = values[n * problem->num_params + k];
+        }
+        const CellParams p = params_from_state(&s);
+        CellState settled;
+        Spikes spikes = {0};
+        spikes.spike_times = (double *)malloc(CONFIG_spikes_init_size * sizeof(double));
+        if (problem->settled) {
+            settled = problem->settled[j];
+            spikes.num_spikes = problem->settled_spikes[j].num_spikes;
+            memcpy(spikes.spike_times, problem->settled_spikes[j].spike_times, spikes.num_spikes * sizeof(double));
+        } else {
+            settled = cell_from_state(&s);
+            fit_run(&p, &settled, 0, problem->stim_step, -1, -1, &spikes);
+            simulated_steps += problem->stim_step;
+        }
+        int num_settled_spikes = spikes.num_spikes;
+        for (int condition = 0; condition < FIT_NUM_CONDITIONS; condition++) {
+            const FitTarget *t = &problem->targets[condition];
+            if (!t->present) continue;
+            CellState c = settled;
+            spikes.num_spikes = num_settled_spikes;
+            fit_run(&p, &c, problem->stim_step, problem->num_steps, condition, t->stim_time, &spikes);
+            simulated_steps += problem->num_steps - problem->stim_step;
+            fit_response(t, spikes.spike_times, spikes.num_spikes, &responses[task * FIT_NUM_CONDITIONS + condition]);
+        }
+        free(spikes.spike_times);
+    }
+    problem->simulated_ms += simulated_steps / CONFIG_1ms_step_num;
+
+    // population features as plot_firing_rate() / plot_time2recover() of visualization.py, squared errors
+    for (int n = 0; n < num; n++) {
+        loss[n] = 0;
+        for (int condition = 0; condition < FIT_NUM_CONDITIONS; condition++) {
+            const FitTarget *t = &problem->targets[condition];
+            if (!t->present) continue;
+            double psth[FIT_MAX_BINS] = {0};
+            int num_firing = 0;
+            for (int j = 0; j < num_cells; j++) {
+                const FitResponse *r = &responses[((long)n * num_cells + j) * FIT_NUM_CONDITIONS + condition];
+                if (r->baseline_count == 0) continue;
+                double baseline_rate = r->baseline_count / (t->baseline_end - t->baseline_start);
+                for (int b = 0; b < t->num_psth; b++) psth[b] += r->psth[b] / t->psth_window / baseline_rate;
+                num_firing++;
+            }
+            double error = 0;
+            for (int b = 0; b < t->num_psth; b++) {
+                double model = num_firing ? psth[b] / num_firing : 0;
+                error += (model - t->psth[b]) * (model - t->psth[b]);
+            }
+            loss[n] += error / t->num_psth;
+            error = 0;
+            for (int b = 0; b < t->num_cdf; b++) {
+                double time = t->cdf_start + b * t->cdf_step;
+                int recovered = 0;
+                for (int j = 0; j < num_cells; j++) {
+                    recovered += responses[((long)n * num_cells + j) * FIT_NUM_CONDITIONS + condition].first_spike <= time;
+                }
+                double model = (double)recovered / num_cells;
+                error += (model - t->cdf[b]) * (model - t->cdf[b]);
+            }
+            loss[n] += problem->cdf_weight * error / t->num_cdf;
+        }
+    }
+    free(responses);
+}
+
+#endif
@@ -0,0 +1,110 @@
+// gates.h
+// Packed gate update for single-cell runs: the 11 dz() calls of f() share one formula, so the gate parameters are
+// stored structure-of-arrays (one array per Gate member, padded to GATE_PACK_WIDTH lanes) and all gates are updated
+// by one loop that the compiler turns into a few vector operations per step. libm exp() does not vectorize and is
+// replaced by exp_packed(), which agrees with it to about one ulp, so the packed kernels (f_packed(), cell_step_packed()
+// in cell.h) are not bit-identical to f(); validate them with -check_against_reference (check.h).
+#ifndef GATES_H
+#define GATES_H
+#include "bio_data/SNrModel.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define NUM_PACKED_GATES 11  // 10 somatic gates and m_HCN_den
+#define GATE_PACK_WIDTH 12   // lanes, a multiple of 4 doubles (padding lanes repeat gate 0 and are discarded)
+
+// gate activation levels m_Na_f ... m_HCN_den are consecutive members of State
+_Static_assert(offsetof(State, m_HCN_den) - offsetof(State, m_Na_f) == (NUM_PACKED_GATES - 1) * sizeof(double),
+               "gate activation levels must be contiguous in State");
+
+typedef struct {
+    double V_z[GATE_PACK_WIDTH];
+    double k_z[GATE_PACK_WIDTH];
+    double x_min[GATE_PACK_WIDTH];
+    double V_tau[GATE_PACK_WIDTH];
+    double tau_0[GATE_PACK_WIDTH];
+    double tau_1[GATE_PACK_WIDTH];
+    double sig_0[GATE_PACK_WIDTH];
+    double sig_1[GATE_PACK_WIDTH];
+} GatePack;
+
+
+// transpose the Gate parameters of `x` in the order of the dz() calls of f()
+static inline void gate_pack(GatePack *restrict pack, const State *restrict x) {
+    const Gate *gates[NUM_PACKED_GATES] = {
+        &x->prop_m_Na_f, &x->prop_h_Na_f, &x->prop_s_Na_f, &x->prop_m_Na_p, &x->prop_h_Na_p,
+        &x->prop_m_K, &x->prop_h_K, &x->prop_m_Ca, &x->prop_h_Ca, &x->prop_m_HCN, &x->prop_m_HCN,
+    };
+    for (int i = 0; i < GATE_PACK_WIDTH; i++) {
+        const Gate *gate = gates[i < NUM_PACKED_GATES ? i : 0];
+        pack->V_z[i] = gate->V_z;
+        pack->k_z[i] = gate->k_z;
+        pack->x_min[i] = gate->x_min;
+        pack->V_tau[i] = gate->V_tau;
+        pack->tau_0[i] = gate->tau_0;
+        pack->tau_1[i] = gate->tau_1;
+        pack->sig_0[i] = gate->sig_0;
+        pack->sig_1[i] = gate->sig_1;
+    }
+}
+
+// max(x, low) as a sign-bit blend: GCC does not if-convert floating-point conditionals in loops without
+// -fno-trapping-math, which would keep dz_packed() scalar
+static inline double clamp_below(double x, double low) {
+    double diff = x - low;
+    uint64_t diff_bits, x_bits, low_bits;
+    memcpy(&diff_bits, &diff, sizeof(diff));
+    memcpy(&x_bits, &x, sizeof(x));
+    memcpy(&low_bits, &low, sizeof(low));
+    uint64_t mask = 0 - (diff_bits >> 63);  // all ones where x < low
+    x_bits = (mask & low_bits) | (~mask & x_bits);
+    memcpy(&x, &x_bits, sizeof(x));
+    return x;
+}
+
+// branch-free exp() for vectorized loops: x = k ln2 + r with |r| <= ln2/2, degree-13 Taylor polynomial for e^r
+// (truncation error below 1e-17 relative) and 2^k assembled in the exponent bits. Arguments are clamped to the
+// normal range, so huge (finite) arguments saturate instead of returning inf/0 (no difference once inside the gate
+// formulas).
+static inline double exp_packed(double x) {
+    const double shift = 0x1.8p52;  // adding it rounds to an integer kept in the low mantissa bits
+    x = -clamp_below(-clamp_below(x, -708.), -709.);
+    double k = x * 1.4426950408889634 + shift;
+    uint64_t k_bits;
+    memcpy(&k_bits, &k, sizeof(k));
+    k -= shift;
+    double r = x - k * 6.93147180369123816490e-01;  // ln2 split in a high part with zero low bits ...
+    r -= k * 1.90821492927058770002e-10;            // ... and the rest
+    double p = 1. / 6227020800.;
+    p = p * r + 1. / 479001600.;
+    p = p * r + 1. / 39916800.;
+    p = p * r + 1. / 3628800.;
+    p = p * r + 1. / 362880.;
+    p = p * r + 1. / 40320.;
+    p = p * r + 1. / 5040.;
+    p = p * r + 1. / 720.;
+    p = p * r + 1. / 120.;
+    p = p * r + 1. / 24.;
+    p = p * r + 1. / 6.;
+    p = p * r + 1. / 2.;
+    p = p * r + 1.;
+    p = p * r + 1.;
+    uint64_t scale_bits = (k_bits << 52) + 0x3ff0000000000000ULL;
+    double scale;
+    memcpy(&scale, &scale_bits, sizeof(scale));
+    return p * scale;
+}
+
+// dz() of every lane, gate i driven by the membrane potential V[i]
+static inline void dz_packed(const GatePack *restrict pack, double *restrict z, const double *restrict V, double dt) {
+    for (int i = 0; i < GATE_PACK_WIDTH; i++) {
+        double z_0 = (1. - pack->x_min[i]) / (1. + exp_packed((pack->V_z[i] - V[i]) / pack->k_z[i]));
+        double tau = pack->tau_0[i] + (pack->tau_1[i] - pack->tau_0[i]) /
+                     (exp_packed((pack->V_tau[i] - V[i]) / pack->sig_0[i]) +
+                      exp_packed((pack->V_tau[i] - V[i]) / pack->sig_1[i]));
+        z[i] += (z_0 - z[i]) * (1 - exp_packed(-dt / tau));
+    }
+}
+
+#endif
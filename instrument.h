@@ -0,0 +1,222 @@
+// instrument.h
+// Low-overhead hot-path instrumentation, enabled with -DSNR_INSTRUMENT.
+// Linux hardware counters for the kernel region are additionally enabled with -DSNR_INSTRUMENT_PERF.
+// Without SNR_INSTRUMENT every macro below compiles to nothing.
+//
+// Counters and phase timers are kept per thread (no atomics on the hot path) and summed in
+// INSTR_REPORT(filename), which writes a JSON report. Timers are taken around whole simulations
+// and writes, never around single steps, so the overhead is a few clock reads per trial.
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#ifdef SNR_INSTRUMENT
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#if defined(SNR_INSTRUMENT_PERF) && defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define INSTR_HAS_PERF 1
+#else
+#define INSTR_HAS_PERF 0
+#endif
+
+#define INSTR_MAX_THREADS 256
+
+// counters
+enum {
+    INSTR_STEPS,         // integration steps of f()
+    INSTR_SPIKES,        // detected spikes
+    INSTR_SIMULATIONS,   // simulated trials / grid cells
+    INSTR_EARLY_EXITS,   // simulations stopped before their full duration
+    INSTR_BYTES_WRITTEN, // bytes written by the csv/raster writers
+    INSTR_NUM_COUNTERS
+};
+static const char *INSTR_COUNTER_NAMES[INSTR_NUM_COUNTERS] = {
+    "steps", "spikes", "simulations", "early_exits", "bytes_written"
+};
+
+// phases
+enum {
+    INSTR_KERNEL, // integration loop around f()
+    INSTR_TRACE,  // integration loop of full_simulation(), including trace recording
+    INSTR_ALLOC,  // buffer allocation
+    INSTR_WRITER, // csv/raster writers
+    INSTR_READER, // binary input files
+    INSTR_NUM_PHASES
+};
+static const char *INSTR_PHASE_NAMES[INSTR_NUM_PHASES] = {
+    "kernel", "trace", "alloc", "writer", "reader"
+};
+
+// hardware counters
+enum {
+    INSTR_CYCLES,
+    INSTR_INSTRUCTIONS,
+    INSTR_CACHE_MISSES,
+    INSTR_NUM_PERF
+};
+
+typedef struct {
+    uint64_t counters[INSTR_NUM_COUNTERS];
+    double phase_time[INSTR_NUM_PHASES];
+    int perf_fd[INSTR_NUM_PERF];
+    int perf_open;
+    int used;
+} __attribute__((aligned(64))) InstrThread;
+
+static InstrThread instr_threads[INSTR_MAX_THREADS];
+static double instr_start_time;
+
+static inline double instr_now() {
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec + t.tv_usec * 1e-6;
+}
+
+static inline InstrThread *instr_thread() {
+#ifdef _OPENMP
+    int id = omp_get_thread_num();
+    if (id >= INSTR_MAX_THREADS) id = INSTR_MAX_THREADS - 1;
+#else
+    int id = 0;
+#endif
+    instr_threads[id].used = 1;
+    return &instr_threads[id];
+}
+
+static inline void instr_init() {
+    memset(instr_threads, 0, sizeof(instr_threads));
+    instr_start_time = instr_now();
+}
+
+#if INSTR_HAS_PERF
+static int instr_perf_open_counter(uint32_t type, uint64_t config, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = group_fd == -1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);  // calling thread, any cpu
+}
+
+static inline void instr_perf_start() {
+    InstrThread *t = instr_thread();
+    if (!t->perf_open) {
+        t->perf_fd[INSTR_CYCLES] = instr_perf_open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+        t->perf_fd[INSTR_INSTRUCTIONS] = instr_perf_open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,
+                                                                 t->perf_fd[INSTR_CYCLES]);
+        t->perf_fd[INSTR_CACHE_MISSES] = instr_perf_open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,
+                                                                 t->perf_fd[INSTR_CYCLES]);
+        t->perf_open = t->perf_fd[INSTR_CYCLES] >= 0 ? 1 : -1;
+        if (t->perf_open < 0) fprintf(stderr, "perf_event_open unavailable, hardware counters disabled\n");
+    }
+    if (t->perf_open > 0) ioctl(t->perf_fd[INSTR_CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static inline void instr_perf_stop() {
+    InstrThread *t = instr_thread();
+    if (t->perf_open > 0) ioctl(t->perf_fd[INSTR_CYCLES], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+}
+#endif
+
+static inline void instr_report(const char *filename) {
+    double wall = instr_now() - instr_start_time;
+    uint64_t counters[INSTR_NUM_COUNTERS] = {0};
+    double phase_time[INSTR_NUM_PHASES] = {0};
+    uint64_t perf[INSTR_NUM_PERF] = {0};
+    int num_threads = 0, has_perf = 0;
+    for (int k = 0; k < INSTR_MAX_THREADS; k++) {
+        InstrThread *t = &instr_threads[k];
+        if (!t->used) continue;
+        num_threads = k + 1;
+        for (int i = 0; i < INSTR_NUM_COUNTERS; i++) counters[i] += t->counters[i];
+        for (int i = 0; i < INSTR_NUM_PHASES; i++) phase_time[i] += t->phase_time[i];
+#if INSTR_HAS_PERF
+        if (t->perf_open > 0) {
+            has_perf = 1;
+            for (int i = 0; i < INSTR_NUM_PERF; i++) {
+                uint64_t value = 0;
+                if (t->perf_fd[i] >= 0 && read(t->perf_fd[i], &value, sizeof(value)) == sizeof(value)) {
+                    perf[i] += value;
+                }
+            }
+        }
+#endif
+    }
+
+    FILE *file = fopen(filename, "w");
+    if (file == NULL) {
+        perror("Error opening instrumentation report");
+        return;
+    }
+    fprintf(file, "{\n  \"wall_time\": %.6f,\n  \"threads\": %d,\n  \"counters\": {", wall, num_threads);
+    for (int i = 0; i < INSTR_NUM_COUNTERS; i++) {
+        fprintf(file, "%s\"%s\": %llu", i ? ", " : "", INSTR_COUNTER_NAMES[i], (unsigned long long)counters[i]);
+    }
+    fprintf(file, "},\n  \"phases\": {");
+    for (int i = 0; i < INSTR_NUM_PHASES; i++) {
+        fprintf(file, "%s\"%s\": %.6f", i ? ", " : "", INSTR_PHASE_NAMES[i], phase_time[i]);
+    }
+    fprintf(file, "},\n  \"ns_per_step\": %.3f,\n  \"writer_MB_per_s\": %.3f,\n",
+            counters[INSTR_STEPS] ? (phase_time[INSTR_KERNEL] + phase_time[INSTR_TRACE]) * 1e9 / counters[INSTR_STEPS] : 0.,
+            phase_time[INSTR_WRITER] > 0 ? counters[INSTR_BYTES_WRITTEN] * 1e-6 / phase_time[INSTR_WRITER] : 0.);
+    fprintf(file, "  \"per_thread\": [");
+    for (int k = 0; k < num_threads; k++) {
+        InstrThread *t = &instr_threads[k];
+        double busy = 0;
+        for (int i = 0; i < INSTR_NUM_PHASES; i++) busy += t->phase_time[i];
+        fprintf(file, "%s\n    {\"thread\": %d, \"simulations\": %llu, \"steps\": %llu, \"busy\": %.6f, \"utilization\": %.4f}",
+                k ? "," : "", k, (unsigned long long)t->counters[INSTR_SIMULATIONS],
+                (unsigned long long)t->counters[INSTR_STEPS], busy, wall > 0 ? busy / wall : 0.);
+    }
+    fprintf(file, "\n  ]");
+    if (has_perf) {
+        fprintf(file, ",\n  \"perf_kernel\": {\"cycles\": %llu, \"instructions\": %llu, \"cache_misses\": %llu, \"ipc\": %.3f}",
+                (unsigned long long)perf[INSTR_CYCLES], (unsigned long long)perf[INSTR_INSTRUCTIONS],
+                (unsigned long long)perf[INSTR_CACHE_MISSES],
+                perf[INSTR_CYCLES] ? (double)perf[INSTR_INSTRUCTIONS] / perf[INSTR_CYCLES] : 0.);
+    }
+    fprintf(file, "\n}\n");
+    fclose(file);
+    printf("Instrumentation report saved in %s \n", filename);
+}
+
+#define INSTR_INIT() instr_init()
+#define INSTR_REPORT(filename) instr_report(filename)
+#define INSTR_COUNT(counter, n) (instr_thread()->counters[counter] += (uint64_t)(n))
+#define INSTR_TIMER_START(name) double _instr_##name = instr_now()
+#define INSTR_TIMER_STOP(name, phase) (instr_thread()->phase_time[phase] += instr_now() - _instr_##name)
+#define INSTR_FILE_MARK(name, file) long _instr_pos_##name = ftell(file)
+#define INSTR_FILE_BYTES(name, file) INSTR_COUNT(INSTR_BYTES_WRITTEN, ftell(file) - _instr_pos_##name)
+#if INSTR_HAS_PERF
+#define INSTR_PERF_START() instr_perf_start()
+#define INSTR_PERF_STOP() instr_perf_stop()
+#else
+#define INSTR_PERF_START() ((void)0)
+#define INSTR_PERF_STOP() ((void)0)
+#endif
+
+#else  // SNR_INSTRUMENT
+
+#define INSTR_INIT() ((void)0)
+#define INSTR_REPORT(filename) ((void)0)
+#define INSTR_COUNT(counter, n) ((void)0)
+#define INSTR_TIMER_START(name) ((void)0)
+#define INSTR_TIMER_STOP(name, phase) ((void)0)
+#define INSTR_FILE_MARK(name, file) ((void)0)
+#define INSTR_FILE_BYTES(name, file) ((void)0)
+#define INSTR_PERF_START() ((void)0)
+#define INSTR_PERF_STOP() ((void)0)
+
+#endif  // SNR_INSTRUMENT
+#endif
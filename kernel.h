@@ -0,0 +1,145 @@
+// kernel.h
+// Runtime CPU feature dispatch for the model kernel.
+// f() and dz() from bio_data/SNrModel.h are compiled several times with different instruction sets
+// (GCC/Clang target attributes, the reference code is inlined into each variant), and one variant
+// is chosen once at startup with CPUID. Variants built with FMA may differ from `generic` in the last bits.
+// The `packed_*` variants use the vectorized gate update of gates.h; they are not bit-identical to f() and are
+// only used when requested (-isa packed or a packed_* name).
+// Each variant also provides the step on the split CellParams/CellState layout (cell.h), selected together.
+#ifndef KERNEL_H
+#define KERNEL_H
+#include "bio_data/SNrModel.h"
+#include "cell.h"
+#include <stdio.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define KERNEL_X86_DISPATCH 1
+#else
+#define KERNEL_X86_DISPATCH 0
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define KERNEL_FLATTEN __attribute__((flatten))
+#else
+#define KERNEL_FLATTEN
+#endif
+
+typedef int (*KernelF)(State *restrict x, double dt);
+typedef void (*KernelDz)(const Gate *restrict gate, double *restrict z, double V, double dt);
+typedef int (*KernelStep)(const CellParams *restrict p, CellState *restrict c, double dt);
+
+typedef struct {
+    const char *name;
+    KernelF f;
+    KernelDz dz;
+    KernelStep step;
+    int (*supported)();
+    int automatic;  // candidate for "auto"
+} Kernel;
+
+
+// ###################################################################
+// ############                 Variants                ##############
+// ###################################################################
+
+KERNEL_FLATTEN int f_generic(State *restrict x, double dt) { return f(x, dt); }
+KERNEL_FLATTEN void dz_generic(const Gate *restrict gate, double *restrict z, double V, double dt) { dz(gate, z, V, dt); }
+KERNEL_FLATTEN int step_generic(const CellParams *restrict p, CellState *restrict c, double dt) { return cell_step(p, c, dt); }
+KERNEL_FLATTEN int f_packed_generic(State *restrict x, double dt) { return f_packed(x, dt); }
+KERNEL_FLATTEN int step_packed_generic(const CellParams *restrict p, CellState *restrict c, double dt) {
+    return cell_step_packed(p, c, dt);
+}
+int generic_supported() { return 1; }
+
+#if KERNEL_X86_DISPATCH
+#define KERNEL_AVX2 __attribute__((target("avx2,fma"), flatten))
+#define KERNEL_AVX512 __attribute__((target("avx512f,avx512dq,avx512vl,avx2,fma"), flatten))
+
+KERNEL_AVX2 int f_avx2(State *restrict x, double dt) { return f(x, dt); }
+KERNEL_AVX2 void dz_avx2(const Gate *restrict gate, double *restrict z, double V, double dt) { dz(gate, z, V, dt); }
+KERNEL_AVX2 int step_avx2(const CellParams *restrict p, CellState *restrict c, double dt) { return cell_step(p, c, dt); }
+KERNEL_AVX2 int f_packed_avx2(State *restrict x, double dt) { return f_packed(x, dt); }
+KERNEL_AVX2 int step_packed_avx2(const CellParams *restrict p, CellState *restrict c, double dt) {
+    return cell_step_packed(p, c, dt);
+}
+int avx2_supported() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+KERNEL_AVX512 int f_avx512(State *restrict x, double dt) { return f(x, dt); }
+KERNEL_AVX512 void dz_avx512(const Gate *restrict gate, double *restrict z, double V, double dt) { dz(gate, z, V, dt); }
+KERNEL_AVX512 int step_avx512(const CellParams *restrict p, CellState *restrict c, double dt) { return cell_step(p, c, dt); }
+KERNEL_AVX512 int f_packed_avx512(State *restrict x, double dt) { return f_packed(x, dt); }
+KERNEL_AVX512 int step_packed_avx512(const CellParams *restrict p, CellState *restrict c, double dt) {
+    return cell_step_packed(p, c, dt);
+}
+int avx512_supported() {
+    __builtin_cpu_init();
+    return avx2_supported() && __builtin_cpu_supports("avx512f") &&
+           __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl");
+}
+#endif
+
+// ordered from the most to the least preferred
+static const Kernel KERNELS[] = {
+#if KERNEL_X86_DISPATCH
+    {"avx512", f_avx512, dz_avx512, step_avx512, avx512_supported, 1},
+    {"avx2", f_avx2, dz_avx2, step_avx2, avx2_supported, 1},
+#endif
+    {"generic", f_generic, dz_generic, step_generic, generic_supported, 1},
+#if KERNEL_X86_DISPATCH
+    {"packed_avx512", f_packed_avx512, dz_avx512, step_packed_avx512, avx512_supported, 0},
+    {"packed_avx2", f_packed_avx2, dz_avx2, step_packed_avx2, avx2_supported, 0},
+#endif
+    {"packed_generic", f_packed_generic, dz_generic, step_packed_generic, generic_supported, 0},
+};
+#define NUM_KERNELS ((int)(sizeof(KERNELS) / sizeof(KERNELS[0])))
+
+
+// ###################################################################
+// ############                 Dispatch                ##############
+// ###################################################################
+
+// selected kernel, the reference f() until select_kernel() is called
+KernelF kernel_f = f;
+KernelDz kernel_dz = dz;
+KernelStep kernel_step = cell_step;
+const char *kernel_name = "reference";
+
+// select a kernel variant by name, the fastest supported one for "auto", or the fastest supported packed_* for "packed"
+// return 0 on success, 1 if the requested variant is unknown or not supported by this CPU
+int select_kernel(const char *isa) {
+    int chosen = -1, forced = strcmp(isa, "auto") != 0, packed = strcmp(isa, "packed") == 0;
+    for (int i = 0; i < NUM_KERNELS; i++) {
+        int match;
+        if (packed) {
+            match = strncmp(KERNELS[i].name, "packed_", 7) == 0 && KERNELS[i].supported();
+        } else {
+            match = forced ? strcmp(isa, KERNELS[i].name) == 0 : KERNELS[i].automatic && KERNELS[i].supported();
+        }
+        if (match) {
+            chosen = i;
+            break;
+        }
+    }
+    if (chosen < 0) {
+        printf("Unknown kernel variant: %s (available:", isa);
+        for (int i = 0; i < NUM_KERNELS; i++) printf(" %s", KERNELS[i].name);
+        printf(")\n");
+        return 1;
+    }
+    if (!KERNELS[chosen].supported()) {
+        printf("Kernel variant %s is not supported by this CPU\n", isa);
+        return 1;
+    }
+    kernel_f = KERNELS[chosen].f;
+    kernel_dz = KERNELS[chosen].dz;
+    kernel_step = KERNELS[chosen].step;
+    kernel_name = KERNELS[chosen].name;
+    printf("Kernel: %s (%s)\n", kernel_name, forced ? "forced by -isa" : "auto-detected");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,83 @@
+// params.h
+// Name -> field table of the double-valued members of State, so that tools and language bindings
+// can configure a cell by name (e.g. "g_HCN_den", "W_GPe", "prop_m_HCN.V_z").
+#ifndef PARAMS_H
+#define PARAMS_H
+#include "bio_data/SNrModel.h"
+#include <stddef.h>
+#include <string.h>
+
+typedef struct {
+    const char *name;
+    size_t offset;
+} StateField;
+
+#define STATE_FIELD(member) {#member, offsetof(State, member)}
+#define STATE_GATE_FIELDS(gate) \
+    STATE_FIELD(gate.V_z), STATE_FIELD(gate.k_z), STATE_FIELD(gate.x_min), STATE_FIELD(gate.V_tau), \
+    STATE_FIELD(gate.tau_0), STATE_FIELD(gate.tau_1), STATE_FIELD(gate.sig_0), STATE_FIELD(gate.sig_1)
+
+static const StateField STATE_FIELDS[] = {
+    // dynamic variables
+    STATE_FIELD(time),
+    STATE_FIELD(V_s),
+    STATE_FIELD(V_d),
+    STATE_FIELD(m_Na_f),
+    STATE_FIELD(h_Na_f),
+    STATE_FIELD(s_Na_f),
+    STATE_FIELD(m_Na_p),
+    STATE_FIELD(h_Na_p),
+    STATE_FIELD(m_K),
+    STATE_FIELD(h_K),
+    STATE_FIELD(m_Ca),
+    STATE_FIELD(h_Ca),
+    STATE_FIELD(m_HCN_som),
+    STATE_FIELD(m_HCN_den),
+    STATE_FIELD(D),
+    STATE_FIELD(F),
+    STATE_FIELD(Ca_in),
+    STATE_FIELD(Cl_som),
+    STATE_FIELD(Cl_den),
+    STATE_FIELD(g_GABA_som),
+    STATE_FIELD(g_GABA_den),
+
+    // parameters
+    STATE_GATE_FIELDS(prop_m_Na_f),
+    STATE_GATE_FIELDS(prop_h_Na_f),
+    STATE_GATE_FIELDS(prop_s_Na_f),
+    STATE_GATE_FIELDS(prop_m_Na_p),
+    STATE_GATE_FIELDS(prop_h_Na_p),
+    STATE_GATE_FIELDS(prop_m_K),
+    STATE_GATE_FIELDS(prop_h_K),
+    STATE_GATE_FIELDS(prop_m_Ca),
+    STATE_GATE_FIELDS(prop_h_Ca),
+    STATE_GATE_FIELDS(prop_m_HCN),
+    STATE_FIELD(D_0),
+    STATE_FIELD(F_0),
+    STATE_FIELD(D_m),
+    STATE_FIELD(F_m),
+    STATE_FIELD(g_HCN_som),
+    STATE_FIELD(g_HCN_den),
+    STATE_FIELD(W_GPe),
+    STATE_FIELD(W_Str),
+    STATE_FIELD(W_SNr),
+    STATE_FIELD(tau_GABA_som),
+    STATE_FIELD(tau_GABA_den),
+    STATE_FIELD(V_th),
+    STATE_FIELD(I_app),
+    STATE_FIELD(I_den),
+    STATE_FIELD(E_leak),
+};
+#define NUM_STATE_FIELDS ((int)(sizeof(STATE_FIELDS) / sizeof(STATE_FIELDS[0])))
+
+// pointer to the named double field of `s`, NULL if there is no such field
+static inline double *state_field(State *s, const char *name) {
+    for (int i = 0; i < NUM_STATE_FIELDS; i++) {
+        if (strcmp(STATE_FIELDS[i].name, name) == 0) {
+            return (double *)((char *)s + STATE_FIELDS[i].offset);
+        }
+    }
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,329 @@
+// parareal.h
+// Parallel-in-time integration of one long single-cell trajectory (Parareal). The run is cut into time slices; a cheap
+// coarse propagator predicts the state at every slice start serially, the exact fine propagator (kernel_step at
+// CONFIG_dt) runs all slices in parallel from those predictions, and the correction
+// U[k+1] = F(U[k]) + G_new(U[k]) - G_old(U[k]) is swept forward until the slice-start states and the spike trains
+// stop changing. After k iterations the first k slices are exact, so the result equals the serial run (bit for bit)
+// at the latest after as many iterations as slices; speedup needs convergence in far fewer.
+// The coarse propagator of a tonic cell is its phase on the limit cycle (period and cycle from shooting.h): a state is
+// projected onto the recorded cycle, advanced by the elapsed time and mapped back, and an input is integrated exactly
+// for PARAREAL_window ms from the cycle state at its phase before the phase is read off again (the phase response).
+// The correction then shifts the fine end state along the cycle by the coarse phase difference. The slices mostly
+// disagree on the phase, so a tonic run of 8 slices converges in 2-3 iterations and one of 32 in 6-7.
+// Cells without a stable tonic cycle use cell_step() with PARAREAL_coarse_ratio times CONFIG_dt, which is adequate
+// for silent stretches but loses the spike phase of firing ones.
+#ifndef PARAREAL_H
+#define PARAREAL_H
+#include "simulation.h"
+#include "shooting.h"
+#include <math.h>
+#include <stddef.h>
+#ifdef _OPENMP
+    #include <omp.h>
+#endif
+
+// evolving variables V_s ... g_GABA_den of CellState, corrected as one vector
+#define PARAREAL_NUM_VARS ((offsetof(CellState, g_GABA_den) - offsetof(CellState, V_s)) / sizeof(double) + 1)
+
+typedef struct {
+    int num_slices;      // time slices, 0: one per thread
+    int coarse_ratio;    // coarse step in units of CONFIG_dt, cells without a tonic cycle
+    int max_iterations;  // 0: num_slices (always exact)
+    double tol;          // convergence threshold on slice-start V_s/V_d changes in mV
+} PararealOptions;
+
+typedef struct {
+    int num_slices;
+    int num_threads;
+    int iterations;
+    int converged;       // slice-start states and spike trains stopped changing, or every slice is exact
+    double max_change;   // last slice-start V_s/V_d change in mV
+    int cycle;           // shoot_orbit() status of the cell, SHOOT_TONIC: phase coarse propagator
+    double period;       // ms, of the limit cycle used by the coarse propagator, NAN: cell_step() coarse propagator
+    double wall_time;    // s
+} PararealReport;
+
+// limit cycle without input, sampled at every fine step from the start of the cycle on
+typedef struct {
+    int status;             // of shoot_orbit()
+    int tonic;              // 0: no stable tonic cycle, the coarse propagator steps cell_step()
+    double period;          // ms
+    int num_samples;        // ceil(period / CONFIG_dt), sample j at j CONFIG_dt
+    CellState *samples;
+    double scale[SHOOT_NUM_VARS];  // of the active variables in the phase projection
+} PararealCycle;
+
+
+// the limit cycle through the settled state of `c` (shoot_orbit()), not tonic for silent or irregular cells
+PararealCycle parareal_cycle(const CellParams *restrict p, const CellState *restrict c) {
+    PeriodicOrbit orbit = shoot_orbit(p, c, 1);
+    PararealCycle cycle = {orbit.status, 0, NAN, 0, NULL, {0}};
+    if (orbit.status != SHOOT_TONIC) return cycle;
+    cycle.tonic = 1;
+    cycle.period = orbit.period;
+    cycle.num_samples = (int)ceil(orbit.period / CONFIG_dt);
+    cycle.samples = (CellState *)malloc(cycle.num_samples * sizeof(CellState));
+    CellState state = orbit.start;
+    for (int j = 0; j < cycle.num_samples; j++) {
+        cycle.samples[j] = state;
+        kernel_step(p, &state, CONFIG_dt);
+    }
+    for (int k = 0; k < SHOOT_NUM_VARS; k++) {
+        cycle.scale[k] = k < 2 ? 10 : k == SHOOT_NUM_VARS - 1 ? fmax(fabs(orbit.start.Ca_in), 1e-6) : 1;
+    }
+    return cycle;
+}
+
+// state of the cycle at time `t` ms after its start (any t), linear between the samples
+static void parareal_cycle_state(const PararealCycle *cycle, double t, CellState *out) {
+    t = fmod(t, cycle->period);
+    if (t < 0) t += cycle->period;
+    int j = (int)(t / CONFIG_dt);
+    if (j >= cycle->num_samples) j = cycle->num_samples - 1;
+    double t_0 = j * CONFIG_dt, t_1 = j + 1 < cycle->num_samples ? t_0 + CONFIG_dt : cycle->period;
+    double w = t_1 > t_0 ? (t - t_0) / (t_1 - t_0) : 0;
+    const CellState *a = &cycle->samples[j], *b = &cycle->samples[(j + 1) % cycle->num_samples];
+    *out = *a;
+    for (int k = 0; k < SHOOT_NUM_VARS; k++) {
+        *shoot_var(out, k) = (1 - w) * *shoot_var((CellState *)a, k) + w * *shoot_var((CellState *)b, k);
+    }
+}
+
+// squared scaled distance of `c` to the segment from sample j to j + 1, `w` gets the position on it in [0, 1]
+static double parareal_segment(const PararealCycle *cycle, const CellState *c, int j, double *w) {
+    const CellState *a = &cycle->samples[j], *b = &cycle->samples[(j + 1) % cycle->num_samples];
+    double ab = 0, ac = 0, bb = 0;
+    for (int k = 0; k < SHOOT_NUM_VARS; k++) {
+        double x_a = *shoot_var((CellState *)a, k) / cycle->scale[k];
+        double d = *shoot_var((CellState *)b, k) / cycle->scale[k] - x_a;
+        double e = *shoot_var((CellState *)c, k) / cycle->scale[k] - x_a;
+        ab += d * e;
+        bb += d * d;
+        ac += e * e;
+    }
+    *w = bb > 0 ? fmin(fmax(ab / bb, 0), 1) : 0;
+    return ac - 2 * *w * ab + *w * *w * bb;
+}
+
+// phase of `c` as the time since the start of the cycle of its closest point (scaled active variables)
+static double parareal_cycle_time(const PararealCycle *cycle, const CellState *c) {
+    int nearest = 0;
+    double best = INFINITY;
+    for (int j = 0; j < cycle->num_samples; j++) {
+        double d = 0;
+        for (int k = 0; k < SHOOT_NUM_VARS; k++) {
+            double e = (*shoot_var(&cycle->samples[j], k) - *shoot_var((CellState *)c, k)) / cycle->scale[k];
+            d += e * e;
+        }
+        if (d < best) {
+            best = d;
+            nearest = j;
+        }
+    }
+    // refine on the segments before and after the nearest sample
+    int before = (nearest + cycle->num_samples - 1) % cycle->num_samples;
+    double w_before, w_after;
+    double d_before = parareal_segment(cycle, c, before, &w_before);
+    double d_after = parareal_segment(cycle, c, nearest, &w_after);
+    int j = d_before < d_after ? before : nearest;
+    double w = d_before < d_after ? w_before : w_after;
+    double t_0 = j * CONFIG_dt, t_1 = j + 1 < cycle->num_samples ? t_0 + CONFIG_dt : cycle->period;
+    return t_0 + w * (t_1 - t_0);
+}
+
+// whether any of the fine steps [i, i + n) contains a stim onset
+static inline int stim_in_range(int i, int n, double stim_time) {
+    for (int k = i; k < i + n; k++) {
+        if (stim_onset(k, stim_time)) return 1;
+    }
+    return 0;
+}
+
+// first fine step in [i, end) with a GPe or Str onset, `end` if none
+static int parareal_next_onset(int i, int end, double GPe_stim_time, double Str_stim_time) {
+    for (; i < end; i++) {
+        if (stim_onset(i, GPe_stim_time) || stim_onset(i, Str_stim_time)) return i;
+    }
+    return end;
+}
+
+// coarse propagator over the fine steps [start, end)
+void parareal_coarse(const CellParams *restrict p, const PararealCycle *cycle, CellState *restrict c, int start,
+                     int end, int ratio, double GPe_stim_time, double Str_stim_time) {
+    if (!cycle->tonic) {
+        // the stimulations of each coarse step are applied once
+        for (int i = start; i < end; i += ratio) {
+            int n = end - i < ratio ? end - i : ratio;
+            c->GPe_stim = stim_in_range(i, n, GPe_stim_time);
+            c->Str_stim = stim_in_range(i, n, Str_stim_time);
+            cell_step(p, c, n * CONFIG_dt);
+        }
+        return;
+    }
+    double time = c->time, phase = parareal_cycle_time(cycle, c);
+    int window = PARAREAL_window * CONFIG_1ms_step_num;
+    for (int i = start; i < end;) {
+        int onset = parareal_next_onset(i, end, GPe_stim_time, Str_stim_time);
+        phase += (onset - i) * CONFIG_dt;
+        i = onset;
+        if (i == end) {
+            parareal_cycle_state(cycle, phase, c);
+            break;
+        }
+        // the response to the input from the cycle state at its phase
+        parareal_cycle_state(cycle, phase, c);
+        int n = end - i < window ? end - i : window;
+        for (int k = i; k < i + n; k++) {
+            set_cell_stim(c, k, GPe_stim_time, Str_stim_time);
+            kernel_step(p, c, CONFIG_dt);
+        }
+        i += n;
+        phase = parareal_cycle_time(cycle, c);
+    }
+    c->time = time + (end - start) * CONFIG_dt;
+}
+
+// fine propagator over the fine steps [start, end), spike times appended to `spikes`
+void parareal_fine(const CellParams *restrict p, CellState *restrict c, int start, int end,
+                   double GPe_stim_time, double Str_stim_time, Spikes *restrict spikes) {
+    for (int i = start; i < end; i++) {
+        set_cell_stim(c, i, GPe_stim_time, Str_stim_time);
+        if (kernel_step(p, c, CONFIG_dt)) {
+            spikes_append(spikes, c->time);
+        }
+    }
+}
+
+// U = F + (G_new - G_old) over the evolving variables, the coarse correction is skipped where it is not finite
+// (the coarse step can blow up on a spike). On a tonic cycle the correction is a phase shift instead: F is moved
+// along the cycle by the phase difference of G_new and G_old (a state difference across a spike is no correction
+// of the phase). Return max |change| of V_s/V_d against the previous U
+static double parareal_correct(const PararealCycle *cycle, CellState *restrict U, const CellState *restrict F,
+                               const CellState *restrict G_new, const CellState *restrict G_old) {
+    double V_s = U->V_s, V_d = U->V_d, time = U->time;
+    *U = *F;
+    U->time = time;
+    if (cycle->tonic) {
+        double shift = parareal_cycle_time(cycle, G_new) - parareal_cycle_time(cycle, G_old);
+        shift -= cycle->period * round(shift / cycle->period);
+        if (shift != 0) {
+            double phase = parareal_cycle_time(cycle, F);
+            CellState from, to;
+            parareal_cycle_state(cycle, phase, &from);
+            parareal_cycle_state(cycle, phase + shift, &to);
+            for (int k = 0; k < SHOOT_NUM_VARS; k++) {
+                *shoot_var(U, k) += *shoot_var(&to, k) - *shoot_var(&from, k);
+            }
+        }
+        return fmax(fabs(U->V_s - V_s), fabs(U->V_d - V_d));
+    }
+    const double *f = &F->V_s, *g_new = &G_new->V_s, *g_old = &G_old->V_s;
+    double *u = &U->V_s;
+    for (size_t k = 0; k < PARAREAL_NUM_VARS; k++) {
+        double correction = g_new[k] - g_old[k];
+        if (isfinite(correction)) u[k] = f[k] + correction;
+    }
+    return fmax(fabs(U->V_s - V_s), fabs(U->V_d - V_d));
+}
+
+// cell_spike_simulation() in parallel time slices, `c` ends in the final state
+Spikes parareal_simulation(const CellParams *restrict p, CellState *restrict c, int duration,
+                           double GPe_stim_time, double Str_stim_time, const PararealOptions *opt,
+                           PararealReport *report) {
+    double start_time = wall_time();
+    PararealCycle cycle = parareal_cycle(p, c);
+    int num_steps = duration * CONFIG_1ms_step_num;
+    int num_threads = 1;
+#ifdef _OPENMP
+    num_threads = omp_get_max_threads();
+#endif
+    int K = opt->num_slices > 0 ? opt->num_slices : num_threads;
+    if (K > num_steps) K = num_steps;
+    int max_iterations = opt->max_iterations > 0 && opt->max_iterations < K ? opt->max_iterations : K;
+
+    int *start = (int *)malloc((K + 1) * sizeof(int));
+    CellState *U = (CellState *)malloc((K + 1) * sizeof(CellState));       // slice-start states
+    CellState *G_old = (CellState *)malloc(K * sizeof(CellState));         // coarse results of the last sweep
+    CellState *F = (CellState *)malloc(K * sizeof(CellState));             // fine results
+    Spikes *slice_spikes = (Spikes *)calloc(K, sizeof(Spikes));
+    int *prev_num_spikes = (int *)malloc(K * sizeof(int));
+    for (int k = 0; k <= K; k++) start[k] = (int)((long)k * num_steps / K);
+
+    // slice-start times as accumulated by the serial run, so that the fine slices reproduce its spike times
+    U[0] = *c;
+    double time = c->time;
+    for (int k = 0, i = 0; k < K; k++) {
+        for (; i < start[k + 1]; i++) time += CONFIG_dt;
+        U[k + 1].time = time;
+    }
+
+    // iteration 0: serial coarse prediction
+    for (int k = 0; k < K; k++) {
+        G_old[k] = U[k];
+        parareal_coarse(p, &cycle, &G_old[k], start[k], start[k + 1], opt->coarse_ratio, GPe_stim_time,
+                        Str_stim_time);
+        double t = U[k + 1].time;
+        U[k + 1] = G_old[k];
+        U[k + 1].time = t;
+        slice_spikes[k] = spikes_new();
+        prev_num_spikes[k] = -1;
+    }
+
+    int iteration = 0, converged = 0;
+    double change = 0;
+    while (iteration < max_iterations && !converged) {
+        // slices before `first` start from exact states that did not change, their fine results stand
+        int first = iteration;
+        iteration++;
+        #pragma omp parallel for schedule(static)
+        for (int k = first; k < K; k++) {
+            F[k] = U[k];
+            slice_spikes[k].num_spikes = 0;
+            parareal_fine(p, &F[k], start[k], start[k + 1], GPe_stim_time, Str_stim_time, &slice_spikes[k]);
+        }
+
+        // serial correction sweep
+        change = 0;
+        int spikes_changed = 0;
+        for (int k = first; k < K; k++) {
+            CellState G_new = U[k];
+            parareal_coarse(p, &cycle, &G_new, start[k], start[k + 1], opt->coarse_ratio, GPe_stim_time,
+                            Str_stim_time);
+            change = fmax(change, parareal_correct(&cycle, &U[k + 1], &F[k], &G_new, &G_old[k]));
+            G_old[k] = G_new;
+            spikes_changed |= slice_spikes[k].num_spikes != prev_num_spikes[k];
+            prev_num_spikes[k] = slice_spikes[k].num_spikes;
+        }
+        converged = iteration == K || (change < opt->tol && !spikes_changed);
+    }
+
+    // concatenate the spike trains of the last fine pass
+    Spikes spikes = spikes_new();
+    for (int k = 0; k < K; k++) {
+        for (int j = 0; j < slice_spikes[k].num_spikes; j++) spikes_append(&spikes, slice_spikes[k].spike_times[j]);
+        free(slice_spikes[k].spike_times);
+    }
+    *c = F[K - 1];
+
+    report->num_slices = K;
+    report->num_threads = num_threads;
+    report->iterations = iteration;
+    report->converged = converged;
+    report->max_change = change;
+    report->cycle = cycle.status;
+    report->period = cycle.period;
+    report->wall_time = wall_time() - start_time;
+    INSTR_COUNT(INSTR_STEPS, (long)num_steps);
+    INSTR_COUNT(INSTR_SPIKES, spikes.num_spikes);
+    INSTR_COUNT(INSTR_SIMULATIONS, 1);
+    free(start);
+    free(U);
+    free(G_old);
+    free(F);
+    free(slice_spikes);
+    free(prev_num_spikes);
+    free(cycle.samples);
+    return spikes;
+}
+
+#endif
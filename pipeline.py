@@ -0,0 +1,275 @@
+import argparse
+import hashlib
+import json
+import os
+import os.path as path
+import re
+import subprocess
+import sys
+import time
+from run_all import tau_Str, tau_GPe, W_Str, W_GPe
+
+# Incremental driver of the whole pipeline: build -> step1 -> step2 -> step3 (one node per HCN choice, stimulation
+# and EphysMeasurement condition) -> summary (visualization.py per HCN choice), run as a DAG.
+# Each node is keyed by a hash of its command, its input files (sources with everything they #include, so the
+# step0_config.h values are covered; upstream artifacts by content) and its environment. A node is rerun only if its
+# key changed or one of its outputs is missing or was modified since, so changing one Str condition reruns one raster
+# and the HCN summary that reads it. Ready nodes run concurrently within a core budget.
+# The keys and output hashes of the last successful runs are kept in intermediate_result/pipeline_manifest.json.
+
+ROOT = path.dirname(path.abspath(__file__))
+SAVE_DIR = path.join(ROOT, "intermediate_result")
+RESULT_DIR = path.join(ROOT, "simulation_result")
+BUILD_DIR = path.join(ROOT, "build")
+MANIFEST = path.join(SAVE_DIR, "pipeline_manifest.json")
+LOG_DIR = path.join(SAVE_DIR, "pipeline_logs")
+HCN_CHOICES = ("zero", "den", "som")
+STEP1_OUTPUTS = ["prepared_g.bin", "prepared_I.bin", "prepared_r_0.bin", "prepared_r_som.bin", "prepared_r_den.bin"]
+
+
+class Node:
+    def __init__(self, name, cmd, inputs=(), outputs=(), deps=(), cores=1, extra_key=""):
+        self.name = name
+        self.cmd = list(cmd)
+        self.inputs = list(inputs)  # files whose content is part of the key
+        self.outputs = list(outputs)
+        self.deps = list(deps)  # nodes producing some of the inputs
+        self.cores = cores
+        self.extra_key = extra_key
+        self.key = None
+
+
+def file_hash(filename):
+    h = hashlib.sha256()
+    with open(filename, "rb") as file:
+        for block in iter(lambda: file.read(1 << 20), b""):
+            h.update(block)
+    return h.hexdigest()
+
+
+def include_closure(source):
+    """source and every header it #includes with quotes, recursively"""
+    files, todo = [], [path.join(ROOT, source)]
+    while todo:
+        filename = todo.pop()
+        if filename in files or not path.exists(filename):
+            continue
+        files.append(filename)
+        with open(filename, encoding="utf-8", errors="replace") as file:
+            for included in re.findall(r'^\s*#\s*include\s+"([^"]+)"', file.read(), re.M):
+                todo.append(path.normpath(path.join(path.dirname(filename), included)))
+    return sorted(files)
+
+
+def node_key(node):
+    h = hashlib.sha256()
+    h.update(json.dumps([node.name, node.cmd, node.extra_key]).encode())
+    for filename in node.inputs:
+        h.update(path.relpath(filename, ROOT).encode())
+        h.update(file_hash(filename).encode())
+    return h.hexdigest()
+
+
+def build_graph(args):
+    nodes = {}
+
+    def add(node):
+        nodes[node.name] = node
+        return node
+
+    def executable(source):
+        exe = path.join(BUILD_DIR, source[:-2] + ".exe")
+        cmd = [args.cc, *args.cflags.split(), f'-DSAVE_DIR="{SAVE_DIR}/"', f'-DRESULT_DIR="{RESULT_DIR}/"',
+               "-o", exe, path.join(ROOT, source), "-lm"]
+        add(Node(f"build/{source[:-2]}", cmd, include_closure(source), [exe]))
+        return exe
+
+    env_key = json.dumps(sorted((k, v) for k, v in os.environ.items() if k.startswith("OMP_")))
+    selected = {hcn: [path.join(SAVE_DIR, f"selected_{kind}_HCN_{hcn}.bin") for kind in ("I", "g", "r")]
+                for hcn in HCN_CHOICES}
+    all_selected = [filename for hcn in HCN_CHOICES for filename in selected[hcn]]
+
+    # step1 + step2: grid search and contour sampling, or the native target solver (no step1)
+    if args.step2 == "grid":
+        step1_exe = executable("step1_grid_search_g_HCN.c")
+        add(Node("step1", [step1_exe], [step1_exe], [path.join(SAVE_DIR, f) for f in STEP1_OUTPUTS],
+                 ["build/step1_grid_search_g_HCN"]))
+        # the target rates are drawn with np.random, seeded here so that the step is reproducible
+        script = ("import numpy as np, runpy; np.random.seed(%d); "
+                  "runpy.run_path('step2_generate_I_g_pairs.py', run_name='__main__')" % args.seed)
+        add(Node("step2", [sys.executable, "-c", script],
+                 [path.join(ROOT, f) for f in ("step2_generate_I_g_pairs.py", "utils.py", "bio_data/OnePulse.xlsx")] +
+                 [path.join(SAVE_DIR, f) for f in STEP1_OUTPUTS],
+                 all_selected, ["step1"]))
+    else:
+        solver_exe = executable("step2_solve_targets.c")
+        add(Node("step2", [solver_exe, "-num", str(args.num_targets), "-seed", str(args.seed)], [solver_exe],
+                 all_selected + [path.join(SAVE_DIR, f) for f in ("selected_target_r.bin", "selected_converged.bin")],
+                 ["build/step2_solve_targets"],
+                 cores=args.cores, extra_key=env_key))
+
+    # step3: one node per condition of run_all.py, reading only the selected pairs of its HCN choice
+    step3_exe = executable("step3_simulation.c")
+    for hcn in HCN_CHOICES:
+        if hcn not in args.hcn:
+            continue
+        task_dir = f"pipeline_HCN_{hcn}"
+        conditions = [("none", 0, ["-Str_stim", "-1", "-GPe_stim", "-1"])]
+        conditions += [("GPe", i, ["-GPe", str(W), "-tau", str(tau), "-GPe_stim", "1000", "-Str_stim", "-1"])
+                       for i, (tau, W) in enumerate(zip(tau_GPe, W_GPe))]
+        conditions += [("Str", i, ["-Str", str(W), "-tau", str(tau), "-Str_stim", "1000", "-GPe_stim", "-1"])
+                       for i, (tau, W) in enumerate(zip(tau_Str, W_Str))]
+        rasters = []
+        for stimulus, i, condition in conditions:
+            task_id = f"{task_dir}/raster_HCN_{hcn}_Stim_{stimulus}_{str(i).zfill(2)}"
+            outputs = [path.join(RESULT_DIR, task_id + ".csv"), path.join(RESULT_DIR, task_id + "_summary.bin")]
+            add(Node(f"step3/{hcn}/{stimulus}_{str(i).zfill(2)}",
+                     [step3_exe, "-HCN", hcn, *condition, "-num", str(args.num), "-o", task_id],
+                     [step3_exe] + selected[hcn][:2], outputs, ["build/step3_simulation", "step2"]))
+            rasters.append(outputs[0])
+
+        # summary: xlsx of the rasters and the comparison figure of visualization.py
+        add(Node(f"summary/{hcn}", [sys.executable, path.join(ROOT, "visualization.py"), "--task_id", task_dir],
+                 [path.join(ROOT, f) for f in ("visualization.py", "utils.py", "bio_data/OnePulse.xlsx")] + rasters,
+                 [path.join(RESULT_DIR, f"{task_dir}_HCN_{hcn}.xlsx"),
+                  path.join(ROOT, "figures", f"{task_dir}_HCN_{hcn}.jpg")],
+                 [name for name in nodes if name.startswith(f"step3/{hcn}/")]))
+    return nodes
+
+
+def load_manifest():
+    if not path.exists(MANIFEST):
+        return {}
+    with open(MANIFEST) as file:
+        return json.load(file)
+
+
+def save_manifest(manifest):
+    with open(MANIFEST + ".tmp", "w") as file:
+        json.dump(manifest, file, indent=1, sort_keys=True)
+    os.replace(MANIFEST + ".tmp", MANIFEST)
+
+
+def up_to_date(node, manifest):
+    entry = manifest.get(node.name)
+    if entry is None or entry["key"] != node.key:
+        return False
+    return all(path.exists(f) and file_hash(f) == entry["outputs"].get(path.relpath(f, ROOT)) for f in node.outputs)
+
+
+def prune_rasters(nodes):
+    """raster files of conditions that are no longer part of the experiment, visualization.py reads every raster"""
+    expected = {f for node in nodes.values() for f in node.outputs}
+    for hcn in HCN_CHOICES:
+        task_path = path.join(RESULT_DIR, f"pipeline_HCN_{hcn}")
+        if not path.isdir(task_path):
+            continue
+        for filename in os.listdir(task_path):
+            full_name = path.join(task_path, filename)
+            if filename.startswith("raster_") and full_name not in expected:
+                print(f"Removing stale {path.relpath(full_name, ROOT)}")
+                os.remove(full_name)
+
+
+def run(nodes, args):
+    """run stale nodes in dependency order, at most args.cores cores busy; return the number of failed nodes"""
+    manifest = load_manifest()
+    for name in args.force:
+        manifest = {k: v for k, v in manifest.items() if not re.fullmatch(name, k)}
+    os.makedirs(BUILD_DIR, exist_ok=True)
+    os.makedirs(LOG_DIR, exist_ok=True)
+    for hcn in args.hcn:
+        os.makedirs(path.join(RESULT_DIR, f"pipeline_HCN_{hcn}"), exist_ok=True)
+
+    pending = dict(nodes)
+    done, failed, stale, running = set(), set(), set(), {}
+    num_run = num_skipped = 0
+    start = time.time()
+    while pending or running:
+        # start ready nodes while the core budget allows (a node asking for more than the budget runs alone)
+        for name, node in list(pending.items()):
+            if any(dep in failed for dep in node.deps if dep in nodes):
+                failed.add(name)
+                del pending[name]
+                print(f"[skip] {name}: upstream failed")
+                continue
+            if not all(dep in done or dep not in nodes for dep in node.deps):
+                continue
+            upstream_stale = args.dry_run and any(dep in stale for dep in node.deps)
+            if not upstream_stale:
+                node.key = node_key(node)
+            if not upstream_stale and up_to_date(node, manifest):
+                done.add(name)
+                del pending[name]
+                num_skipped += 1
+                continue
+            busy = sum(n.cores for n, _, _ in running.values())
+            cores = min(node.cores, args.cores)
+            if running and busy + cores > args.cores:
+                continue
+            del pending[name]
+            if args.dry_run:
+                print(f"[stale] {name}")
+                stale.add(name)
+                done.add(name)
+                continue
+            log_name = path.join(LOG_DIR, name.replace("/", "_") + ".log")
+            log = open(log_name, "w")
+            env = dict(os.environ, OMP_NUM_THREADS=str(cores), MPLBACKEND="Agg")
+            print(f"[run] {name}")
+            running[name] = (node, subprocess.Popen(node.cmd, cwd=ROOT, stdout=log, stderr=subprocess.STDOUT, env=env),
+                             log)
+        if not running:
+            if pending and not args.dry_run:
+                time.sleep(0.05)
+            continue
+
+        # wait for any running node
+        finished = []
+        while not finished:
+            finished = [name for name, (_, process, _) in running.items() if process.poll() is not None]
+            if not finished:
+                time.sleep(0.05)
+        for name in finished:
+            node, process, log = running.pop(name)
+            log.close()
+            missing = [f for f in node.outputs if not path.exists(f)]
+            if process.returncode != 0 or missing:
+                failed.add(name)
+                print(f"[fail] {name} (exit code {process.returncode}{', missing ' + str(missing) if missing else ''}),"
+                      f" see {path.relpath(path.join(LOG_DIR, name.replace('/', '_') + '.log'), ROOT)}")
+                continue
+            manifest[name] = {"key": node.key, "outputs": {path.relpath(f, ROOT): file_hash(f) for f in node.outputs}}
+            save_manifest(manifest)
+            done.add(name)
+            num_run += 1
+    print(f"{num_run} node(s) run, {num_skipped} up to date, {len(failed)} failed in {time.time() - start:.1f} s")
+    return len(failed)
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description="incremental pipeline: build, step1, step2, step3, summary")
+    parser.add_argument("--cores", type=int, default=os.cpu_count(), help="core budget of concurrent nodes")
+    parser.add_argument("--hcn", nargs="+", default=list(HCN_CHOICES), choices=HCN_CHOICES)
+    parser.add_argument("--step2", default="grid", choices=("grid", "solver"),
+                        help="step1 grid + step2 contours, or step2_solve_targets.c")
+    parser.add_argument("--seed", type=int, default=0, help="seed of the target rates drawn in step2")
+    parser.add_argument("--num_targets", type=int, default=1000, help="target rates of the solver")
+    parser.add_argument("--num", type=int, default=100, help="trials per step3 condition")
+    parser.add_argument("--cc", default=os.environ.get("CC", "gcc"))
+    parser.add_argument("--cflags", default="-O2 -fopenmp")
+    parser.add_argument("--force", nargs="*", default=[], help="node name patterns to rerun, e.g. 'step3/den/.*'")
+    parser.add_argument("--dry_run", action="store_true", help="only list the stale nodes")
+    return parser.parse_args()
+
+
+def main():
+    args = parse_args()
+    nodes = build_graph(args)
+    if not args.dry_run:
+        prune_rasters(nodes)
+    sys.exit(1 if run(nodes, args) else 0)
+
+
+if __name__ == "__main__":
+    main()
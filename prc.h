@@ -0,0 +1,111 @@
+// prc.h
+// Phase-response curves by limit-cycle forking. Each cell is settled onto its tonic limit cycle once (PRC_settle ms,
+// then cycles until two consecutive interspike intervals agree within PRC_period_tol), and the state is snapshot at
+// M evenly spaced phases of the following cycle, phase 0 being the step that detected a spike. Every snapshot is then
+// forked into a short run with the GPe and/or Str input applied at its first step, which gives the phase shift and the
+// pause as a function of the phase at which the input lands. This replaces M full runs with a fixed stimulation time
+// by one settle run plus M short forks, and all forks run in parallel when compiled with -fopenmp.
+// A fork is the same computation as the tail of a full run whose stimulation falls on the snapshot step, so its spike
+// times equal those of that run.
+#ifndef PRC_H
+#define PRC_H
+#include "simulation.h"
+#include <math.h>
+
+typedef struct {
+    int oscillating;     // 0: no tonic firing within PRC_max_cycles cycles after settling, no snapshots
+    double period;       // ms, last interspike interval of the settled cycle
+    double start;        // ms, time of the phase-0 spike
+} LimitCycle;
+
+typedef struct {
+    double phase;        // in [0, 1), time since the phase-0 spike / period
+    double first_spike;  // ms from the input to the first spike, the pause (duration of the fork if none)
+    double phase_shift;  // of the first spike in periods, positive: advanced (NAN if none)
+    double phase_shift_2;  // of the second spike, includes the slower recovery of the cycle (NAN if none)
+} PrcPoint;
+
+
+// settle `c` onto its limit cycle and snapshot `num_phases` states at phases k / num_phases of one cycle,
+// `phases` gets the exact phase of every snapshot (snapshots fall on steps)
+LimitCycle prc_limit_cycle(const CellParams *restrict p, CellState *restrict c, int num_phases,
+                           CellState *restrict snapshots, double *restrict phases) {
+    LimitCycle cycle = {0, NAN, NAN};
+    long steps = 0;
+    INSTR_TIMER_START(kernel);
+    for (int i = 0; i < PRC_settle * CONFIG_1ms_step_num; i++) {
+        set_cell_stim(c, i, -1, -1);
+        kernel_step(p, c, CONFIG_dt);
+    }
+    steps += PRC_settle * CONFIG_1ms_step_num;
+
+    // spike times until two consecutive intervals agree; a silent cell gives up after the longest allowed interval
+    double last_spike = NAN, last_isi = NAN;
+    int num_spikes = 0, max_steps = PRC_max_isi * CONFIG_1ms_step_num, since_spike = 0;
+    while (num_spikes <= PRC_max_cycles && since_spike < max_steps) {
+        set_cell_stim(c, 0, -1, -1);
+        since_spike++;
+        if (!kernel_step(p, c, CONFIG_dt)) continue;
+        double isi = c->time - last_spike;
+        if (num_spikes >= 2 && fabs(isi - last_isi) <= PRC_period_tol) {
+            cycle.oscillating = 1;
+            cycle.period = isi;
+            cycle.start = c->time;
+            break;
+        }
+        last_isi = isi;
+        last_spike = c->time;
+        num_spikes++;
+        steps += since_spike;
+        since_spike = 0;
+    }
+    steps += since_spike;
+    if (cycle.oscillating) {
+        // one more cycle: the state right after the phase-0 step, then at the steps closest to k / num_phases
+        double period_steps = cycle.period * CONFIG_1ms_step_num;
+        int next = 0;
+        for (int k = 0; k < num_phases; k++) {
+            int target = (int)floor(k * period_steps / num_phases + 0.5);
+            for (; next < target; next++) {
+                set_cell_stim(c, 0, -1, -1);
+                kernel_step(p, c, CONFIG_dt);
+            }
+            snapshots[k] = *c;
+            phases[k] = (c->time - cycle.start) / cycle.period;
+        }
+        steps += next;
+    }
+    INSTR_TIMER_STOP(kernel, INSTR_KERNEL);
+    INSTR_COUNT(INSTR_STEPS, steps);
+    INSTR_COUNT(INSTR_SIMULATIONS, 1);
+    return cycle;
+}
+
+// fork `duration` ms from `snapshot` with the GPe (`GPe` = 1) and/or Str (`Str` = 1) input at its first step
+PrcPoint prc_fork(const CellParams *restrict p, const CellState *restrict snapshot, const LimitCycle *cycle,
+                  double phase, int GPe, int Str, int duration) {
+    PrcPoint point = {phase, duration, NAN, NAN};
+    CellState c = *snapshot;
+    double start = c.time, spikes[2];
+    int num_spikes = 0, num_steps = duration * CONFIG_1ms_step_num, i;
+    INSTR_TIMER_START(kernel);
+    for (i = 0; i < num_steps && num_spikes < 2; i++) {
+        set_cell_stim(&c, i, GPe ? 0 : -1, Str ? 0 : -1);
+        if (kernel_step(p, &c, CONFIG_dt)) spikes[num_spikes++] = c.time - start;
+    }
+    INSTR_TIMER_STOP(kernel, INSTR_KERNEL);
+    INSTR_COUNT(INSTR_STEPS, i);
+    INSTR_COUNT(INSTR_SPIKES, num_spikes);
+    INSTR_COUNT(INSTR_SIMULATIONS, 1);
+    INSTR_COUNT(INSTR_EARLY_EXITS, i < num_steps);  // stopped after the second spike
+    // unperturbed, the next spikes would come (1 - phase) and (2 - phase) periods after the snapshot
+    double offset = phase * cycle->period;
+    if (num_spikes >= 1) {
+        point.first_spike = spikes[0];
+        point.phase_shift = (cycle->period - offset - spikes[0]) / cycle->period;
+    }
+    if (num_spikes >= 2) point.phase_shift_2 = (2 * cycle->period - offset - spikes[1]) / cycle->period;
+    return point;
+}
+
+#endif
@@ -0,0 +1,474 @@
+// sensitivity.h
+// Forward (tangent-linear) sensitivities of a cell with respect to its main parameters, in one pass: every evolving
+// variable of f() is carried as a dual number (value + derivatives with respect to the SENS_NUM_PARAMS parameters
+// below), so one run yields the trajectory and d(state)/d(parameter). The value part performs the operations of
+// cell_step() (cell.h) in the same order and is bit-identical to the generic kernel.
+// Spike times are the threshold crossings of V_s, their derivatives those of the linearly interpolated crossing;
+// rates are differentiated through the interspike-interval rate (count-based rates are piecewise constant).
+// sens_target_search() uses them to solve rate(parameter) = target by safeguarded Newton iteration.
+#ifndef SENSITIVITY_H
+#define SENSITIVITY_H
+#include "simulation.h"
+#include <math.h>
+
+enum {
+    SENS_g_HCN_som,
+    SENS_g_HCN_den,
+    SENS_I_app,
+    SENS_W_GPe,
+    SENS_W_Str,
+    SENS_tau_GABA_som,
+    SENS_tau_GABA_den,
+    SENS_NUM_PARAMS
+};
+
+static const char *SENS_PARAM_NAMES[SENS_NUM_PARAMS] = {
+    "g_HCN_som", "g_HCN_den", "I_app", "W_GPe", "W_Str", "tau_GABA_som", "tau_GABA_den",
+};
+
+#define SENS_target_tol 0.05     // Hz, |rate - target| accepted by sens_target_search()
+#define SENS_target_max_iter 12  // simulations per search
+
+typedef struct {
+    double x;
+    double dx[SENS_NUM_PARAMS];
+} Dual;
+
+// CellState with dual variables
+typedef struct {
+    double time;
+    Dual V_s;
+    Dual V_d;
+    Dual z[NUM_PACKED_GATES];  // m_Na_f ... m_HCN_den
+    Dual D;
+    Dual F;
+    Dual Ca_in;
+    Dual Cl_som;
+    Dual Cl_den;
+    Dual g_GABA_som;
+    Dual g_GABA_den;
+    Dual param[SENS_NUM_PARAMS];  // the differentiated parameters, seeded with unit derivatives
+    int GPe_stim;
+    int Str_stim;
+    int SNr_stim;
+} SensState;
+
+typedef struct {
+    int num_spikes;
+    double *spike_times;     // as in Spikes (end of the crossing step)
+    double *crossing_times;  // linearly interpolated threshold crossings in ms
+    double *d_spike_times;   // [num_spikes][SENS_NUM_PARAMS], d(crossing time)/d(parameter) in ms per unit
+    int capacity;            // allocated spikes, doubled when full
+} SensSpikes;
+
+typedef struct {
+    double rate;                       // firing_rate_of(), spike count after PREPARE_DURATION_init
+    double isi_rate;                   // (n - 1) / (t_last - t_first) over the crossings of the same spikes,
+                                       // 0 below 2 spikes
+    double d_isi_rate[SENS_NUM_PARAMS];
+} SensRate;
+
+typedef struct {
+    double value;       // parameter value of the last evaluation
+    double rate;        // its firing_rate_of() rate
+    double isi_rate;    // its ISI rate, the searched quantity
+    int num_evaluations;
+    int converged;
+} SensSearch;
+
+
+// ###################################################################
+// ############             Dual arithmetic             ##############
+// ###################################################################
+
+static inline Dual dual_const(double x) {
+    Dual r = {x, {0}};
+    return r;
+}
+
+static inline Dual dual_add(Dual a, Dual b) {
+    Dual r;
+    r.x = a.x + b.x;
+    for (int i = 0; i < SENS_NUM_PARAMS; i++) r.dx[i] = a.dx[i] + b.dx[i];
+    return r;
+}
+
+static inline Dual dual_sub(Dual a, Dual b) {
+    Dual r;
+    r.x = a.x - b.x;
+    for (int i = 0; i < SENS_NUM_PARAMS; i++) r.dx[i] = a.dx[i] - b.dx[i];
+    return r;
+}
+
+static inline Dual dual_mul(Dual a, Dual b) {
+    Dual r;
+    r.x = a.x * b.x;
+    for (int i = 0; i < SENS_NUM_PARAMS; i++) r.dx[i] = a.dx[i] * b.x + a.x * b.dx[i];
+    return r;
+}
+
+static inline Dual dual_div(Dual a, Dual b) {
+    Dual r;
+    r.x = a.x / b.x;
+    for (int i = 0; i < SENS_NUM_PARAMS; i++) r.dx[i] = (a.dx[i] - r.x * b.dx[i]) / b.x;
+    return r;
+}
+
+// a + c
+static inline Dual dual_addc(Dual a, double c) {
+    a.x = a.x + c;
+    return a;
+}
+
+// a - c
+static inline Dual dual_subc(Dual a, double c) {
+    a.x = a.x - c;
+    return a;
+}
+
+// c - a
+static inline Dual dual_csub(double c, Dual a) {
+    Dual r;
+    r.x = c - a.x;
+    for (int i = 0; i < SENS_NUM_PARAMS; i++) r.dx[i] = -a.dx[i];
+    return r;
+}
+
+// c * a
+static inline Dual dual_mulc(double c, Dual a) {
+    Dual r;
+    r.x = c * a.x;
+    for (int i = 0; i < SENS_NUM_PARAMS; i++) r.dx[i] = c * a.dx[i];
+    return r;
+}
+
+// a / c
+static inline Dual dual_divc(Dual a, double c) {
+    Dual r;
+    r.x = a.x / c;
+    for (int i = 0; i < SENS_NUM_PARAMS; i++) r.dx[i] = a.dx[i] / c;
+    return r;
+}
+
+// c / a
+static inline Dual dual_cdiv(double c, Dual a) {
+    Dual r;
+    r.x = c / a.x;
+    for (int i = 0; i < SENS_NUM_PARAMS; i++) r.dx[i] = -r.x * a.dx[i] / a.x;
+    return r;
+}
+
+static inline Dual dual_neg(Dual a) {
+    return dual_csub(0, a);
+}
+
+static inline Dual dual_exp(Dual a) {
+    Dual r;
+    r.x = exp(a.x);
+    for (int i = 0; i < SENS_NUM_PARAMS; i++) r.dx[i] = r.x * a.dx[i];
+    return r;
+}
+
+static inline Dual dual_log(Dual a) {
+    Dual r;
+    r.x = log(a.x);
+    for (int i = 0; i < SENS_NUM_PARAMS; i++) r.dx[i] = a.dx[i] / a.x;
+    return r;
+}
+
+// a^n for a constant exponent
+static inline Dual dual_pow(Dual a, double n) {
+    Dual r;
+    r.x = pow(a.x, n);
+    double slope = n * pow(a.x, n - 1);
+    for (int i = 0; i < SENS_NUM_PARAMS; i++) r.dx[i] = slope * a.dx[i];
+    return r;
+}
+
+
+// ###################################################################
+// ############                 Kernel                  ##############
+// ###################################################################
+
+static inline void sens_set_param(CellParams *restrict p, CellState *restrict c, int param, double value) {
+    switch (param) {
+        case SENS_g_HCN_som: c->g_HCN_som = value; break;
+        case SENS_g_HCN_den: c->g_HCN_den = value; break;
+        case SENS_I_app: c->I_app = value; break;
+        case SENS_W_GPe: p->W_GPe = value; break;
+        case SENS_W_Str: p->W_Str = value; break;
+        case SENS_tau_GABA_som: p->tau_GABA_som = value; break;
+        case SENS_tau_GABA_den: p->tau_GABA_den = value; break;
+    }
+}
+
+// index of a parameter name, -1 if it is not differentiated
+static inline int sens_param_index(const char *name) {
+    for (int i = 0; i < SENS_NUM_PARAMS; i++) {
+        if (strcmp(SENS_PARAM_NAMES[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+static inline Dual dual_seed(double x, int i) {
+    Dual r = dual_const(x);
+    r.dx[i] = 1;
+    return r;
+}
+
+SensState sens_from_cell(const CellParams *restrict p, const CellState *restrict c) {
+    SensState s;
+    s.time = c->time;
+    s.V_s = dual_const(c->V_s);
+    s.V_d = dual_const(c->V_d);
+    const double *z = &c->m_Na_f;
+    for (int i = 0; i < NUM_PACKED_GATES; i++) s.z[i] = dual_const(z[i]);
+    s.D = dual_const(c->D);
+    s.F = dual_const(c->F);
+    s.Ca_in = dual_const(c->Ca_in);
+    s.Cl_som = dual_const(c->Cl_som);
+    s.Cl_den = dual_const(c->Cl_den);
+    s.g_GABA_som = dual_const(c->g_GABA_som);
+    s.g_GABA_den = dual_const(c->g_GABA_den);
+    s.param[SENS_g_HCN_som] = dual_seed(c->g_HCN_som, SENS_g_HCN_som);
+    s.param[SENS_g_HCN_den] = dual_seed(c->g_HCN_den, SENS_g_HCN_den);
+    s.param[SENS_I_app] = dual_seed(c->I_app, SENS_I_app);
+    s.param[SENS_W_GPe] = dual_seed(p->W_GPe, SENS_W_GPe);
+    s.param[SENS_W_Str] = dual_seed(p->W_Str, SENS_W_Str);
+    s.param[SENS_tau_GABA_som] = dual_seed(p->tau_GABA_som, SENS_tau_GABA_som);
+    s.param[SENS_tau_GABA_den] = dual_seed(p->tau_GABA_den, SENS_tau_GABA_den);
+    s.GPe_stim = c->GPe_stim;
+    s.Str_stim = c->Str_stim;
+    s.SNr_stim = c->SNr_stim;
+    return s;
+}
+
+// dz_lane() on dual numbers
+static inline void sens_dz(const GatePack *restrict pack, int i, Dual *restrict z, Dual V, double dt) {
+    Dual z_0 = dual_cdiv(1. - pack->x_min[i], dual_addc(dual_exp(dual_divc(dual_csub(pack->V_z[i], V), pack->k_z[i])), 1.));
+    Dual sum = dual_add(dual_exp(dual_divc(dual_csub(pack->V_tau[i], V), pack->sig_0[i])),
+                        dual_exp(dual_divc(dual_csub(pack->V_tau[i], V), pack->sig_1[i])));
+    Dual tau = dual_addc(dual_cdiv(pack->tau_1[i] - pack->tau_0[i], sum), pack->tau_0[i]);
+    Dual dz = dual_mul(dual_sub(z_0, *z), dual_csub(1, dual_exp(dual_cdiv(-dt, tau))));
+    *z = dual_add(*z, dz);
+}
+
+// E = V_T * log(out / in) / z for a reversal potential
+static inline Dual sens_reversal(double out, Dual in, double z) {
+    return dual_divc(dual_mulc(V_T, dual_log(dual_cdiv(out, in))), z);
+}
+
+// cell_step() on dual numbers; on a spike, *crossing is the interpolated threshold crossing time
+int sens_step(const CellParams *restrict p, SensState *restrict c, double dt, Dual *restrict crossing) {
+    const Dual *param = c->param;
+
+    // Reversal potentials in mV
+    Dual E_Ca = sens_reversal(Ca_out, c->Ca_in, z_Ca);
+    Dual E_Cl_som = sens_reversal(Cl_out, c->Cl_som, z_Cl);
+    Dual E_Cl_den = sens_reversal(Cl_out, c->Cl_den, z_Cl);
+    Dual E_GABA_som = sens_reversal(p_Cl * Cl_out + p_HCO3 * HCO3_out,
+                                    dual_addc(dual_mulc(p_Cl, c->Cl_som), p_HCO3 * HCO3_in), z_GABA);
+    Dual E_GABA_den = sens_reversal(p_Cl * Cl_out + p_HCO3 * HCO3_out,
+                                    dual_addc(dual_mulc(p_Cl, c->Cl_den), p_HCO3 * HCO3_in), z_GABA);
+
+    // Outward currents in pA/pF = mV/ms
+    Dual *z = c->z;
+    Dual I_Na_f = dual_mul(dual_mul(dual_mul(dual_mulc(g_Na_f, dual_pow(z[0], 3)), z[1]), z[2]), dual_subc(c->V_s, E_Na));
+    Dual I_Na_p = dual_mul(dual_mul(dual_mulc(g_Na_p, dual_pow(z[3], 3)), z[4]), dual_subc(c->V_s, E_Na));
+    Dual I_K = dual_mul(dual_mul(dual_mulc(g_K, dual_pow(z[5], 4)), z[6]), dual_subc(c->V_s, E_K));
+    Dual I_Ca = dual_mul(dual_mul(dual_mulc(g_Ca, z[7]), z[8]), dual_sub(c->V_s, E_Ca));
+    Dual I_leak = dual_mulc(g_leak, dual_subc(c->V_s, p->E_leak));
+    Dual I_DS = dual_mulc(g_C / C_som, dual_sub(c->V_s, c->V_d));
+    Dual I_HCN_som = dual_mul(dual_mul(param[SENS_g_HCN_som], z[9]), dual_subc(c->V_s, E_HCN));
+    Dual I_GABA_som = dual_mul(c->g_GABA_som, dual_sub(c->V_s, E_GABA_som));
+
+    Dual m_SK = dual_cdiv(1., dual_addc(dual_pow(dual_cdiv(k_SK, c->Ca_in), n_SK), 1.));
+    Dual I_SK = dual_mul(dual_mulc(g_SK, m_SK), dual_subc(c->V_s, E_K));
+
+    Dual I_SD = dual_mulc(g_C / C_den, dual_sub(c->V_d, c->V_s));
+    Dual I_TRPC3 = dual_mulc(g_TRPC3, dual_subc(c->V_d, E_TRPC3));
+    Dual I_HCN_den = dual_mul(dual_mul(param[SENS_g_HCN_den], z[10]), dual_subc(c->V_d, E_HCN));
+    Dual I_GABA_den = dual_mul(c->g_GABA_den, dual_sub(c->V_d, E_GABA_den));
+
+    Dual chi_som = dual_div(dual_csub(E_HCO3, E_GABA_som), dual_csub(E_HCO3, E_Cl_som));
+    Dual chi_den = dual_div(dual_csub(E_HCO3, E_GABA_den), dual_csub(E_HCO3, E_Cl_den));
+    Dual I_chi_som = dual_mul(dual_mul(chi_som, dual_addc(c->g_GABA_som, g_ton_som)), dual_sub(c->V_s, E_Cl_som));
+    Dual I_chi_den = dual_mul(dual_mul(chi_den, dual_addc(c->g_GABA_den, g_ton_den)), dual_sub(c->V_d, E_Cl_den));
+    Dual I_KCC2_som = dual_mulc(g_KCC2_som, dual_csub(E_K, E_Cl_som));
+    Dual I_KCC2_den = dual_mulc(g_KCC2_den, dual_csub(E_K, E_Cl_den));
+
+    Dual sum_som = dual_add(dual_add(dual_add(dual_add(dual_add(dual_add(dual_add(dual_add(
+        I_Na_f, I_Na_p), I_K), I_Ca), I_leak), I_SK), I_DS), I_HCN_som), I_GABA_som);
+    Dual dVs_dt = dual_add(dual_neg(sum_som), dual_divc(param[SENS_I_app], C_som));
+    Dual sum_den = dual_add(dual_add(dual_add(I_SD, I_TRPC3), I_HCN_den), I_GABA_den);
+    Dual dVd_dt = dual_addc(dual_neg(sum_den), p->I_den / C_den);
+
+    // State variable updates
+    double t_0 = c->time;
+    c->time += dt;
+    for (int i = 0; i < NUM_PACKED_GATES - 1; i++) sens_dz(&p->gates, i, &z[i], c->V_s, dt);
+    sens_dz(&p->gates, NUM_PACKED_GATES - 1, &z[NUM_PACKED_GATES - 1], c->V_d, dt);
+
+    c->Ca_in = dual_add(c->Ca_in, dual_divc(dual_mulc(dt, dual_csub(Ca_min, c->Ca_in)), tau_Ca));
+    c->Ca_in = dual_sub(c->Ca_in, dual_mulc(dt * alpha_Ca * C_som, I_Ca));
+
+    c->Cl_som = dual_add(c->Cl_som, dual_divc(dual_mulc(dt, dual_sub(c->Cl_den, c->Cl_som)), tau_SD));
+    c->Cl_den = dual_add(c->Cl_den, dual_divc(dual_mulc(dt, dual_sub(c->Cl_som, c->Cl_den)), tau_DS));
+    c->Cl_som = dual_add(c->Cl_som, dual_mulc(dt * alpha_Cl_som * C_som, dual_add(I_KCC2_som, I_chi_som)));
+    c->Cl_den = dual_add(c->Cl_den, dual_mulc(dt * alpha_Cl_den * C_den, dual_add(I_KCC2_den, I_chi_den)));
+
+    c->g_GABA_som = dual_mul(c->g_GABA_som, dual_exp(dual_cdiv(-dt, param[SENS_tau_GABA_som])));
+    c->g_GABA_den = dual_mul(c->g_GABA_den, dual_exp(dual_cdiv(-dt, param[SENS_tau_GABA_den])));
+    c->D = dual_add(c->D, dual_mulc(1 - exp(-dt / tau_D), dual_csub(p->D_0, c->D)));
+    c->F = dual_add(c->F, dual_mulc(1 - exp(-dt / tau_F), dual_csub(p->F_0, c->F)));
+
+    c->g_GABA_som = dual_addc(c->g_GABA_som, p->W_SNr * c->SNr_stim);
+    if (c->GPe_stim) {
+        c->g_GABA_som = dual_add(c->g_GABA_som, dual_mul(param[SENS_W_GPe], c->D));
+        c->D = dual_add(c->D, dual_mulc(alpha_D, dual_csub(p->D_m, c->D)));
+    }
+    if (c->Str_stim) {
+        c->g_GABA_den = dual_add(c->g_GABA_den, dual_mul(param[SENS_W_Str], c->F));
+        c->F = dual_add(c->F, dual_mulc(alpha_F, dual_csub(p->F_m, c->F)));
+    }
+
+    Dual V_0 = c->V_s;
+    c->V_s = dual_add(c->V_s, dual_mulc(dt, dVs_dt));
+    c->V_d = dual_add(c->V_d, dual_mulc(dt, dVd_dt));
+    int spike = (V_0.x < p->V_th) && (c->V_s.x >= p->V_th);
+    if (spike) {
+        // t_0 + dt (V_th - V_0) / (V_1 - V_0)
+        Dual fraction = dual_div(dual_csub(p->V_th, V_0), dual_sub(c->V_s, V_0));
+        *crossing = dual_addc(dual_mulc(dt, fraction), t_0);
+    }
+    return spike;
+}
+
+
+// ###################################################################
+// ############               Simulation                ##############
+// ###################################################################
+
+// cell_spike_simulation() with spike-time sensitivities, `c` is advanced (values only)
+SensSpikes sens_spike_simulation(const CellParams *restrict p, CellState *restrict c, int duration,
+                                 double GPe_stim_time, double Str_stim_time) {
+    SensSpikes spikes = {0};
+    spikes.capacity = CONFIG_spikes_init_size;
+    spikes.spike_times = (double *)malloc(spikes.capacity * sizeof(double));
+    spikes.crossing_times = (double *)malloc(spikes.capacity * sizeof(double));
+    spikes.d_spike_times = (double *)malloc(spikes.capacity * SENS_NUM_PARAMS * sizeof(double));
+    SensState s = sens_from_cell(p, c);
+    INSTR_TIMER_START(kernel);
+    for (int i = 0; i < duration*CONFIG_1ms_step_num; i++) {
+        s.GPe_stim = stim_onset(i, GPe_stim_time);
+        s.Str_stim = stim_onset(i, Str_stim_time);
+        Dual crossing;
+        if (sens_step(p, &s, CONFIG_dt, &crossing)) {
+            if (spikes.num_spikes >= spikes.capacity) {
+                spikes.capacity *= 2;
+                spikes.spike_times = (double *)realloc(spikes.spike_times, spikes.capacity * sizeof(double));
+                spikes.crossing_times = (double *)realloc(spikes.crossing_times, spikes.capacity * sizeof(double));
+                spikes.d_spike_times = (double *)realloc(spikes.d_spike_times,
+                                                         spikes.capacity * SENS_NUM_PARAMS * sizeof(double));
+            }
+            spikes.spike_times[spikes.num_spikes] = s.time;
+            spikes.crossing_times[spikes.num_spikes] = crossing.x;
+            memcpy(&spikes.d_spike_times[spikes.num_spikes * SENS_NUM_PARAMS], crossing.dx, sizeof(crossing.dx));
+            spikes.num_spikes++;
+        }
+    }
+    INSTR_TIMER_STOP(kernel, INSTR_KERNEL);
+    INSTR_COUNT(INSTR_STEPS, duration*CONFIG_1ms_step_num);
+    INSTR_COUNT(INSTR_SPIKES, spikes.num_spikes);
+    INSTR_COUNT(INSTR_SIMULATIONS, 1);
+
+    c->time = s.time;
+    c->V_s = s.V_s.x;
+    c->V_d = s.V_d.x;
+    double *z = &c->m_Na_f;
+    for (int i = 0; i < NUM_PACKED_GATES; i++) z[i] = s.z[i].x;
+    c->D = s.D.x;
+    c->F = s.F.x;
+    c->Ca_in = s.Ca_in.x;
+    c->Cl_som = s.Cl_som.x;
+    c->Cl_den = s.Cl_den.x;
+    c->g_GABA_som = s.g_GABA_som.x;
+    c->g_GABA_den = s.g_GABA_den.x;
+    return spikes;
+}
+
+void sens_spikes_free(SensSpikes *spikes) {
+    free(spikes->spike_times);
+    free(spikes->crossing_times);
+    free(spikes->d_spike_times);
+}
+
+// cell_firing_rate() with rate sensitivities, `c` is not advanced
+SensRate sens_firing_rate(const CellParams *restrict p, const CellState *restrict c) {
+    CellState cell = *c;
+    SensSpikes spikes = sens_spike_simulation(p, &cell, PREPARE_DURATION_init + PREPARE_DURATION_test, -1, -1);
+    SensRate rate = {0};
+    int first = 0;
+    while (first < spikes.num_spikes && spikes.spike_times[first] < PREPARE_DURATION_init) first++;
+    int last = spikes.num_spikes - 1;
+    if (last > first) {
+        double span = spikes.crossing_times[last] - spikes.crossing_times[first];
+        rate.isi_rate = 1e3 * (last - first) / span;
+        for (int i = 0; i < SENS_NUM_PARAMS; i++) {
+            double d_span = spikes.d_spike_times[last * SENS_NUM_PARAMS + i] -
+                            spikes.d_spike_times[first * SENS_NUM_PARAMS + i];
+            rate.d_isi_rate[i] = -rate.isi_rate * d_span / span;
+        }
+    }
+    free(spikes.crossing_times);
+    free(spikes.d_spike_times);
+    Spikes counted = {0};
+    counted.spike_times = spikes.spike_times;
+    counted.num_spikes = spikes.num_spikes;
+    rate.rate = firing_rate_of(counted);
+    return rate;
+}
+
+// solve isi_rate(parameter) = target for one parameter of `c` within [low, high], starting from x_0: Newton steps on
+// the rate sensitivity, bisection once the root is bracketed and the Newton step leaves the bracket, secant steps
+// when the sensitivity is unusable (fewer than two spikes) and a move towards the farther bound without either
+void sens_target_search(const CellParams *restrict p, const CellState *restrict c, int param, double target,
+                        double low, double high, double x_0, SensSearch *result) {
+    CellParams params = *p;
+    CellState cell = *c;
+    double x = fmin(fmax(x_0, low), high);
+    double x_below = NAN, x_above = NAN;  // evaluated values with rates below / above the target
+    double x_prev = NAN, r_prev = NAN;
+    result->converged = 0;
+    for (result->num_evaluations = 0; result->num_evaluations < SENS_target_max_iter;) {
+        sens_set_param(&params, &cell, param, x);
+        SensRate rate = sens_firing_rate(&params, &cell);
+        result->num_evaluations++;
+        result->value = x;
+        result->rate = rate.rate;
+        result->isi_rate = rate.isi_rate;
+        double error = rate.isi_rate - target;
+        if (fabs(error) < SENS_target_tol) {
+            result->converged = 1;
+            return;
+        }
+        if (error < 0) x_below = x;
+        else x_above = x;
+        int bracketed = !isnan(x_below) && !isnan(x_above);
+
+        double slope = rate.d_isi_rate[param];
+        if (rate.isi_rate == 0 || slope == 0 || !isfinite(slope)) {
+            slope = !isnan(x_prev) && x != x_prev ? (rate.isi_rate - r_prev) / (x - x_prev) : 0;
+        }
+        double x_next = slope != 0 && isfinite(slope) ? x - error / slope : NAN;
+        double lo = bracketed ? fmin(x_below, x_above) : low, hi = bracketed ? fmax(x_below, x_above) : high;
+        if (isnan(x_next) || x_next <= lo || x_next >= hi) {
+            x_next = bracketed ? (lo + hi) / 2 : (x - low > high - x ? (x + low) / 2 : (x + high) / 2);
+        }
+        x_prev = x;
+        r_prev = rate.isi_rate;
+        x = x_next;
+    }
+}
+
+#endif
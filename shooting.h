@@ -0,0 +1,421 @@
+// shooting.h
+// Periodic orbits of tonically firing cells by shooting, instead of integrating through the transient. The Poincaré
+// section is the spike condition, V_s crossing V_th upwards. The map P takes the other active variables (V_d, the 11
+// gates, Ca_in) from one crossing to the next, integrating with kernel_step at CONFIG_dt and a last fractional step
+// that lands exactly on the section (V_s is linear in dt within a step). The fixed point of P is found by Newton
+// (Broyden) iteration: the first step is a plain cycle, and rank-one updates learn the few slow directions (Ca_in,
+// m_HCN, with multipliers close to 1) that make plain integration need long transients. A solve costs a 100 ms
+// settle run plus about 10 - 25 cycles, typically 500 - 800 ms of simulated time for a 25 - 50 Hz cell instead of the
+// 1500 ms of calculate_firing_rate(), and gives the period to ~1e-6 ms rather than a spike count.
+// Result: the period of the orbit of the discretized system, optionally the multipliers of P (eigenvalues of its
+// forward-difference Jacobian at the orbit, SHOOT_DIM more cycles; the trivial multiplier 1 along the flow is not
+// part of P) and the state at the start of the cycle, with the passive
+// variables (GABA conductances, D, F, chloride, which do not act on the potentials without input) at rest.
+// Silent cells, cells without a converging fixed point (bursting, irregular) and unstable orbits are flagged and
+// should fall back to time integration.
+#ifndef SHOOTING_H
+#define SHOOTING_H
+#include "simulation.h"
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+// active variables, V_s first (fixed to V_th on the section)
+#define SHOOT_NUM_VARS 14
+#define SHOOT_DIM (SHOOT_NUM_VARS - 1)
+
+enum {SHOOT_TONIC, SHOOT_SILENT, SHOOT_NOT_CONVERGED, SHOOT_UNSTABLE};
+static const char *SHOOT_STATUS_NAMES[] = {"tonic", "silent", "not_converged", "unstable"};
+
+static const size_t SHOOT_VARS[SHOOT_NUM_VARS] = {
+    offsetof(CellState, V_s), offsetof(CellState, V_d), offsetof(CellState, m_Na_f), offsetof(CellState, h_Na_f),
+    offsetof(CellState, s_Na_f), offsetof(CellState, m_Na_p), offsetof(CellState, h_Na_p), offsetof(CellState, m_K),
+    offsetof(CellState, h_K), offsetof(CellState, m_Ca), offsetof(CellState, h_Ca), offsetof(CellState, m_HCN_som),
+    offsetof(CellState, m_HCN_den), offsetof(CellState, Ca_in),
+};
+
+typedef struct {
+    int status;                 // SHOOT_*
+    int iterations;             // Newton iterations
+    int evaluations;            // map evaluations, including those of the Jacobians
+    double period;              // ms
+    double residual;            // last scaled max |P(y) - y|
+    double multipliers_re[SHOOT_DIM];  // of P, by decreasing modulus
+    double multipliers_im[SHOOT_DIM];
+    double max_multiplier;      // largest modulus
+    CellState start;            // on the section, time 0
+    double simulated_ms;        // cost of the solve
+} PeriodicOrbit;
+
+
+static inline double *shoot_var(CellState *c, int k) {
+    return (double *)((char *)c + SHOOT_VARS[k]);
+}
+
+// scale of the section variables in the convergence test and the difference steps: mV, 1 for gates, Ca_in itself
+static inline double shoot_scale(const CellState *c, int k) {
+    if (k == 0) return 10;
+    if (k == SHOOT_DIM - 1) return fmax(fabs(c->Ca_in), 1e-6);
+    return 1;
+}
+
+// GABA conductances, D, F and chloride at rest; they do not act on the potentials while the conductances are 0
+static inline void shoot_rest_passive(const CellParams *p, CellState *c) {
+    c->g_GABA_som = c->g_GABA_den = 0;
+    c->D = p->D_0;
+    c->F = p->F_0;
+    // the somatic/dendritic exchange conserves tau_SD Cl_som + tau_DS Cl_den (see f())
+    double Cl = (tau_SD * c->Cl_som + tau_DS * c->Cl_den) / (tau_SD + tau_DS);
+    c->Cl_som = c->Cl_den = Cl;
+    c->GPe_stim = c->Str_stim = c->SNr_stim = 0;
+}
+
+// integrate `c` to the next upward crossing of V_th, ending on it; the time taken in ms, -1 if none within `max_ms`
+static double shoot_to_section(const CellParams *restrict p, CellState *restrict c, double max_ms,
+                               double *simulated_ms) {
+    long max_steps = (long)(max_ms * CONFIG_1ms_step_num);
+    for (long i = 0; i < max_steps; i++) {
+        CellState previous = *c;
+        if (kernel_step(p, c, CONFIG_dt)) {
+            double fraction = (p->V_th - previous.V_s) / (c->V_s - previous.V_s);
+            *c = previous;
+            kernel_step(p, c, fraction * CONFIG_dt);
+            c->V_s = p->V_th;
+            *simulated_ms += (i + fraction) * CONFIG_dt;
+            return (i + fraction) * CONFIG_dt;
+        }
+    }
+    *simulated_ms += max_ms;
+    return -1;
+}
+
+// P(y) - y of the section variables y, on the section state `base`; the period in ms, -1 without a next crossing
+static double shoot_residual(const CellParams *p, const CellState *base, const double *y, double *residual,
+                             double *simulated_ms) {
+    CellState c = *base;
+    for (int k = 0; k < SHOOT_DIM; k++) *shoot_var(&c, k + 1) = y[k];
+    double period = shoot_to_section(p, &c, SHOOTING_max_isi, simulated_ms);
+    for (int k = 0; k < SHOOT_DIM; k++) residual[k] = *shoot_var(&c, k + 1) - y[k];
+    return period;
+}
+
+// solve a x = b in place (partial pivoting), a is n x n row-major; 1 if singular
+static int shoot_solve(double *a, double *b, int n) {
+    for (int col = 0; col < n; col++) {
+        int pivot = col;
+        for (int i = col + 1; i < n; i++) {
+            if (fabs(a[i * n + col]) > fabs(a[pivot * n + col])) pivot = i;
+        }
+        if (a[pivot * n + col] == 0) return 1;
+        if (pivot != col) {
+            for (int j = 0; j < n; j++) {
+                double t = a[col * n + j];
+                a[col * n + j] = a[pivot * n + j];
+                a[pivot * n + j] = t;
+            }
+            double t = b[col];
+            b[col] = b[pivot];
+            b[pivot] = t;
+        }
+        for (int i = col + 1; i < n; i++) {
+            double factor = a[i * n + col] / a[col * n + col];
+            for (int j = col; j < n; j++) a[i * n + j] -= factor * a[col * n + j];
+            b[i] -= factor * b[col];
+        }
+    }
+    for (int i = n - 1; i >= 0; i--) {
+        for (int j = i + 1; j < n; j++) b[i] -= a[i * n + j] * b[j];
+        b[i] /= a[i * n + i];
+    }
+    return 0;
+}
+
+
+// ###################################################################
+// ############             Eigenvalues                 ##############
+// ###################################################################
+
+// reduce a (n x n, row-major) to upper Hessenberg form by stabilized elementary similarity transformations
+static void shoot_hessenberg(double *a, int n) {
+    for (int m = 1; m < n - 1; m++) {
+        int pivot = m;
+        for (int i = m + 1; i < n; i++) {
+            if (fabs(a[i * n + m - 1]) > fabs(a[pivot * n + m - 1])) pivot = i;
+        }
+        double x = a[pivot * n + m - 1];
+        if (pivot != m) {
+            for (int j = m - 1; j < n; j++) {
+                double t = a[pivot * n + j];
+                a[pivot * n + j] = a[m * n + j];
+                a[m * n + j] = t;
+            }
+            for (int i = 0; i < n; i++) {
+                double t = a[i * n + pivot];
+                a[i * n + pivot] = a[i * n + m];
+                a[i * n + m] = t;
+            }
+        }
+        if (x == 0) continue;
+        for (int i = m + 1; i < n; i++) {
+            double y = a[i * n + m - 1] / x;
+            if (y == 0) continue;
+            a[i * n + m - 1] = 0;
+            for (int j = m; j < n; j++) a[i * n + j] -= y * a[m * n + j];
+            for (int j = 0; j < n; j++) a[j * n + m] += y * a[j * n + i];
+        }
+    }
+}
+
+// eigenvalues of an upper Hessenberg matrix (destroyed) by the Francis double-shift QR iteration; 1 if an
+// eigenvalue did not converge within 30 iterations
+static int shoot_hessenberg_qr(double *a, int n, double *re, double *im) {
+#define H(i, j) a[(i) * n + (j)]
+    double norm = 0, shift = 0;
+    for (int i = 0; i < n; i++) {
+        for (int j = i > 0 ? i - 1 : 0; j < n; j++) norm += fabs(H(i, j));
+    }
+    int last = n - 1;
+    while (last >= 0) {
+        int its = 0, low;
+        do {
+            // small subdiagonal element splitting off the active block [low, last]
+            for (low = last; low >= 1; low--) {
+                double s = fabs(H(low - 1, low - 1)) + fabs(H(low, low));
+                if (s == 0) s = norm;
+                if (fabs(H(low, low - 1)) + s == s) {
+                    H(low, low - 1) = 0;
+                    break;
+                }
+            }
+            double x = H(last, last);
+            if (low == last) {  // one root
+                re[last] = x + shift;
+                im[last--] = 0;
+                break;
+            }
+            double y = H(last - 1, last - 1), w = H(last, last - 1) * H(last - 1, last);
+            if (low == last - 1) {  // two roots of the trailing 2 x 2 block
+                double p = 0.5 * (y - x), q = p * p + w, z = sqrt(fabs(q));
+                x += shift;
+                if (q >= 0) {
+                    z = p + (p >= 0 ? z : -z);
+                    re[last - 1] = re[last] = x + z;
+                    if (z != 0) re[last] = x - w / z;
+                    im[last - 1] = im[last] = 0;
+                } else {
+                    re[last - 1] = re[last] = x + p;
+                    im[last - 1] = z;
+                    im[last] = -z;
+                }
+                last -= 2;
+                break;
+            }
+            if (its == 30) return 1;
+            if (its == 10 || its == 20) {  // exceptional shift
+                shift += x;
+                for (int i = 0; i <= last; i++) H(i, i) -= x;
+                double s = fabs(H(last, last - 1)) + fabs(H(last - 1, last - 2));
+                y = x = 0.75 * s;
+                w = -0.4375 * s * s;
+            }
+            its++;
+            // two consecutive small subdiagonal elements, start of the double-shift sweep
+            int m;
+            double p = 0, q = 0, r = 0, z;
+            for (m = last - 2; m >= low; m--) {
+                z = H(m, m);
+                double r0 = x - z, s0 = y - z;
+                p = (r0 * s0 - w) / H(m + 1, m) + H(m, m + 1);
+                q = H(m + 1, m + 1) - z - r0 - s0;
+                r = H(m + 2, m + 1);
+                double s = fabs(p) + fabs(q) + fabs(r);
+                p /= s;
+                q /= s;
+                r /= s;
+                if (m == low) break;
+                double u = fabs(H(m, m - 1)) * (fabs(q) + fabs(r));
+                double v = fabs(p) * (fabs(H(m - 1, m - 1)) + fabs(z) + fabs(H(m + 1, m + 1)));
+                if (u + v == v) break;
+            }
+            for (int i = m + 2; i <= last; i++) {
+                H(i, i - 2) = 0;
+                if (i != m + 2) H(i, i - 3) = 0;
+            }
+            // chase the bulge with Householder reflections
+            for (int k = m; k <= last - 1; k++) {
+                if (k != m) {
+                    p = H(k, k - 1);
+                    q = H(k + 1, k - 1);
+                    r = k != last - 1 ? H(k + 2, k - 1) : 0;
+                    x = fabs(p) + fabs(q) + fabs(r);
+                    if (x != 0) {
+                        p /= x;
+                        q /= x;
+                        r /= x;
+                    }
+                }
+                double s = sqrt(p * p + q * q + r * r);
+                if (p < 0) s = -s;
+                if (s == 0) continue;
+                if (k == m) {
+                    if (low != m) H(k, k - 1) = -H(k, k - 1);
+                } else {
+                    H(k, k - 1) = -s * x;
+                }
+                p += s;
+                x = p / s;
+                y = q / s;
+                z = r / s;
+                q /= p;
+                r /= p;
+                for (int j = k; j <= last; j++) {
+                    p = H(k, j) + q * H(k + 1, j);
+                    if (k != last - 1) {
+                        p += r * H(k + 2, j);
+                        H(k + 2, j) -= p * z;
+                    }
+                    H(k + 1, j) -= p * y;
+                    H(k, j) -= p * x;
+                }
+                int end = last < k + 3 ? last : k + 3;
+                for (int i = low; i <= end; i++) {
+                    p = x * H(i, k) + y * H(i, k + 1);
+                    if (k != last - 1) {
+                        p += z * H(i, k + 2);
+                        H(i, k + 2) -= p * r;
+                    }
+                    H(i, k + 1) -= p * q;
+                    H(i, k) -= p;
+                }
+            }
+        } while (low < last - 1);
+    }
+    return 0;
+#undef H
+}
+
+// eigenvalues of a (n x n, row-major, destroyed) sorted by decreasing modulus; 1 if the iteration failed
+int shoot_eigenvalues(double *a, int n, double *re, double *im) {
+    shoot_hessenberg(a, n);
+    if (shoot_hessenberg_qr(a, n, re, im)) return 1;
+    for (int i = 1; i < n; i++) {  // insertion sort, n is small
+        double r = re[i], m = im[i];
+        int j = i - 1;
+        for (; j >= 0 && hypot(re[j], im[j]) < hypot(r, m); j--) {
+            re[j + 1] = re[j];
+            im[j + 1] = im[j];
+        }
+        re[j + 1] = r;
+        im[j + 1] = m;
+    }
+    return 0;
+}
+
+
+// ###################################################################
+// ############              Shooting                   ##############
+// ###################################################################
+
+// Jacobian of P - I at y (scaled variables, row-major) by forward differences; 1 if a map evaluation failed
+static int shoot_jacobian(const CellParams *p, const CellState *base, const double *y, const double *residual,
+                          const double *scale, double *jacobian, double *simulated_ms) {
+    double shifted[SHOOT_DIM], column[SHOOT_DIM];
+    for (int j = 0; j < SHOOT_DIM; j++) {
+        memcpy(shifted, y, sizeof(shifted));
+        shifted[j] += SHOOTING_fd_step * scale[j];
+        if (shoot_residual(p, base, shifted, column, simulated_ms) < 0) return 1;
+        for (int i = 0; i < SHOOT_DIM; i++) {
+            jacobian[i * SHOOT_DIM + j] = (column[i] - residual[i]) / scale[i] / SHOOTING_fd_step;
+        }
+    }
+    return 0;
+}
+
+// periodic orbit of the cell `c` (variables and per-cell parameters, any state) without input; the multipliers
+// (and the stability test) cost SHOOT_DIM more cycles and are only computed with `multipliers` = 1
+PeriodicOrbit shoot_orbit(const CellParams *restrict p, const CellState *restrict c, int multipliers) {
+    PeriodicOrbit orbit;
+    memset(&orbit, 0, sizeof(orbit));
+    orbit.status = SHOOT_SILENT;
+    orbit.period = orbit.residual = orbit.max_multiplier = NAN;
+    INSTR_TIMER_START(kernel);
+
+    // a short settle run removes the fast transient, two crossings put the guess on the section
+    CellState base = *c;
+    shoot_rest_passive(p, &base);
+    for (int i = 0; i < SHOOTING_settle * CONFIG_1ms_step_num; i++) kernel_step(p, &base, CONFIG_dt);
+    orbit.simulated_ms = SHOOTING_settle;
+    int found = 1;
+    for (int k = 0; k < 2 && found; k++) found = shoot_to_section(p, &base, SHOOTING_max_isi, &orbit.simulated_ms) > 0;
+
+    // Broyden iteration on P(y) - y in scaled variables, starting from P' = 0 (the first step is a plain cycle)
+    double y[SHOOT_DIM], scale[SHOOT_DIM], residual[SHOOT_DIM], previous[SHOOT_DIM], step[SHOOT_DIM];
+    double jacobian[SHOOT_DIM * SHOOT_DIM] = {0}, lu[SHOOT_DIM * SHOOT_DIM];
+    for (int k = 0; k < SHOOT_DIM; k++) {
+        y[k] = *shoot_var(&base, k + 1);
+        scale[k] = shoot_scale(&base, k);
+        jacobian[k * SHOOT_DIM + k] = -1;
+    }
+    double period = -1;
+    if (found) {
+        orbit.status = SHOOT_NOT_CONVERGED;
+        period = shoot_residual(p, &base, y, residual, &orbit.simulated_ms);
+        orbit.evaluations = 1;
+    }
+    while (period > 0) {
+        double norm = 0;
+        for (int k = 0; k < SHOOT_DIM; k++) norm = fmax(norm, fabs(residual[k]) / scale[k]);
+        orbit.residual = norm;
+        orbit.period = period;
+        if (norm < SHOOTING_tol) {
+            orbit.status = SHOOT_TONIC;
+            break;
+        }
+        if (orbit.evaluations >= SHOOTING_max_evaluations) break;
+        memcpy(lu, jacobian, sizeof(jacobian));
+        for (int k = 0; k < SHOOT_DIM; k++) step[k] = -residual[k] / scale[k];
+        if (shoot_solve(lu, step, SHOOT_DIM)) break;
+        for (int k = 0; k < SHOOT_DIM; k++) y[k] += step[k] * scale[k];
+        memcpy(previous, residual, sizeof(residual));
+        period = shoot_residual(p, &base, y, residual, &orbit.simulated_ms);
+        orbit.iterations++;
+        orbit.evaluations++;
+        // rank-one update J += (dF - J dy) dy^T / dy^T dy
+        double update[SHOOT_DIM], length = 0;
+        for (int i = 0; i < SHOOT_DIM; i++) {
+            length += step[i] * step[i];
+            update[i] = (residual[i] - previous[i]) / scale[i];
+            for (int j = 0; j < SHOOT_DIM; j++) update[i] -= jacobian[i * SHOOT_DIM + j] * step[j];
+        }
+        for (int i = 0; i < SHOOT_DIM; i++) {
+            for (int j = 0; j < SHOOT_DIM; j++) jacobian[i * SHOOT_DIM + j] += update[i] * step[j] / length;
+        }
+    }
+    if (orbit.status == SHOOT_TONIC && multipliers) {
+        // the Broyden matrix is only exact along the steps taken, the multipliers need the full Jacobian
+        if (shoot_jacobian(p, &base, y, residual, scale, jacobian, &orbit.simulated_ms) == 0) {
+            for (int k = 0; k < SHOOT_DIM; k++) jacobian[k * SHOOT_DIM + k] += 1;
+            if (shoot_eigenvalues(jacobian, SHOOT_DIM, orbit.multipliers_re, orbit.multipliers_im) == 0) {
+                orbit.max_multiplier = hypot(orbit.multipliers_re[0], orbit.multipliers_im[0]);
+            }
+        }
+        orbit.evaluations += SHOOT_DIM;
+        if (!(orbit.max_multiplier < 1)) orbit.status = SHOOT_UNSTABLE;
+    }
+    INSTR_TIMER_STOP(kernel, INSTR_KERNEL);
+    INSTR_COUNT(INSTR_STEPS, (long)(orbit.simulated_ms * CONFIG_1ms_step_num));
+    INSTR_COUNT(INSTR_SIMULATIONS, 1);
+    INSTR_COUNT(INSTR_EARLY_EXITS, orbit.status == SHOOT_TONIC || orbit.status == SHOOT_UNSTABLE);  // on the section
+    orbit.start = base;
+    for (int k = 0; k < SHOOT_DIM; k++) *shoot_var(&orbit.start, k + 1) = y[k];
+    orbit.start.time = 0;
+    return orbit;
+}
+
+// firing rate in Hz of a tonic cell from its periodic orbit, NAN for cells that need time integration
+double shoot_firing_rate(const CellParams *restrict p, const CellState *restrict c, PeriodicOrbit *orbit) {
+    *orbit = shoot_orbit(p, c, 0);
+    return orbit->status == SHOOT_TONIC ? 1e3 / orbit->period : NAN;
+}
+
+#endif
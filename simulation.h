@@ -0,0 +1,302 @@
+// simulation.h
+// Simulation routines shared by step1, step3 and the benchmark.
+#ifndef SIMULATION_H
+#define SIMULATION_H
+#include "bio_data/SNrModel.h"
+#include "step0_config.h"
+#include "instrument.h"
+#include "kernel.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+    double *spike_times;
+    double *I_HCN_som;
+    double *m_HCN_som;
+    double *g_HCN_som;
+    double *I_app;
+    double *I_TRPC3;
+    double *I_HCN_den;
+    double *m_HCN_den;
+    double *g_HCN_den;
+    double *Vs;
+    double *Vd;
+    double *I_GABA_som;
+    double *E_GABA_som;
+    double *g_GABA_som;
+    double *D;
+    double *I_GABA_den;
+    double *E_GABA_den;
+    double *g_GABA_den;
+    double *F;
+    int num_spikes;
+    int capacity;        // allocated spike_times, spikes_append() doubles it
+} Spikes;
+
+
+// wall-clock time in seconds
+static inline double wall_time() {
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec + t.tv_usec * 1e-6;
+}
+
+
+// an empty spike train with room for CONFIG_spikes_init_size spikes
+static inline Spikes spikes_new(void) {
+    Spikes spikes = {0};
+    spikes.capacity = CONFIG_spikes_init_size;
+    spikes.spike_times = (double *)malloc(spikes.capacity * sizeof(double));
+    return spikes;
+}
+
+// room for at least `capacity` spike times
+static inline void spikes_reserve(Spikes *restrict spikes, int capacity) {
+    if (capacity <= spikes->capacity) return;
+    spikes->capacity = capacity;
+    spikes->spike_times = (double *)realloc(spikes->spike_times, capacity * sizeof(double));
+}
+
+// append one spike time, growing the buffer when it is full
+static inline void spikes_append(Spikes *restrict spikes, double time) {
+    if (spikes->num_spikes >= spikes->capacity) {
+        spikes_reserve(spikes, spikes->capacity > 0 ? 2 * spikes->capacity : CONFIG_spikes_init_size);
+    }
+    spikes->spike_times[spikes->num_spikes++] = time;
+}
+
+
+// ###################################################################
+// ############               Simulation                ##############
+// ###################################################################
+
+// whether step i contains the stim onset (in ms, -1 for no stim)
+static inline int stim_onset(int i, double stim_time) {
+    return i<=stim_time*CONFIG_1ms_step_num && (i+1)>stim_time*CONFIG_1ms_step_num;
+}
+
+// switch GPe/Str stimulation on for the single step containing the stim onset
+static inline void set_stim(State *restrict s, int i, double GPe_stim_time, double Str_stim_time) {
+    s->GPe_stim = stim_onset(i, GPe_stim_time);
+    s->Str_stim = stim_onset(i, Str_stim_time);
+}
+
+static inline void set_cell_stim(CellState *restrict c, int i, double GPe_stim_time, double Str_stim_time) {
+    c->GPe_stim = stim_onset(i, GPe_stim_time);
+    c->Str_stim = stim_onset(i, Str_stim_time);
+}
+
+// the kernel steps a CellState built once per run (cell.h), `s` ends in the final state
+Spikes simple_simulation(State *restrict s, int duration) {
+    const CellParams p = params_from_state(s);
+    CellState c = cell_from_state(s);
+    INSTR_TIMER_START(alloc);
+    Spikes spikes = spikes_new();
+    INSTR_TIMER_STOP(alloc, INSTR_ALLOC);
+    INSTR_TIMER_START(kernel);
+    INSTR_PERF_START();
+    for (int i = 0; i < duration*CONFIG_1ms_step_num; i++) {
+        if (kernel_step(&p, &c, CONFIG_dt)) {
+            spikes_append(&spikes, c.time);
+        }
+        // printf("%f, %f, %f\n", c.time, c.V_d, c.V_s);  // For debug
+    }
+    INSTR_PERF_STOP();
+    INSTR_TIMER_STOP(kernel, INSTR_KERNEL);
+    cell_to_state(s, &c);
+    INSTR_COUNT(INSTR_STEPS, duration*CONFIG_1ms_step_num);
+    INSTR_COUNT(INSTR_SPIKES, spikes.num_spikes);
+    INSTR_COUNT(INSTR_SIMULATIONS, 1);
+    return spikes;
+}
+
+// firing rate in Hz of the spikes after PREPARE_DURATION_init, frees the spikes
+double firing_rate_of(Spikes spikes) {
+    if (spikes.num_spikes == 0) {
+        free(spikes.spike_times);
+        return 0.0;
+    }
+    int first_spike_id = spikes.num_spikes - 1;
+    for (int i = 0; i < spikes.num_spikes; i++) {
+        if (spikes.spike_times[i] >= PREPARE_DURATION_init) {
+            first_spike_id = i + 0;
+            break;
+        }
+    }
+    if (first_spike_id >= spikes.num_spikes - 1) {
+        free(spikes.spike_times);
+        return 1.0;
+    }
+//    double first_spike = spikes.spike_times[first_spike_id];
+//    double last_spike = spikes.spike_times[spikes.num_spikes - 1];
+    double firing_rate = 1e3 * (spikes.num_spikes - first_spike_id)/PREPARE_DURATION_test;
+    free(spikes.spike_times);
+    return firing_rate;
+}
+
+// return firing rate in Hz, 0 if less than 1Hz
+double calculate_firing_rate(State *restrict s) {
+    return firing_rate_of(simple_simulation(s, PREPARE_DURATION_init + PREPARE_DURATION_test));
+}
+
+
+// spike_simulation() on the split layout of cell.h, `p` is shared by all cells of a condition
+Spikes cell_spike_simulation(const CellParams *restrict p, CellState *restrict c, int duration,
+                             double GPe_stim_time, double Str_stim_time) {
+    INSTR_TIMER_START(alloc);
+    Spikes spikes = spikes_new();
+    INSTR_TIMER_STOP(alloc, INSTR_ALLOC);
+    INSTR_TIMER_START(kernel);
+    INSTR_PERF_START();
+    for (int i = 0; i < duration*CONFIG_1ms_step_num; i++) {
+        set_cell_stim(c, i, GPe_stim_time, Str_stim_time);
+        if (kernel_step(p, c, CONFIG_dt)) {
+            spikes_append(&spikes, c->time);
+        }
+    }
+    INSTR_PERF_STOP();
+    INSTR_TIMER_STOP(kernel, INSTR_KERNEL);
+    INSTR_COUNT(INSTR_STEPS, duration*CONFIG_1ms_step_num);
+    INSTR_COUNT(INSTR_SPIKES, spikes.num_spikes);
+    INSTR_COUNT(INSTR_SIMULATIONS, 1);
+    return spikes;
+}
+
+
+// cell_spike_simulation() of a State, split once for the run; `s` ends in the final state
+Spikes spike_simulation(State *restrict s, int duration, double GPe_stim_time, double Str_stim_time) {
+    const CellParams p = params_from_state(s);
+    CellState c = cell_from_state(s);
+    Spikes spikes = cell_spike_simulation(&p, &c, duration, GPe_stim_time, Str_stim_time);
+    cell_to_state(s, &c);
+    return spikes;
+}
+
+
+// calculate_firing_rate() on the split layout of cell.h
+double cell_firing_rate(const CellParams *restrict p, CellState *restrict c) {
+    return firing_rate_of(cell_spike_simulation(p, c, PREPARE_DURATION_init + PREPARE_DURATION_test, -1, -1));
+}
+
+
+// spike_simulation() recording the traces of every step (the `-num 1` path of step3), `s` ends in the final state
+Spikes full_simulation(State *restrict s, int duration, double GPe_stim_time, double Str_stim_time) {
+    INSTR_TIMER_START(alloc);
+    Spikes spikes = spikes_new();
+    spikes.I_HCN_som = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
+    spikes.m_HCN_som = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
+    spikes.g_HCN_som = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
+    spikes.I_app = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
+    spikes.I_TRPC3 = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
+    spikes.I_HCN_den = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
+    spikes.m_HCN_den = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
+    spikes.g_HCN_den = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
+    spikes.Vs = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
+    spikes.Vd = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
+    spikes.I_GABA_som = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
+    spikes.E_GABA_som = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
+    spikes.g_GABA_som = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
+    spikes.D = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
+    spikes.I_GABA_den = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
+    spikes.E_GABA_den = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
+    spikes.g_GABA_den = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
+    spikes.F = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
+    INSTR_TIMER_STOP(alloc, INSTR_ALLOC);
+    const CellParams p = params_from_state(s);
+    CellState c = cell_from_state(s);
+    INSTR_TIMER_START(trace);
+    for (int i = 0; i < duration*CONFIG_1ms_step_num; i++) {
+        set_cell_stim(&c, i, GPe_stim_time, Str_stim_time);
+        if (kernel_step(&p, &c, CONFIG_dt)) {
+            spikes_append(&spikes, c.time);
+        }
+        spikes.I_HCN_som[i] = c.g_HCN_som * c.m_HCN_som * (c.V_s - E_HCN);
+        spikes.m_HCN_som[i] = c.m_HCN_som;
+        spikes.g_HCN_som[i] = c.g_HCN_som;
+        spikes.I_app[i] = c.I_app;
+        spikes.I_TRPC3[i] = g_TRPC3 * (c.V_d - E_TRPC3);
+        spikes.I_HCN_den[i] = c.g_HCN_den * c.m_HCN_den * (c.V_d - E_HCN);
+        spikes.m_HCN_den[i] = c.m_HCN_den;
+        spikes.g_HCN_den[i] = c.g_HCN_den;
+        spikes.Vs[i] = c.V_s;
+        spikes.Vd[i] = c.V_d;
+        spikes.E_GABA_som[i] = V_T * log((p_Cl * Cl_out + p_HCO3 * HCO3_out) / (p_Cl * c.Cl_som + p_HCO3 * HCO3_in)) / z_GABA;;
+        spikes.I_GABA_som[i] = c.g_GABA_som * (c.V_s - spikes.E_GABA_som[i]);
+        spikes.g_GABA_som[i] = c.g_GABA_som;
+        spikes.D[i] = c.D;
+        spikes.E_GABA_den[i] = V_T * log((p_Cl * Cl_out + p_HCO3 * HCO3_out) / (p_Cl * c.Cl_den + p_HCO3 * HCO3_in)) / z_GABA;;
+        spikes.I_GABA_den[i] = c.g_GABA_den * (c.V_d - spikes.E_GABA_den[i]);
+        spikes.g_GABA_den[i] = c.g_GABA_den;
+        spikes.F[i] = c.F;
+    }
+    INSTR_TIMER_STOP(trace, INSTR_TRACE);
+    cell_to_state(s, &c);
+    INSTR_COUNT(INSTR_STEPS, duration*CONFIG_1ms_step_num);
+    INSTR_COUNT(INSTR_SPIKES, spikes.num_spikes);
+    INSTR_COUNT(INSTR_SIMULATIONS, 1);
+    return spikes;
+}
+
+
+// ###################################################################
+// ############                 Output                  ##############
+// ###################################################################
+
+void write_csv(const char *filename, double *data, int num) {
+    INSTR_TIMER_START(writer);
+    FILE *file = fopen(filename, "w");
+    if (file == NULL) {
+        printf("Error opening file!\n");
+        return;
+    }
+    for (int i = 0; i < num; i++) {
+        fprintf(file, "%f,", data[i]);
+    }
+    fprintf(file, "END\n");
+    INSTR_COUNT(INSTR_BYTES_WRITTEN, ftell(file));
+    fclose(file);
+    INSTR_TIMER_STOP(writer, INSTR_WRITER);
+    printf("Result saved in %s \n", filename);
+}
+
+// atomic replacement of a file: write to the FILE of atomic_open() (`<filename>.tmp`, named in `tmp_filename`) and
+// finish with atomic_commit(), so a reader or a resumed run never sees a half-written file
+FILE *atomic_open(const char *filename, const char *mode, char *tmp_filename, size_t tmp_size) {
+    snprintf(tmp_filename, tmp_size, "%s.tmp", filename);
+    return fopen(tmp_filename, mode);
+}
+
+// close the file of atomic_open() and rename it over `filename` unless `status` (an earlier write error) is set,
+// 0 on success; rename() does not replace an existing file on Windows, so it is removed first
+int atomic_commit(FILE *file, const char *tmp_filename, const char *filename, int status) {
+    if (file == NULL) return 1;
+    status |= fclose(file) != 0;
+#ifdef _WIN32
+    if (!status) remove(filename);
+#endif
+    if (!status) status = rename(tmp_filename, filename) != 0;
+    return status;
+}
+
+// `size` doubles to `filename` through atomic_open() / atomic_commit(), 0 on success
+int atomic_write(const char *filename, const double *data, size_t size) {
+    char tmp_filename[600];
+    FILE *file = atomic_open(filename, "wb", tmp_filename, sizeof(tmp_filename));
+    int status = file == NULL || fwrite(data, sizeof(double), size, file) != size;
+    return atomic_commit(file, tmp_filename, filename, status);
+}
+
+// append one raster block (num_spikes, spike_times...) to an opened raster file
+void write_raster(FILE *file, const Spikes *spikes) {
+    INSTR_TIMER_START(writer);
+    INSTR_FILE_MARK(writer, file);
+    fprintf(file, "%d,", spikes->num_spikes);
+    for (int i = 0; i < spikes->num_spikes; i++) {
+        fprintf(file, "%f,", spikes->spike_times[i]);
+    }
+    INSTR_FILE_BYTES(writer, file);
+    INSTR_TIMER_STOP(writer, INSTR_WRITER);
+}
+
+
+#endif
@@ -0,0 +1,246 @@
+#include "snr_api.h"
+#include "simulation.h"
+#include "sensitivity.h"
+#include "surrogate.h"
+#include "params.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+struct SnrCell {
+    State s;
+};
+
+struct SnrSurrogate {
+    Surrogate s;
+};
+
+static int resolve_threads(int num_threads) {
+#ifdef _OPENMP
+    return num_threads > 0 ? num_threads : omp_get_max_threads();
+#else
+    (void)num_threads;
+    return 1;
+#endif
+}
+
+// batch cells share the parameters of `base` (CellParams, see cell.h) and only differ in I_app / g_HCN_*
+static CellState batch_cell(const SnrCell *base, int j, const double *I_app, const double *g_HCN_som,
+                            const double *g_HCN_den) {
+    CellState c = cell_from_state(&base->s);
+    if (I_app) c.I_app = I_app[j];
+    if (g_HCN_som) c.g_HCN_som = g_HCN_som[j];
+    if (g_HCN_den) c.g_HCN_den = g_HCN_den[j];
+    return c;
+}
+
+
+SNR_EXPORT int snr_api_version(void) {
+    return SNR_API_VERSION;
+}
+
+SNR_EXPORT int snr_select_kernel(const char *isa) {
+    return select_kernel(isa);
+}
+
+SNR_EXPORT const char *snr_kernel_name(void) {
+    return kernel_name;
+}
+
+SNR_EXPORT SnrCell *snr_cell_new(void) {
+    SnrCell *cell = (SnrCell *)malloc(sizeof(SnrCell));
+    if (cell) cell->s = init_state();
+    return cell;
+}
+
+SNR_EXPORT SnrCell *snr_cell_copy(const SnrCell *cell) {
+    SnrCell *copy = (SnrCell *)malloc(sizeof(SnrCell));
+    if (copy) *copy = *cell;
+    return copy;
+}
+
+SNR_EXPORT void snr_cell_free(SnrCell *cell) {
+    free(cell);
+}
+
+SNR_EXPORT void snr_cell_reset(SnrCell *cell) {
+    cell->s = init_state();
+}
+
+SNR_EXPORT int snr_cell_set(SnrCell *cell, const char *name, double value) {
+    double *field = state_field(&cell->s, name);
+    if (field == NULL) return -1;
+    *field = value;
+    return 0;
+}
+
+SNR_EXPORT int snr_cell_get(const SnrCell *cell, const char *name, double *value) {
+    double *field = state_field((State *)&cell->s, name);
+    if (field == NULL) return -1;
+    *value = *field;
+    return 0;
+}
+
+SNR_EXPORT double snr_firing_rate(const SnrCell *cell) {
+    State s = cell->s;
+    return calculate_firing_rate(&s);
+}
+
+SNR_EXPORT int snr_simulate(SnrCell *cell, int duration, double GPe_stim, double Str_stim,
+                            double *spike_times, int capacity) {
+    Spikes spikes = spike_simulation(&cell->s, duration, GPe_stim, Str_stim);
+    int num = spikes.num_spikes < capacity ? spikes.num_spikes : capacity;
+    if (spike_times && num > 0) memcpy(spike_times, spikes.spike_times, num * sizeof(double));
+    free(spikes.spike_times);
+    return spikes.num_spikes;
+}
+
+SNR_EXPORT int snr_firing_rate_batch(const SnrCell *base, int num, const double *I_app, const double *g_HCN_som,
+                                     const double *g_HCN_den, double *rates, int num_threads) {
+    const CellParams params = params_from_state(&base->s);
+    #pragma omp parallel for schedule(dynamic) num_threads(resolve_threads(num_threads))
+    for (int j = 0; j < num; j++) {
+        CellState c = batch_cell(base, j, I_app, g_HCN_som, g_HCN_den);
+        rates[j] = cell_firing_rate(&params, &c);
+    }
+    return 0;
+}
+
+SNR_EXPORT int snr_spike_batch(const SnrCell *base, int num, const double *I_app, const double *g_HCN_som,
+                               const double *g_HCN_den, int duration, double GPe_stim, double Str_stim,
+                               double *spike_times, int capacity, int *num_spikes, int num_threads) {
+    int num_truncated = 0;
+    const CellParams params = params_from_state(&base->s);
+    #pragma omp parallel for schedule(dynamic) num_threads(resolve_threads(num_threads)) reduction(+:num_truncated)
+    for (int j = 0; j < num; j++) {
+        CellState c = batch_cell(base, j, I_app, g_HCN_som, g_HCN_den);
+        Spikes spikes = cell_spike_simulation(&params, &c, duration, GPe_stim, Str_stim);
+        int n = spikes.num_spikes < capacity ? spikes.num_spikes : capacity;
+        memcpy(spike_times + (size_t)j * capacity, spikes.spike_times, n * sizeof(double));
+        num_spikes[j] = spikes.num_spikes;
+        num_truncated += spikes.num_spikes > capacity;
+        free(spikes.spike_times);
+    }
+    return num_truncated;
+}
+
+_Static_assert(SNR_NUM_SENS_PARAMS == SENS_NUM_PARAMS, "sensitivity parameters of the C ABI");
+
+SNR_EXPORT const char *snr_sens_param_name(int i) {
+    return i >= 0 && i < SENS_NUM_PARAMS ? SENS_PARAM_NAMES[i] : NULL;
+}
+
+SNR_EXPORT int snr_simulate_sensitivity(SnrCell *cell, int duration, double GPe_stim, double Str_stim,
+                                        double *spike_times, double *d_spike_times, int capacity) {
+    const CellParams params = params_from_state(&cell->s);
+    CellState c = cell_from_state(&cell->s);
+    SensSpikes spikes = sens_spike_simulation(&params, &c, duration, GPe_stim, Str_stim);
+    cell_to_state(&cell->s, &c);
+    int num = spikes.num_spikes < capacity ? spikes.num_spikes : capacity;
+    if (spike_times && num > 0) memcpy(spike_times, spikes.spike_times, num * sizeof(double));
+    if (d_spike_times && num > 0) memcpy(d_spike_times, spikes.d_spike_times, num * SENS_NUM_PARAMS * sizeof(double));
+    sens_spikes_free(&spikes);
+    return spikes.num_spikes;
+}
+
+SNR_EXPORT double snr_rate_sensitivity(const SnrCell *cell, double *isi_rate, double *d_isi_rate) {
+    const CellParams params = params_from_state(&cell->s);
+    CellState c = cell_from_state(&cell->s);
+    SensRate rate = sens_firing_rate(&params, &c);
+    if (isi_rate) *isi_rate = rate.isi_rate;
+    if (d_isi_rate) memcpy(d_isi_rate, rate.d_isi_rate, sizeof(rate.d_isi_rate));
+    return rate.rate;
+}
+
+SNR_EXPORT int snr_target_search(const SnrCell *cell, const char *name, double target, double low, double high,
+                                 double x_0, double *value, double *isi_rate, int *num_evaluations) {
+    int param = sens_param_index(name);
+    if (param < 0) return -1;
+    const CellParams params = params_from_state(&cell->s);
+    CellState c = cell_from_state(&cell->s);
+    SensSearch result;
+    sens_target_search(&params, &c, param, target, low, high, x_0, &result);
+    if (value) *value = result.value;
+    if (isi_rate) *isi_rate = result.isi_rate;
+    if (num_evaluations) *num_evaluations = result.num_evaluations;
+    return result.converged ? 0 : 1;
+}
+
+_Static_assert(SNR_SURROGATE_MAX_DIM == SURROGATE_MAX_DIM, "surrogate axes of the C ABI");
+
+SNR_EXPORT SnrSurrogate *snr_surrogate_new(const SnrCell *base) {
+    SnrSurrogate *surrogate = (SnrSurrogate *)malloc(sizeof(SnrSurrogate));
+    if (surrogate) {
+        State s = base ? base->s : init_state();
+        surrogate_init(&surrogate->s, &s);
+    }
+    return surrogate;
+}
+
+SNR_EXPORT SnrSurrogate *snr_surrogate_from_step1(const char *dir, const char *hcn) {
+    SnrSurrogate *surrogate = (SnrSurrogate *)malloc(sizeof(SnrSurrogate));
+    if (surrogate && surrogate_from_step1(&surrogate->s, dir, hcn)) {
+        snr_surrogate_free(surrogate);
+        return NULL;
+    }
+    return surrogate;
+}
+
+SNR_EXPORT SnrSurrogate *snr_surrogate_load(const char *filename) {
+    SnrSurrogate *surrogate = (SnrSurrogate *)malloc(sizeof(SnrSurrogate));
+    if (surrogate && surrogate_read(&surrogate->s, filename)) {
+        snr_surrogate_free(surrogate);
+        return NULL;
+    }
+    return surrogate;
+}
+
+SNR_EXPORT int snr_surrogate_save(const SnrSurrogate *surrogate, const char *filename) {
+    return surrogate_write(&surrogate->s, filename);
+}
+
+SNR_EXPORT void snr_surrogate_free(SnrSurrogate *surrogate) {
+    if (surrogate == NULL) return;
+    surrogate_free(&surrogate->s);
+    free(surrogate);
+}
+
+SNR_EXPORT int snr_surrogate_add_axis(SnrSurrogate *surrogate, const char *name, double low, double high,
+                                      int log_scale) {
+    return surrogate_add_axis(&surrogate->s, name, low, high, log_scale);
+}
+
+SNR_EXPORT int snr_surrogate_dim(const SnrSurrogate *surrogate) {
+    return surrogate->s.dim;
+}
+
+SNR_EXPORT const char *snr_surrogate_axis(const SnrSurrogate *surrogate, int i, double *low, double *high,
+                                          int *log_scale) {
+    if (i < 0 || i >= surrogate->s.dim) return NULL;
+    const SurrogateAxis *axis = &surrogate->s.axes[i];
+    if (low) *low = axis->low;
+    if (high) *high = axis->high;
+    if (log_scale) *log_scale = axis->log_scale;
+    return STATE_FIELDS[axis->field].name;
+}
+
+SNR_EXPORT long snr_surrogate_size(const SnrSurrogate *surrogate) {
+    return surrogate->s.num;
+}
+
+SNR_EXPORT int snr_surrogate_add(SnrSurrogate *surrogate, long num, const double *x, const double *rates) {
+    if (surrogate->s.dim == 0) return -1;
+    surrogate_add(&surrogate->s, num, x, rates);
+    return 0;
+}
+
+SNR_EXPORT void snr_surrogate_fit(SnrSurrogate *surrogate) {
+    surrogate_fit(&surrogate->s);
+}
+
+SNR_EXPORT long snr_surrogate_rates(SnrSurrogate *surrogate, long num, const double *x, double tol, double *rates,
+                                    double *errors, int num_threads) {
+    return surrogate_rates(&surrogate->s, num, x, tol, rates, errors, num_threads);
+}
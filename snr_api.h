@@ -0,0 +1,110 @@
+// snr_api.h
+// Stable C ABI of the SNr model, built as a shared library:
+//   clang -O2 -fopenmp -shared -fPIC -fvisibility=hidden -o libsnr.so snr_api.c
+// A cell is an opaque handle configured by parameter name (see params.h for the names).
+// Batch functions write into caller-provided buffers and run the cells in parallel.
+#ifndef SNR_API_H
+#define SNR_API_H
+
+#ifdef _WIN32
+#define SNR_EXPORT __declspec(dllexport)
+#else
+#define SNR_EXPORT __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SNR_API_VERSION 3
+
+typedef struct SnrCell SnrCell;
+typedef struct SnrSurrogate SnrSurrogate;
+
+SNR_EXPORT int snr_api_version(void);
+
+// select the kernel variant ("auto", "avx512", "avx2", "generic"), return 0 on success
+SNR_EXPORT int snr_select_kernel(const char *isa);
+SNR_EXPORT const char *snr_kernel_name(void);
+
+// cells start from init_state() of bio_data/SNrModel.h
+SNR_EXPORT SnrCell *snr_cell_new(void);
+SNR_EXPORT SnrCell *snr_cell_copy(const SnrCell *cell);
+SNR_EXPORT void snr_cell_free(SnrCell *cell);
+SNR_EXPORT void snr_cell_reset(SnrCell *cell);
+
+// set/get a double-valued State member by name, return 0 on success, -1 for an unknown name
+SNR_EXPORT int snr_cell_set(SnrCell *cell, const char *name, double value);
+SNR_EXPORT int snr_cell_get(const SnrCell *cell, const char *name, double *value);
+
+// firing rate in Hz as in step1 (calculate_firing_rate), the cell itself is not advanced
+SNR_EXPORT double snr_firing_rate(const SnrCell *cell);
+
+// simulate `duration` ms with GPe/Str stim onsets in ms (-1 for none) as in step3, the cell is advanced
+// spike times are written to `spike_times` (up to `capacity`), return the number of spikes
+SNR_EXPORT int snr_simulate(SnrCell *cell, int duration, double GPe_stim, double Str_stim,
+                            double *spike_times, int capacity);
+
+// firing rates of `num` copies of `base` whose I_app / g_HCN_som / g_HCN_den are replaced element-wise
+// by the given arrays (NULL keeps the value of `base`), using `num_threads` threads (0 for all cores)
+SNR_EXPORT int snr_firing_rate_batch(const SnrCell *base, int num, const double *I_app, const double *g_HCN_som,
+                                     const double *g_HCN_den, double *rates, int num_threads);
+
+// spike trains of `num` such copies, cell j writes up to `capacity` spike times to spike_times[j * capacity ...]
+// and its spike count to num_spikes[j]; return the number of truncated cells
+SNR_EXPORT int snr_spike_batch(const SnrCell *base, int num, const double *I_app, const double *g_HCN_som,
+                               const double *g_HCN_den, int duration, double GPe_stim, double Str_stim,
+                               double *spike_times, int capacity, int *num_spikes, int num_threads);
+
+// forward sensitivities (sensitivity.h) with respect to SNR_NUM_SENS_PARAMS parameters, named by
+// snr_sens_param_name(i): g_HCN_som, g_HCN_den, I_app, W_GPe, W_Str, tau_GABA_som, tau_GABA_den
+#define SNR_NUM_SENS_PARAMS 7
+SNR_EXPORT const char *snr_sens_param_name(int i);
+
+// snr_simulate() that also writes d(spike time)/d(parameter) to d_spike_times[spike][SNR_NUM_SENS_PARAMS]
+SNR_EXPORT int snr_simulate_sensitivity(SnrCell *cell, int duration, double GPe_stim, double Str_stim,
+                                        double *spike_times, double *d_spike_times, int capacity);
+
+// snr_firing_rate() plus the interspike-interval rate and its derivatives d_isi_rate[SNR_NUM_SENS_PARAMS]
+SNR_EXPORT double snr_rate_sensitivity(const SnrCell *cell, double *isi_rate, double *d_isi_rate);
+
+// value of parameter `name` in [low, high] (Newton from x_0) at which the ISI rate of the cell equals `target`,
+// return 0 on convergence, 1 otherwise (value/isi_rate of the last evaluation), -1 for an unknown name
+SNR_EXPORT int snr_target_search(const SnrCell *cell, const char *name, double target, double low, double high,
+                                 double x_0, double *value, double *isi_rate, int *num_evaluations);
+
+// rate surrogate (surrogate.h): the firing rate of snr_firing_rate() over up to SNR_SURROGATE_MAX_DIM parameters of
+// a base cell, predicted in microseconds with a 95% error bound, from training rates at (x_0, x_1, ...) points
+#define SNR_SURROGATE_MAX_DIM 4
+SNR_EXPORT SnrSurrogate *snr_surrogate_new(const SnrCell *base);
+// trained on the step1 grid (prepared_*.bin in `dir`) over I_app and g_HCN_<hcn> for hcn "som"/"den", I_app only for
+// "zero", and fitted; NULL if the files are missing
+SNR_EXPORT SnrSurrogate *snr_surrogate_from_step1(const char *dir, const char *hcn);
+SNR_EXPORT SnrSurrogate *snr_surrogate_load(const char *filename);
+SNR_EXPORT int snr_surrogate_save(const SnrSurrogate *surrogate, const char *filename);
+SNR_EXPORT void snr_surrogate_free(SnrSurrogate *surrogate);
+
+// parameter axis by State member name over [low, high] (log2 scale with `log_scale` = 1), before any training point;
+// return 0 on success, -1 otherwise
+SNR_EXPORT int snr_surrogate_add_axis(SnrSurrogate *surrogate, const char *name, double low, double high,
+                                      int log_scale);
+// number of axes, name and range of axis `i` (NULL if there is no such axis)
+SNR_EXPORT int snr_surrogate_dim(const SnrSurrogate *surrogate);
+SNR_EXPORT const char *snr_surrogate_axis(const SnrSurrogate *surrogate, int i, double *low, double *high,
+                                          int *log_scale);
+SNR_EXPORT long snr_surrogate_size(const SnrSurrogate *surrogate);
+
+// add `num` training rates at x[num][dim], snr_surrogate_fit() refits the correlation lengths and error scale
+SNR_EXPORT int snr_surrogate_add(SnrSurrogate *surrogate, long num, const double *x, const double *rates);
+SNR_EXPORT void snr_surrogate_fit(SnrSurrogate *surrogate);
+
+// rates and 95% error bounds at x[num][dim]; with `tol` > 0, points whose bound exceeds `tol` Hz are simulated
+// (in parallel) and added to the training set, their error is 0; return the number of simulations
+SNR_EXPORT long snr_surrogate_rates(SnrSurrogate *surrogate, long num, const double *x, double tol, double *rates,
+                                    double *errors, int num_threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,285 @@
+import ctypes
+import os
+import os.path as path
+import sys
+import numpy as np
+
+
+def _library_path():
+    name = {"win32": "snr.dll", "darwin": "libsnr.dylib"}.get(sys.platform, "libsnr.so")
+    return os.environ.get("SNR_LIBRARY", path.join(path.dirname(__file__), name))
+
+
+_double_p = ctypes.POINTER(ctypes.c_double)
+_int_p = ctypes.POINTER(ctypes.c_int)
+_lib = ctypes.CDLL(_library_path())
+
+_lib.snr_api_version.restype = ctypes.c_int
+_lib.snr_select_kernel.argtypes = [ctypes.c_char_p]
+_lib.snr_select_kernel.restype = ctypes.c_int
+_lib.snr_kernel_name.restype = ctypes.c_char_p
+_lib.snr_cell_new.restype = ctypes.c_void_p
+_lib.snr_cell_copy.argtypes = [ctypes.c_void_p]
+_lib.snr_cell_copy.restype = ctypes.c_void_p
+_lib.snr_cell_free.argtypes = [ctypes.c_void_p]
+_lib.snr_cell_reset.argtypes = [ctypes.c_void_p]
+_lib.snr_cell_set.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_double]
+_lib.snr_cell_set.restype = ctypes.c_int
+_lib.snr_cell_get.argtypes = [ctypes.c_void_p, ctypes.c_char_p, _double_p]
+_lib.snr_cell_get.restype = ctypes.c_int
+_lib.snr_firing_rate.argtypes = [ctypes.c_void_p]
+_lib.snr_firing_rate.restype = ctypes.c_double
+_lib.snr_simulate.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_double, ctypes.c_double, _double_p, ctypes.c_int]
+_lib.snr_simulate.restype = ctypes.c_int
+_lib.snr_firing_rate_batch.argtypes = [ctypes.c_void_p, ctypes.c_int, _double_p, _double_p, _double_p, _double_p,
+                                       ctypes.c_int]
+_lib.snr_firing_rate_batch.restype = ctypes.c_int
+_lib.snr_spike_batch.argtypes = [ctypes.c_void_p, ctypes.c_int, _double_p, _double_p, _double_p, ctypes.c_int,
+                                 ctypes.c_double, ctypes.c_double, _double_p, ctypes.c_int, _int_p, ctypes.c_int]
+_lib.snr_spike_batch.restype = ctypes.c_int
+_lib.snr_sens_param_name.argtypes = [ctypes.c_int]
+_lib.snr_sens_param_name.restype = ctypes.c_char_p
+_lib.snr_simulate_sensitivity.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_double, ctypes.c_double, _double_p,
+                                          _double_p, ctypes.c_int]
+_lib.snr_simulate_sensitivity.restype = ctypes.c_int
+_lib.snr_rate_sensitivity.argtypes = [ctypes.c_void_p, _double_p, _double_p]
+_lib.snr_rate_sensitivity.restype = ctypes.c_double
+_lib.snr_target_search.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_double, ctypes.c_double,
+                                   ctypes.c_double, ctypes.c_double, _double_p, _double_p, _int_p]
+_lib.snr_target_search.restype = ctypes.c_int
+_lib.snr_surrogate_new.argtypes = [ctypes.c_void_p]
+_lib.snr_surrogate_new.restype = ctypes.c_void_p
+_lib.snr_surrogate_from_step1.argtypes = [ctypes.c_char_p, ctypes.c_char_p]
+_lib.snr_surrogate_from_step1.restype = ctypes.c_void_p
+_lib.snr_surrogate_load.argtypes = [ctypes.c_char_p]
+_lib.snr_surrogate_load.restype = ctypes.c_void_p
+_lib.snr_surrogate_save.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+_lib.snr_surrogate_save.restype = ctypes.c_int
+_lib.snr_surrogate_free.argtypes = [ctypes.c_void_p]
+_lib.snr_surrogate_add_axis.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_double, ctypes.c_double,
+                                        ctypes.c_int]
+_lib.snr_surrogate_add_axis.restype = ctypes.c_int
+_lib.snr_surrogate_dim.argtypes = [ctypes.c_void_p]
+_lib.snr_surrogate_dim.restype = ctypes.c_int
+_lib.snr_surrogate_axis.argtypes = [ctypes.c_void_p, ctypes.c_int, _double_p, _double_p, _int_p]
+_lib.snr_surrogate_axis.restype = ctypes.c_char_p
+_lib.snr_surrogate_size.argtypes = [ctypes.c_void_p]
+_lib.snr_surrogate_size.restype = ctypes.c_long
+_lib.snr_surrogate_add.argtypes = [ctypes.c_void_p, ctypes.c_long, _double_p, _double_p]
+_lib.snr_surrogate_add.restype = ctypes.c_int
+_lib.snr_surrogate_fit.argtypes = [ctypes.c_void_p]
+_lib.snr_surrogate_rates.argtypes = [ctypes.c_void_p, ctypes.c_long, _double_p, ctypes.c_double, _double_p,
+                                     _double_p, ctypes.c_int]
+_lib.snr_surrogate_rates.restype = ctypes.c_long
+
+assert _lib.snr_api_version() == 3, "libsnr API version mismatch"
+_lib.snr_select_kernel(b"auto")
+
+HCN_CHOICES = ("zero", "som", "den")
+INTERMEDIATE_DIR = path.join(path.dirname(path.abspath(__file__)), "intermediate_result")
+SENS_PARAMS = tuple(_lib.snr_sens_param_name(i).decode() for i in range(7))
+
+
+def _as_array(values, num):
+    """float64 contiguous view (no copy for float64 numpy input), broadcast scalars"""
+    if values is None:
+        return None, None
+    array = np.ascontiguousarray(np.broadcast_to(np.asarray(values, dtype=np.float64), (num,)))
+    return array, array.ctypes.data_as(_double_p)
+
+
+class Cell:
+    """SNr cell configured by State member name, e.g. Cell(I_app=-50, g_HCN_den=1.5, W_GPe=0.03)"""
+
+    def __init__(self, _handle=None, **params):
+        self._handle = _handle if _handle is not None else _lib.snr_cell_new()
+        for name, value in params.items():
+            self[name] = value
+
+    def __del__(self):
+        if getattr(self, "_handle", None):
+            _lib.snr_cell_free(self._handle)
+            self._handle = None
+
+    def __setitem__(self, name, value):
+        if _lib.snr_cell_set(self._handle, name.encode(), float(value)) != 0:
+            raise KeyError(name)
+
+    def __getitem__(self, name):
+        value = ctypes.c_double()
+        if _lib.snr_cell_get(self._handle, name.encode(), ctypes.byref(value)) != 0:
+            raise KeyError(name)
+        return value.value
+
+    def copy(self):
+        return Cell(_handle=_lib.snr_cell_copy(self._handle))
+
+    def reset(self):
+        _lib.snr_cell_reset(self._handle)
+
+    def firing_rate(self):
+        return _lib.snr_firing_rate(self._handle)
+
+    def simulate(self, duration=2000, GPe_stim=-1, Str_stim=-1, capacity=10000):
+        spike_times = np.empty(capacity, dtype=np.float64)
+        num = _lib.snr_simulate(self._handle, int(duration), GPe_stim, Str_stim,
+                                spike_times.ctypes.data_as(_double_p), capacity)
+        return spike_times[:min(num, capacity)]
+
+    def simulate_sensitivity(self, duration=2000, GPe_stim=-1, Str_stim=-1, capacity=10000):
+        """simulate() plus d(spike time)/d(parameter), shape (num_spikes, len(SENS_PARAMS))"""
+        spike_times = np.empty(capacity, dtype=np.float64)
+        d_spike_times = np.empty((capacity, len(SENS_PARAMS)), dtype=np.float64)
+        num = _lib.snr_simulate_sensitivity(self._handle, int(duration), GPe_stim, Str_stim,
+                                            spike_times.ctypes.data_as(_double_p),
+                                            d_spike_times.ctypes.data_as(_double_p), capacity)
+        num = min(num, capacity)
+        return spike_times[:num], d_spike_times[:num]
+
+    def rate_sensitivity(self):
+        """(step1 rate, ISI rate, dict of d(ISI rate)/d(parameter))"""
+        isi_rate = ctypes.c_double()
+        d_isi_rate = np.empty(len(SENS_PARAMS), dtype=np.float64)
+        rate = _lib.snr_rate_sensitivity(self._handle, ctypes.byref(isi_rate), d_isi_rate.ctypes.data_as(_double_p))
+        return rate, isi_rate.value, dict(zip(SENS_PARAMS, d_isi_rate))
+
+    def target_search(self, name, target, low, high, x_0=None):
+        """value of parameter `name` giving the target ISI rate (Newton on the rate sensitivity),
+        returns (value, ISI rate, evaluations, converged)"""
+        value, isi_rate, num = ctypes.c_double(), ctypes.c_double(), ctypes.c_int()
+        x_0 = 0.5 * (low + high) if x_0 is None else x_0
+        status = _lib.snr_target_search(self._handle, name.encode(), target, low, high, x_0, ctypes.byref(value),
+                                        ctypes.byref(isi_rate), ctypes.byref(num))
+        if status < 0:
+            raise KeyError(name)
+        return value.value, isi_rate.value, num.value, status == 0
+
+
+class Surrogate:
+    """emulator of the step1 firing rate with 95% error bounds (surrogate.h), e.g.
+    Surrogate.from_step1("den").rates([[-50, 1.5]], tol=1) or
+    Surrogate([("I_app", -80, 0), ("W_GPe", 0.01, 0.1, True)], base=Cell(g_HCN_den=1)) + add() + fit()"""
+
+    def __init__(self, axes=(), base=None, _handle=None):
+        self._handle = _handle if _handle is not None else _lib.snr_surrogate_new(base._handle if base else None)
+        for axis in axes:
+            name, low, high = axis[:3]
+            log_scale = axis[3] if len(axis) > 3 else False
+            if _lib.snr_surrogate_add_axis(self._handle, name.encode(), low, high, int(log_scale)) != 0:
+                raise ValueError("invalid surrogate axis %r" % (axis,))
+
+    def __del__(self):
+        if getattr(self, "_handle", None):
+            _lib.snr_surrogate_free(self._handle)
+            self._handle = None
+
+    @classmethod
+    def from_step1(cls, HCN="den", directory=INTERMEDIATE_DIR):
+        """over I_app and g_HCN at HCN (I_app only for "zero"), trained on prepared_*.bin of step1 and fitted"""
+        assert HCN in HCN_CHOICES
+        handle = _lib.snr_surrogate_from_step1(path.join(directory, "").encode(), HCN.encode())
+        if not handle:
+            raise FileNotFoundError("step1 grid in %s" % directory)
+        return cls(_handle=handle)
+
+    @classmethod
+    def load(cls, filename):
+        handle = _lib.snr_surrogate_load(filename.encode())
+        if not handle:
+            raise ValueError("cannot load surrogate %s" % filename)
+        return cls(_handle=handle)
+
+    def save(self, filename):
+        if _lib.snr_surrogate_save(self._handle, filename.encode()) != 0:
+            raise OSError("cannot write surrogate %s" % filename)
+
+    @property
+    def axes(self):
+        """[(name, low, high, log_scale)]"""
+        axes = []
+        for i in range(_lib.snr_surrogate_dim(self._handle)):
+            low, high, log_scale = ctypes.c_double(), ctypes.c_double(), ctypes.c_int()
+            name = _lib.snr_surrogate_axis(self._handle, i, ctypes.byref(low), ctypes.byref(high),
+                                           ctypes.byref(log_scale))
+            axes.append((name.decode(), low.value, high.value, bool(log_scale.value)))
+        return axes
+
+    def __len__(self):
+        return _lib.snr_surrogate_size(self._handle)
+
+    def _points(self, x):
+        dim = _lib.snr_surrogate_dim(self._handle)
+        x = np.ascontiguousarray(np.asarray(x, dtype=np.float64).reshape(-1, dim))
+        return x, x.ctypes.data_as(_double_p)
+
+    def add(self, x, rates):
+        """training rates at the points x, shape (num, dim), e.g. from a sweep"""
+        x, x_p = self._points(x)
+        (rates, rates_p) = _as_array(rates, len(x))
+        if _lib.snr_surrogate_add(self._handle, len(x), x_p, rates_p) != 0:
+            raise ValueError("surrogate without axes")
+
+    def fit(self):
+        _lib.snr_surrogate_fit(self._handle)
+
+    def rates(self, x, tol=0., num_threads=0):
+        """(rates, 95% error bounds, simulations) at the points x, shape (num, dim); points with a bound above
+        tol > 0 Hz are simulated and added to the training set"""
+        x, x_p = self._points(x)
+        rates = np.empty(len(x), dtype=np.float64)
+        errors = np.empty(len(x), dtype=np.float64)
+        num = _lib.snr_surrogate_rates(self._handle, len(x), x_p, tol, rates.ctypes.data_as(_double_p),
+                                       errors.ctypes.data_as(_double_p), num_threads)
+        return rates, errors, num
+
+
+def select_kernel(isa="auto"):
+    if _lib.snr_select_kernel(isa.encode()) != 0:
+        raise ValueError(isa)
+    return _lib.snr_kernel_name().decode()
+
+
+def _placement_arrays(g_HCN, HCN, num):
+    assert HCN in HCN_CHOICES
+    g_som = _as_array(g_HCN, num) if HCN == "som" else (None, None)
+    g_den = _as_array(g_HCN, num) if HCN == "den" else (None, None)
+    return g_som, g_den
+
+
+def firing_rate_batch(I_app, g_HCN=0., HCN="zero", base=None, num_threads=0):
+    """step1 firing rates of cells with element-wise I_app and g_HCN inserted at HCN in (zero, som, den)"""
+    num = np.broadcast(np.asarray(I_app), np.asarray(g_HCN)).size
+    base = base if base is not None else Cell()
+    (I, I_p) = _as_array(I_app, num)
+    (g_som, g_som_p), (g_den, g_den_p) = _placement_arrays(g_HCN, HCN, num)
+    rates = np.empty(num, dtype=np.float64)
+    _lib.snr_firing_rate_batch(base._handle, num, I_p, g_som_p, g_den_p, rates.ctypes.data_as(_double_p), num_threads)
+    return rates
+
+
+def spike_batch(I_app, g_HCN=0., HCN="zero", base=None, duration=2000, GPe_stim=-1, Str_stim=-1,
+                capacity=1000, num_threads=0):
+    """step3 rasters, returns a list of spike time arrays"""
+    num = np.broadcast(np.asarray(I_app), np.asarray(g_HCN)).size
+    base = base if base is not None else Cell()
+    (I, I_p) = _as_array(I_app, num)
+    (g_som, g_som_p), (g_den, g_den_p) = _placement_arrays(g_HCN, HCN, num)
+    spike_times = np.empty((num, capacity), dtype=np.float64)
+    num_spikes = np.empty(num, dtype=np.intc)
+    _lib.snr_spike_batch(base._handle, num, I_p, g_som_p, g_den_p, int(duration), GPe_stim, Str_stim,
+                         spike_times.ctypes.data_as(_double_p), capacity, num_spikes.ctypes.data_as(_int_p),
+                         num_threads)
+    return [spike_times[j, :min(n, capacity)] for j, n in enumerate(num_spikes)]
+
+
+def bisect_I_app(target_fr, g_HCN=0., HCN="zero", I_range=(-80., 0.), iterations=12, num_threads=0):
+    """I_app giving each target firing rate, bisecting all targets at once (one parallel batch per iteration)"""
+    target_fr = np.asarray(target_fr, dtype=np.float64)
+    low = np.full(target_fr.shape, I_range[0])
+    high = np.full(target_fr.shape, I_range[1])
+    for _ in range(iterations):
+        middle = 0.5 * (low + high)
+        too_fast = firing_rate_batch(middle, g_HCN, HCN, num_threads=num_threads) > target_fr
+        high = np.where(too_fast, middle, high)
+        low = np.where(too_fast, low, middle)
+    return 0.5 * (low + high)
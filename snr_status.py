@@ -0,0 +1,131 @@
+import argparse
+import glob
+import json
+import os
+import os.path as path
+import sys
+import time
+
+# Live view of running step1/step3 jobs: reads the status files written by telemetry.h (by default every
+# intermediate_result/status/*.json) and prints one line per job with its progress, throughput, ETA and errors.
+# A job whose process is gone without reaching "done" is shown as "dead", one whose file was not rewritten for
+# --stale seconds as "stale".
+
+ROOT = path.dirname(path.abspath(__file__))
+STATUS_DIR = path.join(ROOT, "intermediate_result", "status")
+
+
+def status_files(sources):
+    files = []
+    for source in sources:
+        if path.isdir(source):
+            files += sorted(glob.glob(path.join(source, "*.json")))
+        else:
+            files += sorted(glob.glob(source))
+    return files
+
+
+def read_status(filename):
+    try:
+        with open(filename) as f:
+            return json.load(f)
+    except (OSError, ValueError):
+        return None  # removed or being replaced
+
+
+def process_alive(pid):
+    try:
+        os.kill(pid, 0)
+    except ProcessLookupError:
+        return False
+    except (PermissionError, OSError):
+        return True  # exists but is not ours, or no signals (Windows)
+    return True
+
+
+def job_state(status, now, stale):
+    state = status["state"]
+    if state == "running":
+        if not process_alive(status["pid"]):
+            return "dead"
+        if now - status["updated"] > stale:
+            return "stale"
+    return state
+
+
+def format_seconds(seconds):
+    if seconds < 0:
+        return "-"
+    seconds = int(round(seconds))
+    return "%d:%02d:%02d" % (seconds // 3600, seconds // 60 % 60, seconds % 60)
+
+
+def short_name(name, width):
+    # the end of a long name: step3 job names share their prefix and differ in the task id
+    return name if len(name) <= width else "..." + name[-(width - 3):]
+
+
+def print_table(files, stale, per_thread):
+    now = time.time()
+    print("%-32s %8s %-7s %15s %7s %10s %9s %8s %7s" % ("job", "pid", "state", "done/total", "%", "sim ms/s",
+                                                      "elapsed", "eta", "errors"))
+    for filename in files:
+        status = read_status(filename)
+        if status is None:
+            continue
+        done, total = status["done"], status["total"]
+        print("%-32s %8d %-7s %15s %6.1f%% %10.0f %9s %8s %7d" % (
+            short_name(status["job"], 32), status["pid"], job_state(status, now, stale), "%d/%d" % (done, total),
+            100.0 * done / total if total else 0, status["simulated_ms_per_s"], format_seconds(status["elapsed"]),
+            format_seconds(status["eta"]), status["errors"]))
+        if per_thread:
+            for t, thread in enumerate(status["threads"]):
+                print("    thread %3d: %8d items %10.0f sim ms/s %7d errors" % (t, thread["items"],
+                                                                              thread["simulated_ms_per_s"],
+                                                                              thread["errors"]))
+
+
+def clean(files, stale):
+    now = time.time()
+    for filename in files:
+        status = read_status(filename)
+        if status is not None and job_state(status, now, stale) in ("done", "failed", "dead"):
+            os.remove(filename)
+            print("Removed %s" % filename)
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description="progress of running step1/step3 jobs from their status files")
+    parser.add_argument("sources", nargs="*", default=[STATUS_DIR],
+                        help="status files, globs or directories of them (default: %(default)s)")
+    parser.add_argument("--watch", type=float, default=0, help="refresh every WATCH seconds until interrupted")
+    parser.add_argument("--threads", action="store_true", help="also show the per-thread throughput")
+    parser.add_argument("--stale", type=float, default=30, help="seconds without an update before a job is stale")
+    parser.add_argument("--clean", action="store_true", help="remove the files of finished and dead jobs")
+    return parser.parse_args()
+
+
+def main():
+    args = parse_args()
+    if args.clean:
+        clean(status_files(args.sources), args.stale)
+        return
+    while True:
+        files = status_files(args.sources)
+        if args.watch > 0:
+            sys.stdout.write("\033[H\033[J")  # clear the terminal
+        if not files:
+            print("No status files in %s" % ", ".join(args.sources))
+        else:
+            print_table(files, args.stale, args.threads)
+        if args.watch <= 0:
+            break
+        sys.stdout.flush()
+        try:
+            time.sleep(args.watch)
+        except KeyboardInterrupt:
+            break
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,159 @@
+// sobol.h
+// Variance-based global sensitivity analysis:
+// - Sobol' low-discrepancy sequence (direction numbers of Joe & Kuo, up to SOBOL_MAX_DIM dimensions, Gray-code free
+//   so that any point can be generated independently)
+// - Saltelli design: base matrices A and B (the first and the second half of a 2d-dimensional Sobol' point) and the
+//   d matrices AB_i (A with column i from B), N * (d + 2) model evaluations in total
+// - first-order (Saltelli 2010) and total (Jansen) Sobol' indices with bootstrap percentile confidence intervals
+#ifndef SOBOL_H
+#define SOBOL_H
+#include "step0_config.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define SOBOL_BITS 32
+#define SOBOL_MAX_DIM 32
+
+// degree s, coefficients a and initial direction numbers m of dimensions 2 ... SOBOL_MAX_DIM (new-joe-kuo-6.21201)
+static const struct { int s; int a; int m[7]; } SOBOL_DIRECTIONS[SOBOL_MAX_DIM - 1] = {
+    {1, 0, {1}}, {2, 1, {1, 3}}, {3, 1, {1, 3, 1}}, {3, 2, {1, 1, 1}}, {4, 1, {1, 1, 3, 3}}, {4, 4, {1, 3, 5, 13}},
+    {5, 2, {1, 1, 5, 5, 17}}, {5, 4, {1, 1, 5, 5, 5}}, {5, 7, {1, 1, 7, 11, 19}}, {5, 11, {1, 1, 5, 1, 1}},
+    {5, 13, {1, 1, 1, 3, 11}}, {5, 14, {1, 3, 5, 5, 31}}, {6, 1, {1, 3, 3, 9, 7, 49}}, {6, 13, {1, 1, 1, 15, 21, 21}},
+    {6, 16, {1, 3, 1, 13, 27, 49}}, {6, 19, {1, 1, 1, 15, 7, 5}}, {6, 22, {1, 3, 1, 15, 13, 25}},
+    {6, 25, {1, 1, 5, 5, 19, 61}}, {7, 1, {1, 3, 7, 11, 23, 15, 103}}, {7, 4, {1, 3, 7, 13, 13, 15, 69}},
+    {7, 7, {1, 1, 3, 13, 7, 35, 63}}, {7, 8, {1, 3, 5, 9, 1, 25, 53}}, {7, 14, {1, 3, 1, 13, 9, 35, 107}},
+    {7, 19, {1, 3, 1, 5, 27, 61, 31}}, {7, 21, {1, 1, 5, 11, 19, 41, 61}}, {7, 28, {1, 3, 5, 3, 3, 13, 69}},
+    {7, 31, {1, 1, 7, 13, 1, 19, 1}}, {7, 32, {1, 3, 7, 5, 13, 19, 59}}, {7, 37, {1, 1, 3, 9, 25, 29, 41}},
+    {7, 41, {1, 3, 5, 13, 23, 1, 55}}, {7, 42, {1, 3, 7, 3, 13, 59, 17}},
+};
+
+typedef struct {
+    int dim;
+    uint32_t v[SOBOL_MAX_DIM][SOBOL_BITS];  // direction numbers, scaled to 32 bits
+} Sobol;
+
+typedef struct {
+    double S1[SOBOL_MAX_DIM / 2];       // first-order indices
+    double S1_low[SOBOL_MAX_DIM / 2];   // confidence interval
+    double S1_high[SOBOL_MAX_DIM / 2];
+    double ST[SOBOL_MAX_DIM / 2];       // total indices
+    double ST_low[SOBOL_MAX_DIM / 2];
+    double ST_high[SOBOL_MAX_DIM / 2];
+    double mean;
+    double variance;
+} SobolIndices;
+
+
+// ###################################################################
+// ############              Sequence                   ##############
+// ###################################################################
+
+void sobol_init(Sobol *sobol, int dim) {
+    sobol->dim = dim;
+    for (int b = 0; b < SOBOL_BITS; b++) sobol->v[0][b] = 1u << (SOBOL_BITS - 1 - b);
+    for (int j = 1; j < dim; j++) {
+        int s = SOBOL_DIRECTIONS[j - 1].s, a = SOBOL_DIRECTIONS[j - 1].a;
+        for (int b = 0; b < s; b++) sobol->v[j][b] = (uint32_t)SOBOL_DIRECTIONS[j - 1].m[b] << (SOBOL_BITS - 1 - b);
+        for (int b = s; b < SOBOL_BITS; b++) {
+            uint32_t v = sobol->v[j][b - s] ^ (sobol->v[j][b - s] >> s);
+            for (int k = 1; k < s; k++) {
+                if ((a >> (s - 1 - k)) & 1) v ^= sobol->v[j][b - k];
+            }
+            sobol->v[j][b] = v;
+        }
+    }
+}
+
+// point `index` (0, 1, ...) of the sequence in [0, 1)^dim: XOR of the direction numbers of the Gray code bits
+void sobol_point(const Sobol *sobol, uint32_t index, double *x) {
+    uint32_t gray = index ^ (index >> 1);
+    for (int j = 0; j < sobol->dim; j++) {
+        uint32_t value = 0;
+        for (int b = 0; gray >> b; b++) {
+            if ((gray >> b) & 1) value ^= sobol->v[j][b];
+        }
+        x[j] = value * 0x1.0p-32;
+    }
+}
+
+// row `row` of matrix `block` of the Saltelli design (0: A, 1: B, 2 + i: AB_i), `sobol` has 2 * dim dimensions
+void saltelli_point(const Sobol *sobol, int dim, uint32_t row, int block, double *u) {
+    double x[SOBOL_MAX_DIM];
+    sobol_point(sobol, row, x);
+    for (int k = 0; k < dim; k++) u[k] = block == 1 ? x[dim + k] : x[k];
+    if (block >= 2) u[block - 2] = x[dim + block - 2];
+}
+
+
+// ###################################################################
+// ############               Indices                   ##############
+// ###################################################################
+
+// indices from the outputs of the rows `rows` (N of them, possibly repeated), f laid out as [row][block]
+static void sobol_estimate(const double *f, const long *rows, long N, int dim, double *S1, double *ST,
+                           double *mean, double *variance) {
+    double sum = 0, sum_sq = 0;
+    for (long n = 0; n < N; n++) {
+        const double *y = f + rows[n] * (dim + 2);
+        sum += y[0] + y[1];
+        sum_sq += y[0] * y[0] + y[1] * y[1];
+    }
+    *mean = sum / (2 * N);
+    *variance = sum_sq / (2 * N) - *mean * *mean;
+    for (int i = 0; i < dim; i++) {
+        double first = 0, total = 0;
+        for (long n = 0; n < N; n++) {
+            const double *y = f + rows[n] * (dim + 2);
+            first += y[1] * (y[2 + i] - y[0]);
+            total += (y[0] - y[2 + i]) * (y[0] - y[2 + i]);
+        }
+        S1[i] = *variance > 0 ? first / N / *variance : NAN;
+        ST[i] = *variance > 0 ? total / (2 * N) / *variance : NAN;
+    }
+}
+
+static int sobol_compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// indices of the N x (dim + 2) outputs `f` of a Saltelli design, with `num_bootstrap` resamples of the rows for the
+// `confidence` percentile intervals
+void sobol_indices(const double *f, long N, int dim, int num_bootstrap, double confidence, uint64_t seed,
+                   SobolIndices *indices) {
+    long *rows = (long *)malloc(N * sizeof(long));
+    for (long n = 0; n < N; n++) rows[n] = n;
+    sobol_estimate(f, rows, N, dim, indices->S1, indices->ST, &indices->mean, &indices->variance);
+
+    double *S1 = (double *)malloc((size_t)num_bootstrap * dim * sizeof(double));
+    double *ST = (double *)malloc((size_t)num_bootstrap * dim * sizeof(double));
+    double S1_r[SOBOL_MAX_DIM / 2], ST_r[SOBOL_MAX_DIM / 2], mean, variance;
+    for (int r = 0; r < num_bootstrap; r++) {
+        for (long n = 0; n < N; n++) rows[n] = (long)(splitmix_uniform(&seed) * N);
+        sobol_estimate(f, rows, N, dim, S1_r, ST_r, &mean, &variance);
+        for (int i = 0; i < dim; i++) {
+            S1[i * num_bootstrap + r] = S1_r[i];
+            ST[i * num_bootstrap + r] = ST_r[i];
+        }
+    }
+    int low = (int)floor((1 - confidence) / 2 * (num_bootstrap - 1));
+    int high = (int)ceil((1 + confidence) / 2 * (num_bootstrap - 1));
+    for (int i = 0; i < dim; i++) {
+        if (num_bootstrap == 0 || isnan(indices->S1[i])) {
+            indices->S1_low[i] = indices->S1_high[i] = indices->ST_low[i] = indices->ST_high[i] = NAN;
+            continue;
+        }
+        qsort(S1 + i * num_bootstrap, num_bootstrap, sizeof(double), sobol_compare_double);
+        qsort(ST + i * num_bootstrap, num_bootstrap, sizeof(double), sobol_compare_double);
+        indices->S1_low[i] = S1[i * num_bootstrap + low];
+        indices->S1_high[i] = S1[i * num_bootstrap + high];
+        indices->ST_low[i] = ST[i * num_bootstrap + low];
+        indices->ST_high[i] = ST[i * num_bootstrap + high];
+    }
+    free(rows);
+    free(S1);
+    free(ST);
+}
+
+#endif
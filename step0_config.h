@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <stdint.h>
 
 // basic
 # define second 1e3;
@@ -12,8 +13,13 @@
 const int CONFIG_spikes_init_size = 1e4;
 
 // Path
+// (can be overridden at compile time, e.g. -DSAVE_DIR=\"./intermediate_result/\")
+#ifndef SAVE_DIR
 # define SAVE_DIR "C:/Users/maxyc/CLionProjects/SNr_model_with_HCN/intermediate_result/"
+#endif
+#ifndef RESULT_DIR
 # define RESULT_DIR "C:/Users/maxyc/CLionProjects/SNr_model_with_HCN/simulation_result/"
+#endif
 
 
 // step 1 grid search hyperparameter
@@ -35,6 +41,48 @@ const int SIM_DURATION_total = 2000;  // ms
 const double DEFAULT_g_HCN = 1;
 const double DEFAULT_I_app = -50;
 
+// step 3 streaming summary (see analysis.h), same conventions as visualization.py
+const double SUMMARY_bin_size = 1;  // ms, PSTH bin
+const double SUMMARY_baseline_start = 100;  // ms
+const double SUMMARY_baseline_end = 1000;  // ms
+
+// step 3 ensemble trace statistics (see analysis.h)
+const double ENSEMBLE_bin_size = 1;  // ms, traces are sampled at the end of each bin
+const int ENSEMBLE_quantile_buckets = 256;  // resolution of the quantile sketches, per variable range
+
+// step 3 parallel-in-time single runs (see parareal.h)
+const int PARAREAL_coarse_ratio = 4;  // coarse step / CONFIG_dt without a tonic cycle, explicit Euler is unstable beyond ~0.1 ms
+const int PARAREAL_window = 100;  // ms integrated exactly after an input by the phase coarse propagator
+const double PARAREAL_tol = 0.1;  // mV, slice-start change below which the iteration stops
+
+// step 4 global sensitivity analysis (see sobol.h)
+const double SOBOL_response_window = 500;  // ms after the stimulation, longer pauses are censored to this
+const double SOBOL_rebound_window = 100;  // ms from the first spike after the stimulation
+const int SOBOL_chunk = 4096;  // evaluations between cache writes
+
+// step 3 phase-response curves (see prc.h)
+const int PRC_settle = 1000;  // ms before the cycle is measured, the pre-stimulation time of the protocol
+const int PRC_max_isi = 1000;  // ms, a longer silence means the cell is not firing tonically
+const int PRC_max_cycles = 50;  // cycles after settling until two interspike intervals agree
+const double PRC_period_tol = 0.1;  // ms between consecutive interspike intervals on the limit cycle
+const int PRC_fork_duration = 500;  // ms after the input, default of -prc_duration
+
+// periodic orbits by shooting (see shooting.h)
+const int SHOOTING_settle = 100;  // ms of plain integration before the first guess
+const double SHOOTING_max_isi = 1000;  // ms, a longer silence means the cell is not firing tonically
+const double SHOOTING_tol = 1e-6;  // max |P(y) - y| relative to the variable scales (10 mV, 1, Ca_in)
+const double SHOOTING_fd_step = 1e-7;  // forward-difference step relative to the variable scales
+const int SHOOTING_max_evaluations = 80;  // cycles per orbit, including the Jacobians
+
+// rate surrogate (see surrogate.h)
+const int SURROGATE_neighbors = 16;  // training points per query, at most SURROGATE_MAX_NEIGHBORS
+const double SURROGATE_nugget = 1. / 12;  // Hz^2, noise of the training rates (step1 rates are whole Hz)
+const long SURROGATE_fit_points = 512;  // leave-one-out points per candidate correlation length
+
+// live progress of step 1 and step 3 (see telemetry.h)
+const double TELEMETRY_interval = 1;  // s between status file rewrites
+const double TELEMETRY_max_rate = 1000;  // Hz, a spike train above one spike per ms counts as an error (runaway)
+
 
 static inline double* linspace(double start, double end, int n) {
     if (n <= 0) return NULL;
@@ -60,5 +108,14 @@ static inline double* exp2space(double start, double end, int n) {
     return array;
 }
 
+// splitmix64, uniform in [0, 1); the state is a plain integer that can be saved and restored
+static inline double splitmix_uniform(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return (z >> 11) * 0x1.0p-53;
+}
+
 
 #endif
\ No newline at end of file
@@ -1,61 +1,44 @@
-#include "bio_data/SNrModel.h"
-#include "step0_config.h"
+#include "simulation.h"
+#include "check.h"
+#include "telemetry.h"
 #include <stdio.h>
 #include <stdlib.h>
 
-typedef struct {
-    double *spike_times;
-    int num_spikes;
-} Spikes;
-
-// double uniform_rng(double min, double max)
-// {
-//     double range = (max - min);
-//     double div = RAND_MAX / range;
-//     return min + (rand() / div);
-// }
-
-Spikes simple_simulation(State *restrict s, int duration) {
-    Spikes spikes;
-    spikes.num_spikes = 0;
-    spikes.spike_times = (double *)malloc(CONFIG_spikes_init_size * sizeof(double));
-    for (int i = 0; i < duration*CONFIG_1ms_step_num; i++) {
-        if (f(s, CONFIG_dt)) {
-            spikes.spike_times[spikes.num_spikes] = s->time;
-            spikes.num_spikes++;
+// compare the selected kernel with the reference on `num_check` cells sampled evenly from the som/den grids
+int check_grid(int num_check, CheckTolerance tol) {
+    const double* g = exp2space(START_conductance, END_conductance, NUM_conductance);
+    const double* I = linspace(START_current, END_current, NUM_current);
+    State *cells = (State *)malloc(num_check * sizeof(State));
+    for (int k = 0; k < num_check; k++) {
+        // R2 low-discrepancy sequence over the (g_HCN, I_app) grid, alternating som/den
+        double u = fmod(0.5 + 0.7548776662466927 * k, 1.), v = fmod(0.5 + 0.5698402909980532 * k, 1.);
+        int i = (int)(u * NUM_conductance), j = (int)(v * NUM_current);
+        cells[k] = init_state();
+        cells[k].I_app = I[j];
+        if (k % 2 == 0) {
+            cells[k].g_HCN_som = g[i];
+        } else {
+            cells[k].g_HCN_den = g[i];
         }
-        // printf("%f, %f, %f\n", s->time, s->V_d, s->V_s);  // For debug
     }
-    return spikes;
+    int num_failed = check_against_reference(cells, num_check, PREPARE_DURATION_init + PREPARE_DURATION_test, -1, -1, tol);
+    free(cells);
+    free((double *)g);
+    free((double *)I);
+    return num_failed;
 }
 
-// return firing rate in Hz, 0 if less than 1Hz
-double calculate_firing_rate(State *restrict s) {
-    Spikes spikes = simple_simulation(s, PREPARE_DURATION_init + PREPARE_DURATION_test);
-    if (spikes.num_spikes == 0) {
-        free(spikes.spike_times);
-        return 0.0;
-    }
-    int first_spike_id = spikes.num_spikes - 1;
-    for (int i = 0; i < spikes.num_spikes; i++) {
-        if (spikes.spike_times[i] >= PREPARE_DURATION_init) {
-            first_spike_id = i + 0;
-            break;
-        }
-    }
-    if (first_spike_id >= spikes.num_spikes - 1) {
-        free(spikes.spike_times);
-        return 1.0;
-    }
-//    double first_spike = spikes.spike_times[first_spike_id];
-//    double last_spike = spikes.spike_times[spikes.num_spikes - 1];
-    double firing_rate = 1e3 * (spikes.num_spikes - first_spike_id)/PREPARE_DURATION_test;
-    free(spikes.spike_times);
-    return firing_rate;
+// calculate_firing_rate() of one grid cell, counted in the telemetry with its spikes
+double grid_firing_rate(State *s, int duration) {
+    Spikes spikes = simple_simulation(s, duration);
+    int num_spikes = spikes.num_spikes;
+    double rate = firing_rate_of(spikes);
+    telemetry_add(duration, telemetry_error(s->V_s, num_spikes, duration));
+    return rate;
 }
 
-// Previous task 4 in reference repository
-void setup() {
+// Previous task 4 in reference repository, `verbose`: one console line per grid cell
+void setup(int verbose, const char *status) {
     // ###################################################################
     // ############ TO Change: Search grid of g_HCN x I_app ##############
     // ############            see step0_config.h           ##############
@@ -65,12 +48,14 @@ void setup() {
     double r_0[NUM_current], r_som[NUM_conductance][NUM_current], r_den[NUM_conductance][NUM_current];
 
     // calculate firing rate r_0, r_som, r_den
+    const int duration = PREPARE_DURATION_init + PREPARE_DURATION_test;
+    telemetry_start("step1", NUM_current * (1 + 2 * NUM_conductance), status);
     printf("Computing r_0 ... \n");
     for (int j=0; j < NUM_current; j++) {
         State s = init_state();
         s.I_app = I[j];
-        r_0[j] = calculate_firing_rate(&s);
-        printf("r_0[%d]: I_app %f, firerate %f\n", j, I[j],  r_0[j]);
+        r_0[j] = grid_firing_rate(&s, duration);
+        if (verbose) printf("r_0[%d]: I_app %f, firerate %f\n", j, I[j],  r_0[j]);
     }
     printf("Computing r_som ... \n");
     for (int i = 0; i < NUM_conductance; i++) {
@@ -78,8 +63,8 @@ void setup() {
             State s = init_state();
             s.I_app = I[j];
             s.g_HCN_som = g[i];
-            r_som[i][j] = calculate_firing_rate(&s);
-            printf("r_som[%d][%d]: I_app %f, g_HCN_som %f, firerate %f\n", i, j, I[j], g[i], r_som[i][j]);
+            r_som[i][j] = grid_firing_rate(&s, duration);
+            if (verbose) printf("r_som[%d][%d]: I_app %f, g_HCN_som %f, firerate %f\n", i, j, I[j], g[i], r_som[i][j]);
         }
     }
     printf("Computing r_den ... \n");
@@ -88,14 +73,15 @@ void setup() {
             State s = init_state();
             s.I_app = I[j];
             s.g_HCN_den = g[i];
-            r_den[i][j] = calculate_firing_rate(&s);
-            printf("r_den[%d][%d]: I_app %f, g_HCN_den %f, firerate %f\n", i, j, I[j], g[i], r_den[i][j]);
+            r_den[i][j] = grid_firing_rate(&s, duration);
+            if (verbose) printf("r_den[%d][%d]: I_app %f, g_HCN_den %f, firerate %f\n", i, j, I[j], g[i], r_den[i][j]);
         }
     }
 
     // save result
     char file[128];
     printf("Saving intermediate data at: %s \n", SAVE_DIR);
+    INSTR_TIMER_START(writer);
 
     strcpy(file, SAVE_DIR "prepared_g.bin");
     write_binary_file(file, g, NUM_conductance);
@@ -117,18 +103,50 @@ void setup() {
     for (int i = 0; i < NUM_conductance; i++) {
         append_binary_file(file, r_den[i], NUM_current);
     }
+    INSTR_COUNT(INSTR_BYTES_WRITTEN, sizeof(double) * (NUM_conductance + NUM_current * (2 * NUM_conductance + 2)));
+    INSTR_TIMER_STOP(writer, INSTR_WRITER);
+    telemetry_finish(0);
 }
 
-int main() {
+int main(int argc, char *argv[]) {
     struct timeval start_time, stop_time, elapsed_time;
     gettimeofday(&start_time, NULL);
+    INSTR_INIT();
+
+    char isa[16] = "auto";
+    int num_check = 0, verbose = 1;
+    char status[512] = "auto";
+    CheckTolerance check_tol = {0, CONFIG_dt};
+    for (int i = 1; i + 1 < argc; i+=2) {
+        if (strcmp(argv[i], "-isa") == 0) {
+            strncpy(isa, argv[i + 1], sizeof(isa) - 1);
+            isa[sizeof(isa) - 1] = '\0';
+        } else if (strcmp(argv[i], "-verbose") == 0) {
+            verbose = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-status") == 0) {
+            strncpy(status, argv[i + 1], sizeof(status) - 1);
+            status[sizeof(status) - 1] = '\0';
+        } else if (strcmp(argv[i], "-check_against_reference") == 0) {
+            num_check = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-check_tol_spikes") == 0) {
+            check_tol.max_spike_diff = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-check_tol_rms") == 0) {
+            check_tol.max_rms = strtod(argv[i + 1], NULL);
+        } else {
+            printf("Unimplemented option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (select_kernel(isa)) return 1;
+    if (num_check > 0 && check_grid(num_check, check_tol) > 0) return 1;
 
     printf("Step1 grid search g_HCN begins \n");
-    setup();
+    setup(verbose, status);
     printf("Step1 grid search g_HCN finishes \n");
 
     gettimeofday(&stop_time, NULL);
     timersub(&stop_time, &start_time, &elapsed_time);
     printf("Running time: %f seconds.\n", elapsed_time.tv_sec + elapsed_time.tv_usec * 1e-6);
+    INSTR_REPORT(SAVE_DIR "step1_instrument.json");
     return 0;
 }
\ No newline at end of file
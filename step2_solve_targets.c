@@ -0,0 +1,339 @@
+// step2_solve_targets.c
+// Native alternative to step1 (grid search) + step2 (contour interpolation): for each target rate r it solves
+//   r_0(I_app) = 0.68 r                       (no-HCN cell)
+//   r_HCN(g_HCN, I_app) = r, same I_app         (somatic and dendritic HCN)
+// by bracketed secant iteration (Illinois) on actual simulations, and writes selected_*.bin in the layout of
+// step2_generate_I_g_pairs.py. Rates are interspike-interval rates over the step1 window (see cell_isi_rate()),
+// which vary smoothly with the parameters unlike spike counts. A few anchor targets spread over the range are solved
+// first; the other targets start from the anchors' interpolated solution and usually converge in 2-4 simulations.
+// The pairs are exact, but the cost grows with the number of targets: the default 1000 take about 6500 simulations,
+// more than the 2211 of the step1 grid, so the solver pays off for few targets or when exact pairs matter.
+// selected_converged.bin marks the targets whose three solves converged (1) or ended at a range bound (0).
+// With -rate orbit, the rate of a tonic cell is 1000 / period of its periodic orbit found by shooting (see shooting.h),
+// which costs about half the simulated time and has no window quantization; silent or irregular cells fall back to
+// the interspike-interval rate.
+#include "simulation.h"
+#include "sensitivity.h"
+#include "shooting.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#ifdef _OPENMP
+    #include <omp.h>
+#endif
+
+#define SOLVE_ratio 0.68      // r_0 / r_HCN, as in step2
+#define SOLVE_tol 0.05        // Hz
+#define SOLVE_max_iter 20     // simulations per solve
+#define SOLVE_num_anchors 9
+#define SOLVE_MAX_TARGETS 1024  // step3 reads at most this many cells
+
+typedef struct {
+    double value;
+    double rate;
+    int num_evaluations;
+    int converged;
+} Solution;
+
+static int rate_orbit = 0;      // -rate orbit
+static long num_orbits[SHOOT_UNSTABLE + 1];  // by status
+
+// (n - 1) / (t_last - t_first) in Hz over the spikes after PREPARE_DURATION_init, 0 below two spikes
+double cell_isi_rate(const CellParams *restrict p, const CellState *restrict c) {
+    CellState cell = *c;
+    Spikes spikes = cell_spike_simulation(p, &cell, PREPARE_DURATION_init + PREPARE_DURATION_test, -1, -1);
+    int first = 0;
+    while (first < spikes.num_spikes && spikes.spike_times[first] < PREPARE_DURATION_init) first++;
+    int last = spikes.num_spikes - 1;
+    double rate = last > first ? 1e3 * (last - first) / (spikes.spike_times[last] - spikes.spike_times[first]) : 0;
+    free(spikes.spike_times);
+    return rate;
+}
+
+// rate of the periodic orbit of a tonic cell with -rate orbit, cell_isi_rate() otherwise or without one
+double cell_rate(const CellParams *restrict p, const CellState *restrict c) {
+    if (rate_orbit) {
+        PeriodicOrbit orbit;
+        double rate = shoot_firing_rate(p, c, &orbit);
+        #pragma omp critical
+        num_orbits[orbit.status]++;
+        if (!isnan(rate)) return rate;
+    }
+    return cell_isi_rate(p, c);
+}
+
+// rate(parameter) = target within [low, high], secant steps from x_0 / x_1 until the root is bracketed, then Illinois.
+// Not sens_target_search() of sensitivity.h: its dual-number runs cost about 8 plain ones, cannot use the orbit rate
+// of -rate orbit, and the anchor-interpolated starts here already converge in 2-4 plain simulations
+Solution solve_rate(const CellParams *p, const CellState *c, int param, double target, double low, double high,
+                    double x_0, double x_1) {
+    CellParams params = *p;
+    CellState cell = *c;
+    Solution s = {0, 0, 0, 0};
+    double x[2] = {fmin(fmax(x_0, low), high), fmin(fmax(x_1, low), high)};
+    double f[2] = {0, 0};
+    int side = 0;  // Illinois: the end point kept twice in a row gets its value halved
+    int bracketed = 0;
+    for (int k = 0; k < 2 || s.num_evaluations < SOLVE_max_iter; k++) {
+        double x_next;
+        if (k < 2) {
+            x_next = x[k];
+        } else if (bracketed) {
+            x_next = (x[0] * f[1] - x[1] * f[0]) / (f[1] - f[0]);
+        } else {
+            x_next = f[1] != f[0] ? x[1] - f[1] * (x[1] - x[0]) / (f[1] - f[0]) : NAN;
+            // secant beyond the range: try the bound, flat: move towards the farther bound
+            if (isnan(x_next)) x_next = x[1] - low > high - x[1] ? (x[1] + low) / 2 : (x[1] + high) / 2;
+            x_next = fmin(fmax(x_next, low), high);
+            // the target is out of reach if the bound was tried already
+            if (x_next == x[1]) return s;
+        }
+        sens_set_param(&params, &cell, param, x_next);
+        double rate = cell_rate(&params, &cell);
+        double f_next = rate - target;
+        s.num_evaluations++;
+        s.value = x_next;
+        s.rate = rate;
+        if (fabs(f_next) < SOLVE_tol) {
+            s.converged = 1;
+            return s;
+        }
+        if (k == 0) {
+            f[0] = f_next;
+            continue;
+        }
+        if (k == 1) {
+            f[1] = f_next;
+            bracketed = (f[0] < 0) != (f[1] < 0);
+            continue;
+        }
+        if (bracketed) {
+            // replace the end point with the same sign
+            int same = (f_next < 0) == (f[1] < 0);
+            if (same) {
+                x[1] = x_next;
+                f[1] = f_next;
+                if (side == 1) f[0] /= 2;
+                side = 1;
+            } else {
+                x[0] = x_next;
+                f[0] = f_next;
+                if (side == 0) f[1] /= 2;
+                side = 0;
+            }
+            if (x[0] == x[1]) return s;
+        } else {
+            x[0] = x[1];
+            f[0] = f[1];
+            x[1] = x_next;
+            f[1] = f_next;
+            bracketed = (f[0] < 0) != (f[1] < 0);
+        }
+    }
+    return s;
+}
+
+// linear interpolation of the anchor solutions at target r (anchors sorted by target)
+static double interpolate(const double *anchor_r, const double *anchor_x, int num, double r) {
+    if (r <= anchor_r[0]) return anchor_x[0];
+    for (int k = 1; k < num; k++) {
+        if (r <= anchor_r[k]) {
+            double w = (r - anchor_r[k - 1]) / (anchor_r[k] - anchor_r[k - 1]);
+            return anchor_x[k - 1] + w * (anchor_x[k] - anchor_x[k - 1]);
+        }
+    }
+    return anchor_x[num - 1];
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// N(25, 12) samples below MAX_Fr = 60 Hz as in step2_generate_I_g_pairs.py (Box-Muller on rand())
+void draw_targets(double *targets, int num, unsigned seed) {
+    srand(seed);
+    for (int n = 0; n < num;) {
+        double u = (rand() + 1.) / (RAND_MAX + 2.), v = (rand() + 1.) / (RAND_MAX + 2.);
+        double r = 25 + 12 * sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+        if (r < 60) targets[n++] = r;
+    }
+}
+
+// I_app, then g_HCN_som and g_HCN_den for every target; x_0/x_1 of each solve from the anchors (or the range);
+// `label` prefixes the console lines ("anchor " for the anchor pass)
+void solve_targets(const char *label, const double *targets, int num, const double *anchor_r, const double *anchor_I,
+                   const double *anchor_g_som, const double *anchor_g_den, int num_anchors,
+                   Solution *zero, Solution *som, Solution *den) {
+    const double g_low = pow(2, START_conductance), g_high = pow(2, END_conductance);
+    State s = init_state();
+    const CellParams params = params_from_state(&s);
+    #pragma omp parallel for schedule(dynamic)
+    for (int j = 0; j < num; j++) {
+        CellState cell = cell_from_state(&s);
+        double I_0 = num_anchors ? interpolate(anchor_r, anchor_I, num_anchors, targets[j]) : -50;
+        zero[j] = solve_rate(&params, &cell, SENS_I_app, SOLVE_ratio * targets[j], START_current, END_current,
+                             I_0, I_0 + 1);
+        cell.I_app = zero[j].value;
+        double g_som = num_anchors ? interpolate(anchor_r, anchor_g_som, num_anchors, targets[j]) : 1;
+        som[j] = solve_rate(&params, &cell, SENS_g_HCN_som, targets[j], g_low, g_high, g_som, g_som * 1.1);
+        double g_den = num_anchors ? interpolate(anchor_r, anchor_g_den, num_anchors, targets[j]) : 1;
+        den[j] = solve_rate(&params, &cell, SENS_g_HCN_den, targets[j], g_low, g_high, g_den, g_den * 1.1);
+        printf("%s#%d: target %f Hz, I_app %f (%d sims), g_HCN_som %f (%d sims), g_HCN_den %f (%d sims)%s\n", label,
+               j, targets[j], zero[j].value, zero[j].num_evaluations, som[j].value, som[j].num_evaluations,
+               den[j].value, den[j].num_evaluations,
+               zero[j].converged && som[j].converged && den[j].converged ? "" : " NOT converged");
+    }
+}
+
+int write_selected(const char *dir, const char *name, const double *data, int num) {
+    char filename[512];
+    snprintf(filename, sizeof(filename), "%s%s.bin", dir, name);
+    int status = atomic_write(filename, data, num);
+    if (status) printf("Error writing %s \n", filename);
+    return status;
+}
+
+int main(int argc, char *argv[]) {
+    struct timeval start_time, stop_time, elapsed_time;
+    gettimeofday(&start_time, NULL);
+    INSTR_INIT();
+
+    char isa[16] = "auto", target_file[512] = "", output_dir[512] = SAVE_DIR;
+    int num = 1000;
+    unsigned seed = 0;
+    for (int i = 1; i + 1 < argc; i+=2) {
+        if (strcmp(argv[i], "-targets") == 0) {
+            snprintf(target_file, sizeof(target_file), "%s", argv[i + 1]);
+        } else if (strcmp(argv[i], "-num") == 0) {
+            num = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-seed") == 0) {
+            seed = strtoul(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-o") == 0) {
+            snprintf(output_dir, sizeof(output_dir), "%s", argv[i + 1]);
+        } else if (strcmp(argv[i], "-isa") == 0) {
+            strncpy(isa, argv[i + 1], sizeof(isa) - 1);
+            isa[sizeof(isa) - 1] = '\0';
+        } else if (strcmp(argv[i], "-rate") == 0) {
+            if (strcmp(argv[i + 1], "isi") != 0 && strcmp(argv[i + 1], "orbit") != 0) {
+                printf("-rate must be isi or orbit\n");
+                return 1;
+            }
+            rate_orbit = strcmp(argv[i + 1], "orbit") == 0;
+        } else {
+            printf("Unimplemented option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (select_kernel(isa)) return 1;
+
+    // target rates, from a float64 file or drawn as in step2
+    double *targets = (double *)malloc(SOLVE_MAX_TARGETS * sizeof(double));
+    if (target_file[0] != '\0') {
+        FILE *file = fopen(target_file, "rb");
+        if (file == NULL) {
+            perror("Error opening targets");
+            return 1;
+        }
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fclose(file);
+        if (size <= 0 || size / (long)sizeof(double) > SOLVE_MAX_TARGETS) {
+            printf("Targets: expected 1 to %d float64 values in %s\n", SOLVE_MAX_TARGETS, target_file);
+            return 1;
+        }
+        size_t n;
+        read_binary_file(target_file, targets, &n);
+        num = (int)n;
+    } else {
+        if (num < 1 || num > SOLVE_MAX_TARGETS) {
+            printf("-num must be between 1 and %d\n", SOLVE_MAX_TARGETS);
+            return 1;
+        }
+        draw_targets(targets, num, seed);
+    }
+    printf("Step2 target solver: %d targets \n", num);
+
+    // anchors at evenly spaced quantiles of the targets, solved from the middle of the ranges
+    double sorted[SOLVE_MAX_TARGETS];
+    memcpy(sorted, targets, num * sizeof(double));
+    qsort(sorted, num, sizeof(double), compare_double);
+    int num_anchors = num >= 4 * SOLVE_num_anchors ? SOLVE_num_anchors : 0;
+    double anchor_r[SOLVE_num_anchors] = {0}, anchor_I[SOLVE_num_anchors] = {0};
+    double anchor_g_som[SOLVE_num_anchors] = {0}, anchor_g_den[SOLVE_num_anchors] = {0};
+    Solution anchor_zero[SOLVE_num_anchors], anchor_som[SOLVE_num_anchors], anchor_den[SOLVE_num_anchors];
+    for (int k = 0; k < num_anchors; k++) anchor_r[k] = sorted[(long)(2 * k + 1) * num / (2 * num_anchors)];
+    solve_targets("anchor ", anchor_r, num_anchors, NULL, NULL, NULL, NULL, 0, anchor_zero, anchor_som, anchor_den);
+    for (int k = 0; k < num_anchors; k++) {
+        anchor_I[k] = anchor_zero[k].value;
+        anchor_g_som[k] = anchor_som[k].value;
+        anchor_g_den[k] = anchor_den[k].value;
+    }
+
+    Solution *zero = (Solution *)malloc(num * sizeof(Solution));
+    Solution *som = (Solution *)malloc(num * sizeof(Solution));
+    Solution *den = (Solution *)malloc(num * sizeof(Solution));
+    solve_targets("", targets, num, anchor_r, anchor_I, anchor_g_som, anchor_g_den, num_anchors, zero, som, den);
+
+    // selected_*.bin as written by step2_generate_I_g_pairs.py
+    double *I = (double *)malloc(num * sizeof(double));
+    double *g = (double *)malloc(num * sizeof(double));
+    double *r = (double *)malloc(num * sizeof(double));
+    double *converged = (double *)malloc(num * sizeof(double));
+    long num_sims = 0;
+    int num_failed = 0, status = 0;
+    for (int k = 0; k < num_anchors; k++) {
+        num_sims += anchor_zero[k].num_evaluations + anchor_som[k].num_evaluations + anchor_den[k].num_evaluations;
+    }
+    for (int j = 0; j < num; j++) {
+        num_sims += zero[j].num_evaluations + som[j].num_evaluations + den[j].num_evaluations;
+        converged[j] = zero[j].converged && som[j].converged && den[j].converged;
+        num_failed += !converged[j];
+        I[j] = zero[j].value;
+        g[j] = 0;
+        r[j] = zero[j].rate;
+    }
+    status |= write_selected(output_dir, "selected_I_HCN_zero", I, num);
+    status |= write_selected(output_dir, "selected_g_HCN_zero", g, num);
+    status |= write_selected(output_dir, "selected_r_HCN_zero", r, num);
+    for (int j = 0; j < num; j++) {
+        g[j] = som[j].value;
+        r[j] = som[j].rate;
+    }
+    status |= write_selected(output_dir, "selected_I_HCN_som", I, num);
+    status |= write_selected(output_dir, "selected_g_HCN_som", g, num);
+    status |= write_selected(output_dir, "selected_r_HCN_som", r, num);
+    for (int j = 0; j < num; j++) {
+        g[j] = den[j].value;
+        r[j] = den[j].rate;
+    }
+    status |= write_selected(output_dir, "selected_I_HCN_den", I, num);
+    status |= write_selected(output_dir, "selected_g_HCN_den", g, num);
+    status |= write_selected(output_dir, "selected_r_HCN_den", r, num);
+    status |= write_selected(output_dir, "selected_target_r", targets, num);
+    status |= write_selected(output_dir, "selected_converged", converged, num);
+    INSTR_COUNT(INSTR_BYTES_WRITTEN, sizeof(double) * 11 * num);
+
+    printf("Step2 target solver: %ld simulations (%.1f per target), %d target(s) not converged within %g Hz \n",
+           num_sims, (double)num_sims / num, num_failed, SOLVE_tol);
+    if (rate_orbit) {
+        printf("Step2 target solver: periodic orbits");
+        for (int k = 0; k <= SHOOT_UNSTABLE; k++) printf(" %ld %s", num_orbits[k], SHOOT_STATUS_NAMES[k]);
+        printf(" (all but tonic by time integration) \n");
+    }
+    if (!status) printf("Saved selected_*.bin in %s \n", output_dir);
+    free(targets);
+    free(converged);
+    free(zero);
+    free(som);
+    free(den);
+    free(I);
+    free(g);
+    free(r);
+
+    gettimeofday(&stop_time, NULL);
+    timersub(&stop_time, &start_time, &elapsed_time);
+    printf("Running time: %f seconds.\n", elapsed_time.tv_sec + elapsed_time.tv_usec * 1e-6);
+    INSTR_REPORT(SAVE_DIR "step2_instrument.json");
+    return status;
+}
@@ -1,5 +1,12 @@
-#include "bio_data/SNrModel.h"
-#include "step0_config.h"
+#include "simulation.h"
+#include "check.h"
+#include "analysis.h"
+#include "dendrite.h"
+#include "parareal.h"
+#include "sensitivity.h"
+#include "prc.h"
+#include "checkpoint.h"
+#include "telemetry.h"
 #include <stdio.h>
 #include <sys/stat.h>
 
@@ -47,131 +54,149 @@ int directory_not_exists(const char *path) {
     return 1;
 }
 
+// options of the runners besides the model setting
 typedef struct {
-    double *spike_times;
-    double *I_HCN_som;
-    double *m_HCN_som;
-    double *g_HCN_som;
-    double *I_app;
-    double *I_TRPC3;
-    double *I_HCN_den;
-    double *m_HCN_den;
-    double *g_HCN_den;
-    double *Vs;
-    double *Vd;
-    double *I_GABA_som;
-    double *E_GABA_som;
-    double *g_GABA_som;
-    double *D;
-    double *I_GABA_den;
-    double *E_GABA_den;
-    double *g_GABA_den;
-    double *F;
-    int num_spikes;
-} Spikes;
-
-
-void write_csv(const char *filename, double *data, int num) {
-    FILE *file = fopen(filename, "w");
-    if (file == NULL) {
-        printf("Error opening file!\n");
-        return;
-    }
-    for (int i = 0; i < num; i++) {
-        fprintf(file, "%f,", data[i]);
+    int num_check;              // cells checked against the reference kernel before the run
+    CheckTolerance check_tol;
+    int write_raster;           // raw raster csv
+    int write_summary;          // streaming PSTH/latency/baseline summary, see analysis.h
+    int ensemble;               // ensemble trace statistics instead of rasters, see analysis.h
+    int ensemble_quantiles;     // quantile sketches in ensemble mode
+    const Morphology *morphology;  // N-compartment dendrite instead of f(), see dendrite.h (NULL: f())
+    double theta;               // axial coupling of the N-compartment dendrite, 0 explicit, 0.5 - 1 implicit
+    int parareal;               // single runs in parallel time slices, see parareal.h
+    PararealOptions parareal_opt;
+    int parareal_check;         // also run serially and report speedup and error
+    int duration;               // ms, parareal single runs
+    int sensitivity;            // spike-time and rate sensitivities of single runs, see sensitivity.h
+    int prc;                    // phase-response curves at this many phases instead of rasters, see prc.h
+    int prc_duration;           // ms, forks of the phase-response curves
+    double checkpoint_sim;      // ms of simulated time between checkpoints of batch runs, see checkpoint.h
+    double checkpoint_wall;     // s of wall time between checkpoints
+    int resume;                 // continue a batch run from its checkpoint
+    int verbose;                // one console line per cell
+    const char *status;         // live progress file of batch runs, see telemetry.h ("auto", "none" or a path)
+} RunOptions;
+
+State setup_state(double W_GPe, double W_Str, double tau, const char* HCN, double g_HCN, double I_app) {
+    State s = init_state();
+    s.W_GPe = W_GPe;
+    s.tau_GABA_som = tau;
+    s.W_Str = W_Str;
+    s.tau_GABA_den = tau;
+    s.I_app = I_app;
+    if (strcmp(HCN, "som") == 0) {
+        s.g_HCN_som = g_HCN;
+    } else if (strcmp(HCN, "den") == 0) {
+        s.g_HCN_den = g_HCN;
     }
-    fprintf(file, "END\n");
-    fclose(file);
-    printf("Result saved in %s \n", filename);
+    return s;
 }
 
-
-Spikes spike_simulation(State *restrict s, int duration, double GPe_stim_time, double Str_stim_time) {
-    Spikes spikes;
-    spikes.num_spikes = 0;
-    spikes.spike_times = (double *)malloc(CONFIG_spikes_init_size * sizeof(double));
-    for (int i = 0; i < duration*CONFIG_1ms_step_num; i++) {
-        if (i<=GPe_stim_time*CONFIG_1ms_step_num && (i+1)>GPe_stim_time*CONFIG_1ms_step_num) {
-            s->GPe_stim = 1;
-        } else {
-            s->GPe_stim = 0;
-        }
-        if (i<=Str_stim_time*CONFIG_1ms_step_num && (i+1)>Str_stim_time*CONFIG_1ms_step_num) {
-            s->Str_stim = 1;
-        } else {
-            s->Str_stim = 0;
-        }
-        if (f(s, CONFIG_dt)) {
-            spikes.spike_times[spikes.num_spikes] = s->time;
-            spikes.num_spikes++;
+// traces of all cells accumulated into per-time-bin statistics, cells run in parallel when compiled with -fopenmp
+int ensemble_batch(double W_GPe, double W_Str, double tau, const char* HCN, double GPe_stim, double Str_stim,
+                   const char* task_id, int num_sim, const double *g_HCN, const double *I, const RunOptions *opt) {
+    int num_buckets = opt->ensemble_quantiles ? ENSEMBLE_quantile_buckets : 0;
+    EnsembleStats stats = ensemble_init(SIM_DURATION_total, num_buckets);
+    #pragma omp parallel
+    {
+        // per-thread accumulator, merged once at the end
+        EnsembleStats local = ensemble_init(SIM_DURATION_total, num_buckets);
+        #pragma omp for schedule(dynamic)
+        for (int j = 0; j < num_sim; j++) {
+            State s = setup_state(W_GPe, W_Str, tau, HCN, g_HCN[j], I[j]);
+            int num_spikes = ensemble_simulation(&s, SIM_DURATION_total, GPe_stim, Str_stim, &local);
+            if (opt->verbose) printf("#%d: I_app: %f, g_HCN_%s: %f, %d spikes \n", j, I[j], HCN, g_HCN[j], num_spikes);
+            telemetry_add(SIM_DURATION_total, telemetry_error(s.V_s, num_spikes, SIM_DURATION_total));
         }
+        #pragma omp critical
+        ensemble_merge(&stats, &local);
+        ensemble_free(&local);
     }
-    return spikes;
+    char filename[512];
+    strcpy(filename, RESULT_DIR);
+    strcat(filename, task_id);
+    strcat(filename, "_ensemble.bin");
+    int status = ensemble_write(&stats, filename);
+    ensemble_free(&stats);
+    return status;
 }
 
-
-Spikes full_simulation(State *restrict s, int duration, double GPe_stim_time, double Str_stim_time) {
-    Spikes spikes;
-    spikes.num_spikes = 0;
-    spikes.spike_times = (double *)malloc(CONFIG_spikes_init_size * sizeof(double));
-    spikes.I_HCN_som = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
-    spikes.m_HCN_som = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
-    spikes.g_HCN_som = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
-    spikes.I_app = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
-    spikes.I_TRPC3 = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
-    spikes.I_HCN_den = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
-    spikes.m_HCN_den = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
-    spikes.g_HCN_den = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
-    spikes.Vs = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
-    spikes.Vd = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
-    spikes.I_GABA_som = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
-    spikes.E_GABA_som = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
-    spikes.g_GABA_som = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
-    spikes.D = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
-    spikes.I_GABA_den = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
-    spikes.E_GABA_den = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
-    spikes.g_GABA_den = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
-    spikes.F = (double *)malloc(CONFIG_1ms_step_num*duration * sizeof(double));
-    for (int i = 0; i < duration*CONFIG_1ms_step_num; i++) {
-        if (i<=GPe_stim_time*CONFIG_1ms_step_num && (i+1)>GPe_stim_time*CONFIG_1ms_step_num) {
-            s->GPe_stim = 1;
-        } else {
-            s->GPe_stim = 0;
+// phase-response curves of all cells: settle runs in parallel over cells, then forks over cells x phases
+int prc_batch(double W_GPe, double W_Str, double tau, const char* HCN, double GPe_stim, double Str_stim,
+              const char* task_id, int num_sim, const double *g_HCN, const double *I, const RunOptions *opt) {
+    int num_phases = opt->prc;
+    long num_points = (long)num_sim * num_phases;
+    // cells of a condition only differ in I_app and g_HCN, they share one parameter block
+    State base = setup_state(W_GPe, W_Str, tau, HCN, 0, 0);
+    const CellParams params = params_from_state(&base);
+    LimitCycle *cycles = (LimitCycle *)malloc(num_sim * sizeof(LimitCycle));
+    CellState *snapshots = (CellState *)malloc(num_points * sizeof(CellState));
+    double *phases = (double *)malloc(num_points * sizeof(double));
+    PrcPoint *points = (PrcPoint *)malloc(num_points * sizeof(PrcPoint));
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int j = 0; j < num_sim; j++) {
+        State s = setup_state(W_GPe, W_Str, tau, HCN, g_HCN[j], I[j]);
+        CellState cell = cell_from_state(&s);
+        cycles[j] = prc_limit_cycle(&params, &cell, num_phases, snapshots + (long)j * num_phases,
+                                    phases + (long)j * num_phases);
+        if (opt->verbose) {
+            printf("#%d: I_app: %f, g_HCN_%s: %f, period %f ms \n", j, I[j], HCN, g_HCN[j], cycles[j].period);
         }
-        if (i<=Str_stim_time*CONFIG_1ms_step_num && (i+1)>Str_stim_time*CONFIG_1ms_step_num) {
-            s->Str_stim = 1;
+        telemetry_add(cell.time, telemetry_error(cell.V_s, 0, cell.time));
+    }
+    #pragma omp parallel for schedule(dynamic)
+    for (long k = 0; k < num_points; k++) {
+        const LimitCycle *cycle = &cycles[k / num_phases];
+        if (cycle->oscillating) {
+            points[k] = prc_fork(&params, &snapshots[k], cycle, phases[k], GPe_stim >= 0, Str_stim >= 0,
+                                 opt->prc_duration);
         } else {
-            s->Str_stim = 0;
+            points[k] = (PrcPoint){NAN, NAN, NAN, NAN};
         }
-        if (f(s, CONFIG_dt)) {
-            spikes.spike_times[spikes.num_spikes] = s->time;
-            spikes.num_spikes++;
+        telemetry_add(cycle->oscillating ? opt->prc_duration : 0, 0);
+    }
+
+    char filename[512];
+    strcpy(filename, RESULT_DIR);
+    strcat(filename, task_id);
+    strcat(filename, "_prc.csv");
+    FILE *result = fopen(filename, "w");
+    if (result == NULL) {
+        perror("Failed to open file");
+    } else {
+        fprintf(result, "cell,I_app,g_HCN,period,phase,first_spike,phase_shift,phase_shift_2\n");
+        for (long k = 0; k < num_points; k++) {
+            int j = k / num_phases;
+            fprintf(result, "%d,%f,%f,%.9g,%.9g,%.9g,%.9g,%.9g\n", j, I[j], g_HCN[j], cycles[j].period,
+                    points[k].phase, points[k].first_spike, points[k].phase_shift, points[k].phase_shift_2);
         }
-        spikes.I_HCN_som[i] = s->g_HCN_som * s->m_HCN_som * (s->V_s - E_HCN);
-        spikes.m_HCN_som[i] = s->m_HCN_som;
-        spikes.g_HCN_som[i] = s->g_HCN_som;
-        spikes.I_app[i] = s->I_app;
-        spikes.I_TRPC3[i] = g_TRPC3 * (s->V_d - E_TRPC3);
-        spikes.I_HCN_den[i] = s->g_HCN_den * s->m_HCN_den * (s->V_d - E_HCN);
-        spikes.m_HCN_den[i] = s->m_HCN_den;
-        spikes.g_HCN_den[i] = s->g_HCN_den;
-        spikes.Vs[i] = s->V_s;
-        spikes.Vd[i] = s->V_d;
-        spikes.E_GABA_som[i] = V_T * log((p_Cl * Cl_out + p_HCO3 * HCO3_out) / (p_Cl * s->Cl_som + p_HCO3 * HCO3_in)) / z_GABA;;
-        spikes.I_GABA_som[i] = s->g_GABA_som * (s->V_s - spikes.E_GABA_som[i]);
-        spikes.g_GABA_som[i] = s->g_GABA_som;
-        spikes.D[i] = s->D;
-        spikes.E_GABA_den[i] = V_T * log((p_Cl * Cl_out + p_HCO3 * HCO3_out) / (p_Cl * s->Cl_den + p_HCO3 * HCO3_in)) / z_GABA;;
-        spikes.I_GABA_den[i] = s->g_GABA_den * (s->V_d - spikes.E_GABA_den[i]);
-        spikes.g_GABA_den[i] = s->g_GABA_den;
-        spikes.F[i] = s->F;
-    }
-    return spikes;
+        fclose(result);
+        printf("Phase-response curves saved in %s \n", filename);
+    }
+    free(cycles);
+    free(snapshots);
+    free(phases);
+    free(points);
+    return result == NULL;
 }
 
+// everything a checkpoint of a batch run depends on, `base` is the setup state of the run (the model of params.h)
+uint64_t batch_fingerprint(const State *base, const char* HCN, double GPe_stim, double Str_stim, int num_sim,
+                           const double *g_HCN, const double *I, const RunOptions *opt) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    hash = checkpoint_hash(kernel_name, strlen(kernel_name), hash);
+    hash = checkpoint_hash(HCN, strlen(HCN), hash);
+    hash = checkpoint_hash_state(base, hash);
+    double setup[5] = {GPe_stim, Str_stim, SIM_DURATION_total, opt->write_raster, opt->write_summary};
+    hash = checkpoint_hash(setup, sizeof(setup), hash);
+    hash = checkpoint_hash(g_HCN, num_sim * sizeof(double), hash);
+    return checkpoint_hash(I, num_sim * sizeof(double), hash);
+}
 
 int batch_simulation(double W_GPe, double W_Str, double tau, const char* HCN,
-    double GPe_stim, double Str_stim, const char* task_id, int num_sim) {
+    double GPe_stim, double Str_stim, const char* task_id, int num_sim, const RunOptions *opt) {
     // load conductances
     char g_value_filename[512];
     if (strcmp(HCN, "som") == 0) {
@@ -184,7 +209,9 @@ int batch_simulation(double W_GPe, double W_Str, double tau, const char* HCN,
     double g_HCN[1024];
     size_t N0;
     printf("%s \n", g_value_filename);
+    INSTR_TIMER_START(reader_g);
     read_binary_file(g_value_filename, g_HCN, &N0);
+    INSTR_TIMER_STOP(reader_g, INSTR_READER);
 
     // load current
     char I_value_filename[512];
@@ -198,47 +225,237 @@ int batch_simulation(double W_GPe, double W_Str, double tau, const char* HCN,
     double I[1024];
     size_t N1;
     printf("%s \n", I_value_filename);
+    INSTR_TIMER_START(reader_I);
     read_binary_file(I_value_filename, I, &N1);
+    INSTR_TIMER_STOP(reader_I, INSTR_READER);
+
+    // compare the selected kernel with the reference on evenly sampled cells before the production run
+    int num_check = opt->num_check;
+    if (num_check > 0) {
+        if (num_check > num_sim) num_check = num_sim;
+        State *cells = (State *)malloc(num_check * sizeof(State));
+        for (int k = 0; k < num_check; k++) {
+            int j = k * num_sim / num_check;
+            cells[k] = setup_state(W_GPe, W_Str, tau, HCN, g_HCN[j], I[j]);
+        }
+        int num_failed = check_against_reference(cells, num_check, SIM_DURATION_total, GPe_stim, Str_stim,
+                                                 opt->check_tol);
+        free(cells);
+        if (num_failed > 0) return 1;
+    }
+
+    char job[256];
+    snprintf(job, sizeof(job), "step3 %s", task_id);
+    telemetry_start(job, (long)num_sim * (opt->prc + 1), opt->status);
+    if (opt->prc) {
+        int status = prc_batch(W_GPe, W_Str, tau, HCN, GPe_stim, Str_stim, task_id, num_sim, g_HCN, I, opt);
+        telemetry_finish(status);
+        return status;
+    }
+    if (opt->ensemble) {
+        int status = ensemble_batch(W_GPe, W_Str, tau, HCN, GPe_stim, Str_stim, task_id, num_sim, g_HCN, I, opt);
+        telemetry_finish(status);
+        return status;
+    }
+
+    // periodic checkpoints, a resumed run continues the raster written so far
+    Checkpoint ck = {0};
+    int checkpointing = opt->checkpoint_sim > 0 || opt->checkpoint_wall > 0 || opt->resume, resuming = 0;
+    if (checkpointing) {
+        snprintf(ck.filename, sizeof(ck.filename), "%s%s_checkpoint.bin", RESULT_DIR, task_id);
+        FILE *file = opt->resume ? fopen(ck.filename, "rb") : NULL;
+        if (file) fclose(file);
+        resuming = file != NULL;
+        if (opt->resume && !resuming) printf("No checkpoint %s, starting from the beginning \n", ck.filename);
+    }
 
     // simulate for all possible conductances
+    char filename[512];
+    FILE *result = NULL;
+    if (opt->write_raster) {
+        strcpy(filename, RESULT_DIR);
+        strcat(filename, task_id);
+        strcat(filename, ".csv");
+        printf("Result writing in %s \n", filename);
+        result = fopen(filename, resuming ? "r+" : "w");
+        if (result == NULL) {
+            perror("Failed to open file");
+            telemetry_finish(1);
+            return 1;  // Or handle the error as needed
+        }
+    }
+    // the first stimulation is the latency reference of the summary
+    SpikeSummary summary = summary_init(SIM_DURATION_total, GPe_stim >= 0 ? GPe_stim : Str_stim, num_sim);
+    // cells of a condition only differ in I_app and g_HCN, they share one parameter block
+    State base = setup_state(W_GPe, W_Str, tau, HCN, 0, 0);
+    const CellParams params = params_from_state(&base);
+    CheckpointPosition pos = {0};
+    if (checkpointing) {
+        ck.fingerprint = batch_fingerprint(&base, HCN, GPe_stim, Str_stim, num_sim, g_HCN, I, opt);
+        ck.interval_sim = opt->checkpoint_sim;
+        ck.interval_wall = opt->checkpoint_wall;
+        ck.last_wall = wall_time();
+        ck.num_sim = num_sim;
+        ck.raster = result;
+        ck.summary = opt->write_summary ? &summary : NULL;
+        pos.state = base;
+        if (resuming && checkpoint_read(&ck, &pos)) {
+            if (result) fclose(result);
+            summary_free(&summary);
+            telemetry_finish(1);
+            return 1;
+        }
+        if (resuming) printf("Resuming at cell %d, %.0f ms \n", pos.cell, pos.step / (double)CONFIG_1ms_step_num);
+    }
+    for (int j = pos.cell; j < num_sim; j++) {
+        State s = setup_state(W_GPe, W_Str, tau, HCN, g_HCN[j], I[j]);
+        CellState cell;
+        Spikes spikes;
+        if (checkpointing) {
+            // the resumed cell continues from its checkpointed state, the others start from their setup state
+            if (!resuming || j > pos.cell) {
+                pos.cell = j;
+                pos.step = 0;
+                pos.state = s;
+                pos.spikes = spikes_new();
+            }
+            cell = cell_from_state(&pos.state);
+            checkpoint_simulation(&params, &cell, &pos, &ck, SIM_DURATION_total, GPe_stim, Str_stim);
+            spikes = pos.spikes;
+        } else {
+            cell = cell_from_state(&s);
+            spikes = opt->morphology ?
+                dendrite_spike_simulation(&params, opt->morphology, &cell, opt->theta, SIM_DURATION_total, GPe_stim,
+                                          Str_stim) :
+                cell_spike_simulation(&params, &cell, SIM_DURATION_total, GPe_stim, Str_stim);
+        }
+        if (opt->verbose) {
+            printf("#%d: I_app: %f, g_HCN_%s: %f, %d spikes \n", j, I[j], HCN, g_HCN[j], spikes.num_spikes);
+        }
+        telemetry_add(SIM_DURATION_total, telemetry_error(cell.V_s, spikes.num_spikes, SIM_DURATION_total));
+        if (opt->write_summary) summary_add(&summary, &spikes);
+        if (result) write_raster(result, &spikes);
+        free(spikes.spike_times);
+        if (checkpointing && result) ck.raster_offset = ftell(result);
+    }
+    if (result) {
+        fprintf(result, "END\n");
+        fclose(result);
+        printf("Result saved in %s \n", filename);
+    }
+    int status = 0;
+    if (opt->write_summary) {
+        strcpy(filename, RESULT_DIR);
+        strcat(filename, task_id);
+        strcat(filename, "_summary.bin");
+        status = summary_write(&summary, filename);
+    }
+    summary_free(&summary);
+    if (checkpointing && !status) remove(ck.filename);
+    telemetry_finish(status);
+    return status;
+}
+
+// single run in parallel time slices, raster only (no traces)
+int parareal_single(double W_GPe, double W_Str, double tau, const char* HCN,
+    double GPe_stim, double Str_stim, const char* task_id, double g_HCN, double I_app, const RunOptions *opt) {
+    State s = setup_state(W_GPe, W_Str, tau, HCN, g_HCN, I_app);
+    const CellParams params = params_from_state(&s);
+    CellState cell = cell_from_state(&s);
+    PararealReport report;
+    Spikes spikes = parareal_simulation(&params, &cell, opt->duration, GPe_stim, Str_stim, &opt->parareal_opt, &report);
+    printf("#1: I_app: %f, g_HCN_%s: %f, %d spikes \n", I_app, HCN, g_HCN, spikes.num_spikes);
+    if (report.cycle != SHOOT_TONIC) {
+        printf("Parareal: no tonic limit cycle (%s), coarse steps of %d x dt \n", SHOOT_STATUS_NAMES[report.cycle],
+               opt->parareal_opt.coarse_ratio);
+    } else {
+        printf("Parareal: phase coarse propagator on the %f ms limit cycle \n", report.period);
+    }
+    printf("Parareal: %d slices on %d threads, %d iterations, %s (last change %g mV), %f s\n", report.num_slices,
+           report.num_threads, report.iterations,
+           report.iterations == report.num_slices ? "exact (no slice left to correct)" :
+           report.converged ? "converged" : "NOT converged",
+           report.max_change, report.wall_time);
+
+    if (opt->parareal_check) {
+        CellState serial = cell_from_state(&s);
+        double start = wall_time();
+        Spikes ref = cell_spike_simulation(&params, &serial, opt->duration, GPe_stim, Str_stim);
+        double serial_time = wall_time() - start;
+        int num_matched = ref.num_spikes < spikes.num_spikes ? ref.num_spikes : spikes.num_spikes;
+        double max_error = 0;
+        for (int i = 0; i < num_matched; i++) {
+            max_error = fmax(max_error, fabs(ref.spike_times[i] - spikes.spike_times[i]));
+        }
+        printf("Parareal vs serial: speedup %.2f (%f s serial), spikes %d vs %d, max spike-time error %g ms, "
+               "final V_s error %g mV\n", serial_time / report.wall_time, serial_time, spikes.num_spikes,
+               ref.num_spikes, max_error, fabs(cell.V_s - serial.V_s));
+        free(ref.spike_times);
+    }
+
     char filename[512];
     strcpy(filename, RESULT_DIR);
     strcat(filename, task_id);
     strcat(filename, ".csv");
-    printf("Result writing in %s \n", filename);
     FILE *result = fopen(filename, "w");
     if (result == NULL) {
         perror("Failed to open file");
-        return 1;  // Or handle the error as needed
-    }
-    for (int j = 0; j < num_sim; j++) {
-        State s = init_state();
-        s.W_GPe = W_GPe;
-        s.tau_GABA_som = tau;
-        s.W_Str = W_Str;
-        s.tau_GABA_den = tau;
-        s.I_app = I[j];
-        if (strcmp(HCN, "som") == 0) {
-            s.g_HCN_som = g_HCN[j];
-        } else if (strcmp(HCN, "den") == 0) {
-            s.g_HCN_den = g_HCN[j];
-        }
-        Spikes spikes = spike_simulation(&s, SIM_DURATION_total, GPe_stim, Str_stim);
-        printf("#%d: I_app: %f, g_HCN_%s: %f, %d spikes \n", j, I[j], HCN, g_HCN[j], spikes.num_spikes);
-        fprintf(result, "%d,", spikes.num_spikes);
-        for (int i = 0; i < spikes.num_spikes; i++) {
-            fprintf(result, "%f,", spikes.spike_times[i]);
-        }
         free(spikes.spike_times);
+        return 1;
     }
+    write_raster(result, &spikes);
     fprintf(result, "END\n");
     fclose(result);
     printf("Result saved in %s \n", filename);
+    free(spikes.spike_times);
+    return 0;
+}
+
+// spike times with their sensitivities to the SENS_PARAM_NAMES parameters, and the rate sensitivities of step1
+int sensitivity_single(const State *s, const char *task_id, double GPe_stim, double Str_stim) {
+    const CellParams params = params_from_state(s);
+    CellState cell = cell_from_state(s);
+    SensRate rate = sens_firing_rate(&params, &cell);
+    printf("Rate %f Hz, ISI rate %f Hz, d(ISI rate)/d(parameter):", rate.rate, rate.isi_rate);
+    for (int i = 0; i < SENS_NUM_PARAMS; i++) printf(" %s %g", SENS_PARAM_NAMES[i], rate.d_isi_rate[i]);
+    printf("\n");
+
+    SensSpikes spikes = sens_spike_simulation(&params, &cell, SIM_DURATION_total, GPe_stim, Str_stim);
+    char filename[512];
+    strcpy(filename, RESULT_DIR);
+    strcat(filename, task_id);
+    strcat(filename, "_sensitivity.csv");
+    FILE *file = fopen(filename, "w");
+    if (file == NULL) {
+        perror("Failed to open file");
+        sens_spikes_free(&spikes);
+        return 1;
+    }
+    fprintf(file, "spike_time,crossing_time");
+    for (int i = 0; i < SENS_NUM_PARAMS; i++) fprintf(file, ",d_%s", SENS_PARAM_NAMES[i]);
+    fprintf(file, "\n");
+    for (int j = 0; j < spikes.num_spikes; j++) {
+        fprintf(file, "%f,%.9g", spikes.spike_times[j], spikes.crossing_times[j]);
+        for (int i = 0; i < SENS_NUM_PARAMS; i++) fprintf(file, ",%.9g", spikes.d_spike_times[j * SENS_NUM_PARAMS + i]);
+        fprintf(file, "\n");
+    }
+    fclose(file);
+    printf("Sensitivities saved in %s \n", filename);
+    sens_spikes_free(&spikes);
     return 0;
 }
 
 int single_simulation(double W_GPe, double W_Str, double tau, const char* HCN,
-    double GPe_stim, double Str_stim, const char* task_id, double g_HCN, double I_app) {
+    double GPe_stim, double Str_stim, const char* task_id, double g_HCN, double I_app, const RunOptions *opt) {
+    if (opt->num_check > 0) {
+        State cell = setup_state(W_GPe, W_Str, tau, HCN, g_HCN, I_app);
+        if (check_against_reference(&cell, 1, SIM_DURATION_total, GPe_stim, Str_stim, opt->check_tol) > 0) return 1;
+    }
+    if (opt->sensitivity) {
+        State cell = setup_state(W_GPe, W_Str, tau, HCN, g_HCN, I_app);
+        if (sensitivity_single(&cell, task_id, GPe_stim, Str_stim)) return 1;
+    }
+
     // simulate for all possible conductances
     char filename[512];
     strcpy(filename, RESULT_DIR);
@@ -251,23 +468,10 @@ int single_simulation(double W_GPe, double W_Str, double tau, const char* HCN,
         return 1;  // Or handle the error as needed
     }
 
-    State s = init_state();
-    s.W_GPe = W_GPe;
-    s.tau_GABA_som = tau;
-    s.W_Str = W_Str;
-    s.tau_GABA_den = tau;
-    s.I_app = I_app;
-    if (strcmp(HCN, "som") == 0) {
-        s.g_HCN_som = g_HCN;
-    } else if (strcmp(HCN, "den") == 0) {
-        s.g_HCN_den = g_HCN;
-    }
+    State s = setup_state(W_GPe, W_Str, tau, HCN, g_HCN, I_app);
     Spikes spikes = full_simulation(&s, SIM_DURATION_total, GPe_stim, Str_stim);
     printf("#1: I_app: %f, g_HCN_%s: %f, %d spikes \n", I_app, HCN, g_HCN, spikes.num_spikes);
-    fprintf(result, "%d,", spikes.num_spikes);
-    for (int i = 0; i < spikes.num_spikes; i++) {
-        fprintf(result, "%f,", spikes.spike_times[i]);
-    }
+    write_raster(result, &spikes);
     free(spikes.spike_times);
 
     fprintf(result, "END\n");
@@ -389,9 +593,22 @@ int single_simulation(double W_GPe, double W_Str, double tau, const char* HCN,
 int main(int argc, char *argv[]) {
     struct timeval start_time, stop_time, elapsed_time;
     gettimeofday(&start_time, NULL);
+    INSTR_INIT();
 
-    char HCN_choice[8] = "zero", task_id[128] = "test/mitten";
+    char HCN_choice[8] = "zero", task_id[128] = "test/mitten", isa[16] = "auto";
     int num_sim = NUM_samples;
+    char morphology_file[512] = "";
+    RunOptions opt = {
+        .check_tol = {.max_spike_diff = 0, .max_rms = CONFIG_dt},
+        .write_raster = 1,
+        .write_summary = 1,
+        .ensemble_quantiles = 1,
+        .parareal_opt = {.coarse_ratio = PARAREAL_coarse_ratio, .tol = PARAREAL_tol},
+        .duration = SIM_DURATION_total,
+        .prc_duration = PRC_fork_duration,
+        .verbose = 1,
+        .status = "auto",
+    };
     double W_GPe = 0, W_Str = 0, tau = 0;
     double GPe_stim = 1000, Str_stim = 1000;
     double g_HCN = DEFAULT_g_HCN;
@@ -422,6 +639,57 @@ int main(int argc, char *argv[]) {
         } else if (strcmp(argv[i], "-o") == 0) {
             strncpy(task_id, argv[i + 1], sizeof(task_id) - 1);
             task_id[sizeof(task_id) - 1] = '\0';
+        } else if (strcmp(argv[i], "-check_against_reference") == 0) {
+            opt.num_check = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-check_tol_spikes") == 0) {
+            opt.check_tol.max_spike_diff = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-check_tol_rms") == 0) {
+            opt.check_tol.max_rms = strtod(argv[i + 1], NULL);
+        } else if (strcmp(argv[i], "-raster") == 0) {
+            opt.write_raster = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-summary") == 0) {
+            opt.write_summary = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-ensemble") == 0) {
+            opt.ensemble = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-quantiles") == 0) {
+            opt.ensemble_quantiles = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-morphology") == 0) {
+            strncpy(morphology_file, argv[i + 1], sizeof(morphology_file) - 1);
+            morphology_file[sizeof(morphology_file) - 1] = '\0';
+        } else if (strcmp(argv[i], "-theta") == 0) {
+            opt.theta = strtod(argv[i + 1], NULL);
+        } else if (strcmp(argv[i], "-parareal") == 0) {
+            opt.parareal = 1;
+            opt.parareal_opt.num_slices = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-parareal_ratio") == 0) {
+            opt.parareal_opt.coarse_ratio = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-parareal_iter") == 0) {
+            opt.parareal_opt.max_iterations = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-parareal_tol") == 0) {
+            opt.parareal_opt.tol = strtod(argv[i + 1], NULL);
+        } else if (strcmp(argv[i], "-parareal_check") == 0) {
+            opt.parareal_check = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-sensitivity") == 0) {
+            opt.sensitivity = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-duration") == 0) {
+            opt.duration = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-prc") == 0) {
+            opt.prc = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-prc_duration") == 0) {
+            opt.prc_duration = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-checkpoint_sim") == 0) {
+            opt.checkpoint_sim = strtod(argv[i + 1], NULL);
+        } else if (strcmp(argv[i], "-checkpoint_wall") == 0) {
+            opt.checkpoint_wall = strtod(argv[i + 1], NULL);
+        } else if (strcmp(argv[i], "-resume") == 0) {
+            opt.resume = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-verbose") == 0) {
+            opt.verbose = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-status") == 0) {
+            opt.status = argv[i + 1];
+        } else if (strcmp(argv[i], "-isa") == 0) {
+            strncpy(isa, argv[i + 1], sizeof(isa) - 1);
+            isa[sizeof(isa) - 1] = '\0';
         } else {
             printf("Unimplemented option: %s\n", argv[i]);
             return 1;
@@ -439,6 +707,28 @@ int main(int argc, char *argv[]) {
     printf("NUM_simulation: %d\n", num_sim);
     printf("HCN_choice: %s\n", HCN_choice);
     printf("task_id: %s\n", task_id);
+    if (select_kernel(isa)) return 1;
+    if ((opt.checkpoint_sim > 0 || opt.checkpoint_wall > 0 || opt.resume) &&
+        (num_sim == 1 || opt.ensemble || opt.prc || morphology_file[0] != '\0')) {
+        // a checkpoint holds one cell State and its spikes: no traces, ensembles, PRC cycles or dendritic trees
+        printf("Checkpoints are only supported for batch runs without -ensemble, -prc or -morphology\n");
+        return 1;
+    }
+    if (opt.sensitivity && (num_sim != 1 || opt.prc || opt.parareal)) {
+        printf("-sensitivity is only supported for single runs (-num 1) without -prc or -parareal\n");
+        return 1;
+    }
+    Morphology morphology;
+    if (morphology_file[0] != '\0') {
+        // the N-compartment dendrite replaces the kernel in batch runs with rasters/summaries
+        if (num_sim == 1 || opt.ensemble || opt.prc) {
+            printf("-morphology is only supported for batch runs without -ensemble or -prc\n");
+            return 1;
+        }
+        if (morphology_read(morphology_file, &morphology)) return 1;
+        printf("theta: %f\n", opt.theta);
+        opt.morphology = &morphology;
+    }
 
     if (num_sim == 1) {
         printf("g_HCN: %f\n", g_HCN);
@@ -458,14 +748,28 @@ int main(int argc, char *argv[]) {
             }
         }
         strcat(task_id, "/single");
-        single_simulation(W_GPe, W_Str, tau, HCN_choice, GPe_stim, Str_stim, task_id, g_HCN, I_app);
+        if (opt.prc) {
+            if (prc_batch(W_GPe, W_Str, tau, HCN_choice, GPe_stim, Str_stim, task_id, 1, &g_HCN, &I_app, &opt)) {
+                return 1;
+            }
+        } else if (opt.parareal) {
+            if (parareal_single(W_GPe, W_Str, tau, HCN_choice, GPe_stim, Str_stim, task_id, g_HCN, I_app, &opt)) {
+                return 1;
+            }
+        } else if (single_simulation(W_GPe, W_Str, tau, HCN_choice, GPe_stim, Str_stim, task_id, g_HCN, I_app,
+                                     &opt)) {
+            return 1;
+        }
         printf("single finishes \n");
     } else {
         printf("\n");
         printf("batch simulation begins \n");
-        batch_simulation(W_GPe, W_Str, tau, HCN_choice, GPe_stim, Str_stim, task_id, num_sim);
+        if (batch_simulation(W_GPe, W_Str, tau, HCN_choice, GPe_stim, Str_stim, task_id, num_sim, &opt)) {
+            return 1;
+        }
         printf("batch finishes \n");
     }
+    if (opt.morphology) morphology_free(&morphology);
 
     gettimeofday(&stop_time, NULL);
     timersub(&stop_time, &start_time, &elapsed_time);
@@ -473,5 +777,9 @@ int main(int argc, char *argv[]) {
     printf("############# Total time was %f seconds. \n", elapsed_time.tv_sec + elapsed_time.tv_usec * 1e-6);
     printf("##########################\n");
     printf("\n");
+
+    char report_filename[512];
+    snprintf(report_filename, sizeof(report_filename), "%s%s_instrument.json", RESULT_DIR, task_id);
+    INSTR_REPORT(report_filename);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,57 @@
+import numpy as np
+import os.path as path
+from utils import xlsx_reader
+
+# Fit targets of step4_fit_params.c from the OnePulse.xlsx recordings, in the conventions of visualization.py:
+# - psth: normalized firing rate (window counts / baseline rate over (100, 1000) ms) at 800, 810, ..., 1190 ms,
+#   averaged over cells (plot_firing_rate())
+# - cdf: fraction of trials whose first spike at or after the recovery start (1004 ms for the recordings, the
+#   stimulation artifact) is before t, at t = 1000, 1001, ..., 1050 ms (plot_time2recover())
+TARGET_VERSION = 1
+STIM_TIME = 1000  # ms
+RECOVERY_START = 1004  # ms, as plot_time2recover() for "exp"
+BASELINE_RANGE = (100, 1000)  # ms
+PSTH_START, PSTH_STEP, PSTH_NUM, PSTH_WINDOW = 800, 10, 40, 20  # ms, STEP_SIZE / WINDOW_SIZE of visualization.py
+CDF_START, CDF_STEP, CDF_NUM = 1000, 1, 51  # ms
+
+
+def recording_features(cells_of_trials):
+    ts = PSTH_START + PSTH_STEP * np.arange(PSTH_NUM)
+    all_fr = []
+    first_spikes = []
+    for trials in cells_of_trials.values():
+        spike_series = np.concatenate(trials)
+        baseline_fr = np.sum((spike_series >= BASELINE_RANGE[0]) &
+                             (spike_series < BASELINE_RANGE[1])) / (BASELINE_RANGE[1] - BASELINE_RANGE[0])
+        if baseline_fr > 0:
+            counts = [np.sum((spike_series >= t - PSTH_WINDOW / 2) & (spike_series < t + PSTH_WINDOW / 2)) for t in ts]
+            all_fr.append(np.array(counts) / PSTH_WINDOW / baseline_fr)
+        for trial in trials:
+            after = trial[trial >= RECOVERY_START]
+            first_spikes.append(np.min(after) if after.size > 0 else np.inf)
+    psth = np.mean(np.stack(all_fr, axis=0), axis=0)
+    first_spikes = np.array(first_spikes)
+    cdf = np.array([np.mean(first_spikes <= CDF_START + CDF_STEP * k) for k in range(CDF_NUM)])
+    return psth, cdf, len(cells_of_trials)
+
+
+def write_target(filename, cells_of_trials):
+    """layout (all float64):
+    version, stim_time, num_cells, baseline_start, baseline_end, psth_start, psth_step, psth_window, num_psth,
+    cdf_start, cdf_step, num_cdf, psth[num_psth], cdf[num_cdf]"""
+    psth, cdf, num_cells = recording_features(cells_of_trials)
+    header = [TARGET_VERSION, STIM_TIME, num_cells, *BASELINE_RANGE, PSTH_START, PSTH_STEP, PSTH_WINDOW, PSTH_NUM,
+              CDF_START, CDF_STEP, CDF_NUM]
+    np.concatenate((header, psth, cdf)).astype(np.float64).tofile(filename)
+    print(f"{filename}: {num_cells} cells, min norm. FR {np.min(psth):.3f}, "
+          f"recovered within {CDF_NUM - 1} ms {cdf[-1]:.3f}")
+
+
+def main():
+    for sheet_name, stim_name in (("GPe naive", "GPe"), ("D1 naive", "Str")):
+        cells_of_trials = xlsx_reader(path.join('bio_data', 'OnePulse.xlsx'), sheet_name)
+        write_target(path.join('intermediate_result', f'fit_target_{stim_name}.bin'), cells_of_trials)
+
+
+if __name__ == "__main__":
+    main()
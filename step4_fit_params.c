@@ -0,0 +1,348 @@
+// step4_fit_params.c
+// Fit of selected State parameters (synaptic weights, GABA time constants, HCN gate, ...) to the OnePulse.xlsx
+// recordings: differential evolution (DE/rand/1/bin) on the PSTH / time-to-recover loss of fitting.h, run on the
+// population of selected I_app / g_HCN pairs. All candidates of a generation are evaluated together in parallel
+// (candidates x cells, -fopenmp), and the population is checkpointed after every generation, so an interrupted fit
+// continues with -resume 1 exactly as if it had not stopped.
+// The targets are written by step4_export_fit_targets.py.
+#include "simulation.h"
+#include "fitting.h"
+#include "checkpoint.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define FIT_CHECKPOINT_VERSION 2
+#define FIT_MAX_CELLS 1024  // step3 reads at most this many cells
+
+typedef struct {
+    int num_params;
+    int pop_size;
+    int generation;
+    long num_evaluations;
+    uint64_t rng;
+    double *u;       // normalized coordinates in [0, 1], pop_size x num_params
+    double *loss;
+} Population;
+
+// losses of `num` candidates given in normalized coordinates
+static void evaluate(FitProblem *problem, const double *u, int num, double *loss) {
+    double *values = (double *)malloc((size_t)num * problem->num_params * sizeof(double));
+    for (int n = 0; n < num; n++) {
+        for (int k = 0; k < problem->num_params; k++) {
+            values[n * problem->num_params + k] = fit_param_value(&problem->params[k], u[n * problem->num_params + k]);
+        }
+    }
+    fit_evaluate(problem, values, num, loss);
+    free(values);
+}
+
+// DE/rand/1/bin trial vectors; a component leaving [0, 1] is put between the base vector and that bound
+static void make_trials(Population *pop, double weight, double crossover, double *trials) {
+    int dim = pop->num_params, np = pop->pop_size;
+    for (int i = 0; i < np; i++) {
+        int r0, r1, r2;
+        do r0 = (int)(splitmix_uniform(&pop->rng) * np); while (r0 == i);
+        do r1 = (int)(splitmix_uniform(&pop->rng) * np); while (r1 == i || r1 == r0);
+        do r2 = (int)(splitmix_uniform(&pop->rng) * np); while (r2 == i || r2 == r0 || r2 == r1);
+        int k_forced = (int)(splitmix_uniform(&pop->rng) * dim);
+        for (int k = 0; k < dim; k++) {
+            double base = pop->u[r0 * dim + k];
+            double v = base + weight * (pop->u[r1 * dim + k] - pop->u[r2 * dim + k]);
+            if (v < 0) v = base * splitmix_uniform(&pop->rng);
+            if (v > 1) v = base + (1 - base) * splitmix_uniform(&pop->rng);
+            int take = k == k_forced || splitmix_uniform(&pop->rng) < crossover;
+            trials[i * dim + k] = take ? v : pop->u[i * dim + k];
+        }
+    }
+}
+
+static int best_index(const Population *pop) {
+    int best = 0;
+    for (int i = 1; i < pop->pop_size; i++) {
+        if (pop->loss[i] < pop->loss[best]) best = i;
+    }
+    return best;
+}
+
+
+// ###################################################################
+// ############              Checkpoint                 ##############
+// ###################################################################
+
+// everything the losses and the trial vectors depend on besides the population: kernel, cells (every field of
+// params.h, so the model and the I_app / g_HCN pairs), targets, DE settings
+uint64_t fit_fingerprint(const FitProblem *problem, const char *HCN, double weight, double crossover) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    hash = checkpoint_hash(kernel_name, strlen(kernel_name), hash);
+    hash = checkpoint_hash(HCN, strlen(HCN), hash);
+    double setup[4] = {problem->num_cells, problem->cdf_weight, weight, crossover};
+    hash = checkpoint_hash(setup, sizeof(setup), hash);
+    for (int j = 0; j < problem->num_cells; j++) hash = checkpoint_hash_state(&problem->cells[j], hash);
+    // the targets are zeroed before they are read, padding included
+    return checkpoint_hash(problem->targets, sizeof(problem->targets), hash);
+}
+
+// layout (all float64):
+//   version, generation, num_params, pop_size, num_evaluations, rng >> 32, rng & 0xffffffff,
+//   fingerprint >> 32, fingerprint & 0xffffffff,
+//   [low, high, log_scale] per parameter, u[pop_size * num_params], loss[pop_size]
+// written with atomic_write(), so a checkpoint is never left half written
+int fit_checkpoint_write(const Population *pop, const FitProblem *problem, uint64_t fingerprint, const char *filename) {
+    int dim = pop->num_params;
+    size_t size = 9 + 3 * dim + (size_t)pop->pop_size * (dim + 1);
+    double *data = (double *)malloc(size * sizeof(double));
+    double header[9] = {FIT_CHECKPOINT_VERSION, pop->generation, dim, pop->pop_size, pop->num_evaluations,
+                        (double)(pop->rng >> 32), (double)(pop->rng & 0xffffffffULL), (double)(fingerprint >> 32),
+                        (double)(fingerprint & 0xffffffffULL)};
+    memcpy(data, header, sizeof(header));
+    for (int k = 0; k < dim; k++) {
+        data[9 + 3 * k] = problem->params[k].low;
+        data[10 + 3 * k] = problem->params[k].high;
+        data[11 + 3 * k] = problem->params[k].log_scale;
+    }
+    memcpy(data + 9 + 3 * dim, pop->u, (size_t)pop->pop_size * dim * sizeof(double));
+    memcpy(data + 9 + 3 * dim + pop->pop_size * dim, pop->loss, pop->pop_size * sizeof(double));
+
+    int status = atomic_write(filename, data, size);
+    if (status) perror("Error writing checkpoint");
+    INSTR_COUNT(INSTR_BYTES_WRITTEN, size * sizeof(double));
+    free(data);
+    return status;
+}
+
+// the population of a checkpoint written with the same parameters, population size and setup; 0 on success
+int fit_checkpoint_read(Population *pop, const FitProblem *problem, uint64_t fingerprint, const char *filename) {
+    int dim = pop->num_params;
+    size_t size = 9 + 3 * dim + (size_t)pop->pop_size * (dim + 1);
+    double *data = (double *)malloc(size * sizeof(double));
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        perror("Error opening checkpoint");
+        free(data);
+        return 1;
+    }
+    int status = fread(data, sizeof(double), size, file) != size || fgetc(file) != EOF ||
+                 data[0] != FIT_CHECKPOINT_VERSION || data[2] != dim || data[3] != pop->pop_size;
+    fclose(file);
+    for (int k = 0; k < dim && !status; k++) {
+        status = data[9 + 3 * k] != problem->params[k].low || data[10 + 3 * k] != problem->params[k].high ||
+                 data[11 + 3 * k] != problem->params[k].log_scale;
+    }
+    if (status) {
+        printf("Fit: %s does not match the fitted parameters / population size\n", filename);
+        free(data);
+        return 1;
+    }
+    if ((((uint64_t)data[7] << 32) | (uint64_t)data[8]) != fingerprint) {
+        printf("Fit: %s was written for another setup (HCN, -num, -cdf_weight, -F, -CR, targets, model or kernel)\n",
+               filename);
+        free(data);
+        return 1;
+    }
+    pop->generation = (int)data[1];
+    pop->num_evaluations = (long)data[4];
+    pop->rng = ((uint64_t)data[5] << 32) | (uint64_t)data[6];
+    memcpy(pop->u, data + 9 + 3 * dim, (size_t)pop->pop_size * dim * sizeof(double));
+    memcpy(pop->loss, data + 9 + 3 * dim + pop->pop_size * dim, pop->pop_size * sizeof(double));
+    free(data);
+    return 0;
+}
+
+// generation, evaluations, best and mean loss, best parameter values
+void history_append(const Population *pop, const FitProblem *problem, const char *filename, int header) {
+    FILE *file = fopen(filename, header ? "w" : "a");
+    if (file == NULL) {
+        perror("Error opening fit history");
+        return;
+    }
+    int dim = pop->num_params, best = best_index(pop);
+    if (header) {
+        fprintf(file, "generation,evaluations,best_loss,mean_loss");
+        for (int k = 0; k < dim; k++) fprintf(file, ",%s", problem->params[k].name);
+        fprintf(file, "\n");
+    }
+    double mean = 0;
+    for (int i = 0; i < pop->pop_size; i++) mean += pop->loss[i] / pop->pop_size;
+    fprintf(file, "%d,%ld,%g,%g", pop->generation, pop->num_evaluations, pop->loss[best], mean);
+    for (int k = 0; k < dim; k++) {
+        fprintf(file, ",%.8g", fit_param_value(&problem->params[k], pop->u[best * dim + k]));
+    }
+    fprintf(file, "\n");
+    fclose(file);
+}
+
+// cells evenly sampled from the selected I_app / g_HCN pairs of step2
+int load_cells(const char *HCN, int num, double *I, double *g_HCN) {
+    char filename[512];
+    double I_all[FIT_MAX_CELLS], g_all[FIT_MAX_CELLS];
+    size_t N0 = 0, N1 = 0;
+    snprintf(filename, sizeof(filename), SAVE_DIR "selected_I_HCN_%s.bin", HCN);
+    read_binary_file(filename, I_all, &N0);
+    snprintf(filename, sizeof(filename), SAVE_DIR "selected_g_HCN_%s.bin", HCN);
+    read_binary_file(filename, g_all, &N1);
+    if (N0 == 0 || N0 != N1) {
+        printf("Fit: no selected I_app / g_HCN pairs for HCN %s\n", HCN);
+        return 0;
+    }
+    if (num > (int)N0) num = (int)N0;
+    for (int k = 0; k < num; k++) {
+        I[k] = I_all[(long)k * N0 / num];
+        g_HCN[k] = g_all[(long)k * N0 / num];
+    }
+    return num;
+}
+
+int main(int argc, char *argv[]) {
+    struct timeval start_time, stop_time, elapsed_time;
+    gettimeofday(&start_time, NULL);
+    INSTR_INIT();
+
+    char isa[16] = "auto", HCN[8] = "den", output_dir[512] = SAVE_DIR;
+    char fit_spec[1024] = "W_GPe,W_Str,tau_GABA_som,tau_GABA_den";
+    char target_files[FIT_NUM_CONDITIONS][512] = {SAVE_DIR "fit_target_GPe.bin", SAVE_DIR "fit_target_Str.bin"};
+    int num_cells = 20, pop_size = 0, num_generations = 40, resume = 0;
+    double weight = 0.7, crossover = 0.9, cdf_weight = 1;
+    unsigned long seed = 0;
+    for (int i = 1; i + 1 < argc; i+=2) {
+        if (strcmp(argv[i], "-fit") == 0) {
+            snprintf(fit_spec, sizeof(fit_spec), "%s", argv[i + 1]);
+        } else if (strcmp(argv[i], "-HCN") == 0) {
+            snprintf(HCN, sizeof(HCN), "%s", argv[i + 1]);
+        } else if (strcmp(argv[i], "-num") == 0) {
+            num_cells = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-pop") == 0) {
+            pop_size = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-generations") == 0) {
+            num_generations = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-F") == 0) {
+            weight = strtod(argv[i + 1], NULL);
+        } else if (strcmp(argv[i], "-CR") == 0) {
+            crossover = strtod(argv[i + 1], NULL);
+        } else if (strcmp(argv[i], "-cdf_weight") == 0) {
+            cdf_weight = strtod(argv[i + 1], NULL);
+        } else if (strcmp(argv[i], "-target_GPe") == 0 || strcmp(argv[i], "-target_Str") == 0) {
+            // "none" leaves the condition out of the loss
+            int condition = strcmp(argv[i], "-target_Str") == 0;
+            snprintf(target_files[condition], sizeof(target_files[condition]), "%s",
+                     strcmp(argv[i + 1], "none") == 0 ? "" : argv[i + 1]);
+        } else if (strcmp(argv[i], "-seed") == 0) {
+            seed = strtoul(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-resume") == 0) {
+            resume = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-o") == 0) {
+            snprintf(output_dir, sizeof(output_dir), "%s", argv[i + 1]);
+        } else if (strcmp(argv[i], "-isa") == 0) {
+            strncpy(isa, argv[i + 1], sizeof(isa) - 1);
+            isa[sizeof(isa) - 1] = '\0';
+        } else {
+            printf("Unimplemented option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (select_kernel(isa)) return 1;
+
+    // fitted parameters, comma separated "name" or "name:low:high"
+    FitProblem *problem = (FitProblem *)calloc(1, sizeof(FitProblem));
+    problem->cdf_weight = cdf_weight;
+    for (char *spec = strtok(fit_spec, ","); spec != NULL; spec = strtok(NULL, ",")) {
+        if (problem->num_params == FIT_MAX_PARAMS) {
+            printf("Fit: at most %d parameters\n", FIT_MAX_PARAMS);
+            return 1;
+        }
+        if (fit_param_parse(&problem->params[problem->num_params++], spec)) return 1;
+    }
+    int num_targets = 0;
+    for (int k = 0; k < FIT_NUM_CONDITIONS; k++) {
+        if (fit_target_read(&problem->targets[k], target_files[k])) return 1;
+        num_targets += problem->targets[k].present;
+    }
+    if (num_targets == 0) {
+        printf("Fit: no targets, run step4_export_fit_targets.py first\n");
+        return 1;
+    }
+    // every condition is simulated with one stimulation time (fit_setup())
+    if (problem->targets[0].present && problem->targets[1].present &&
+        problem->targets[0].stim_time != problem->targets[1].stim_time) {
+        printf("Fit: the targets have different stimulation times (%g and %g ms)\n", problem->targets[0].stim_time,
+               problem->targets[1].stim_time);
+        return 1;
+    }
+    double I[FIT_MAX_CELLS], g_HCN[FIT_MAX_CELLS];
+    num_cells = load_cells(HCN, num_cells < FIT_MAX_CELLS ? num_cells : FIT_MAX_CELLS, I, g_HCN);
+    if (num_cells < 1) return 1;
+    fit_setup(problem, I, g_HCN, HCN, num_cells);
+    uint64_t fingerprint = fit_fingerprint(problem, HCN, weight, crossover);
+
+    int dim = problem->num_params;
+    if (pop_size <= 0) pop_size = 10 * dim;
+    if (pop_size < 4) pop_size = 4;
+    printf("Step4 fit: %d parameter(s), population %d, %d cells, HCN %s, %s \n", dim, pop_size, num_cells, HCN,
+           problem->settled ? "responses only (parameters act after the stimulation)" : "full runs");
+
+    Population pop = {dim, pop_size, 0, 0, seed, NULL, NULL};
+    pop.u = (double *)malloc((size_t)pop_size * dim * sizeof(double));
+    pop.loss = (double *)malloc(pop_size * sizeof(double));
+    double *trials = (double *)malloc((size_t)pop_size * dim * sizeof(double));
+    double *trial_loss = (double *)malloc(pop_size * sizeof(double));
+    char checkpoint_filename[600], history_filename[600], best_filename[600];
+    snprintf(checkpoint_filename, sizeof(checkpoint_filename), "%sfit_checkpoint.bin", output_dir);
+    snprintf(history_filename, sizeof(history_filename), "%sfit_history.csv", output_dir);
+    snprintf(best_filename, sizeof(best_filename), "%sfit_best.txt", output_dir);
+
+    if (resume) {
+        if (fit_checkpoint_read(&pop, problem, fingerprint, checkpoint_filename)) return 1;
+        printf("Resumed from %s at generation %d \n", checkpoint_filename, pop.generation);
+    } else {
+        for (int i = 0; i < pop_size * dim; i++) pop.u[i] = splitmix_uniform(&pop.rng);
+        evaluate(problem, pop.u, pop_size, pop.loss);
+        pop.num_evaluations = pop_size;
+        history_append(&pop, problem, history_filename, 1);
+        if (fit_checkpoint_write(&pop, problem, fingerprint, checkpoint_filename)) return 1;
+    }
+
+    while (pop.generation < num_generations) {
+        double generation_start = wall_time();
+        long simulated_ms = problem->simulated_ms;
+        make_trials(&pop, weight, crossover, trials);
+        evaluate(problem, trials, pop_size, trial_loss);
+        for (int i = 0; i < pop_size; i++) {
+            if (trial_loss[i] <= pop.loss[i]) {
+                memcpy(pop.u + i * dim, trials + i * dim, dim * sizeof(double));
+                pop.loss[i] = trial_loss[i];
+            }
+        }
+        pop.generation++;
+        pop.num_evaluations += pop_size;
+        history_append(&pop, problem, history_filename, 0);
+        if (fit_checkpoint_write(&pop, problem, fingerprint, checkpoint_filename)) return 1;
+        double seconds = wall_time() - generation_start;
+        printf("Generation %d: best loss %g, %.1f candidates/s, %.0f simulated ms/s \n", pop.generation,
+               pop.loss[best_index(&pop)], pop_size / seconds, (problem->simulated_ms - simulated_ms) / seconds);
+    }
+
+    // best parameters as "name value" lines
+    int best = best_index(&pop);
+    FILE *file = fopen(best_filename, "w");
+    printf("Best loss %g after %ld evaluations: \n", pop.loss[best], pop.num_evaluations);
+    for (int k = 0; k < dim; k++) {
+        double value = fit_param_value(&problem->params[k], pop.u[best * dim + k]);
+        printf("  %s %.8g \n", problem->params[k].name, value);
+        if (file) fprintf(file, "%s %.8g\n", problem->params[k].name, value);
+    }
+    if (file) fclose(file);
+    printf("Saved %s, %s and %s \n", best_filename, history_filename, checkpoint_filename);
+    free(pop.u);
+    free(pop.loss);
+    free(trials);
+    free(trial_loss);
+    fit_free(problem);
+    free(problem);
+
+    gettimeofday(&stop_time, NULL);
+    timersub(&stop_time, &start_time, &elapsed_time);
+    printf("Running time: %f seconds.\n", elapsed_time.tv_sec + elapsed_time.tv_usec * 1e-6);
+    INSTR_REPORT(SAVE_DIR "step4_instrument.json");
+    return 0;
+}
@@ -0,0 +1,377 @@
+// step4_sobol_indices.c
+// Global sensitivity of the pause response of one cell: Saltelli design over a box of State parameters (sobol.h),
+// three scalar outputs per evaluation
+//   baseline_rate    spikes in [SUMMARY_baseline_start, SUMMARY_baseline_end) in Hz
+//   pause_duration   first spike at or after the stimulation minus the stimulation time in ms, censored to
+//                    SOBOL_response_window
+//   rebound_rate     spikes in the SOBOL_rebound_window ms from that first spike in Hz (0 without one)
+// and first-order / total Sobol' indices with bootstrap confidence intervals for each of them.
+// Evaluations run in parallel (-fopenmp) and are cached in <outdir>sobol_cache.bin keyed on the sample point, so a
+// rerun with a larger -N (the design is nested), more bootstrap resamples or after an interruption only simulates
+// the new points. The cache is tied to the setup (cell, stimulation, parameter box, kernel) and restarted if it
+// changed. As in the fit, parameters that act from the stimulation on only share one settled state per run.
+#include "simulation.h"
+#include "fitting.h"
+#include "sobol.h"
+#include "checkpoint.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define SOBOL_CACHE_VERSION 1
+#define SOBOL_NUM_OUTPUTS 3
+static const char *SOBOL_OUTPUT_NAMES[SOBOL_NUM_OUTPUTS] = {"baseline_rate", "pause_duration", "rebound_rate"};
+
+typedef struct {
+    State base;          // the cell with the fixed parameters
+    int num_params;
+    FitParam params[SOBOL_MAX_DIM / 2];
+    int condition;       // 0 GPe, 1 Str
+    double stim_time;    // ms
+    int stim_step;
+    int num_steps;
+    CellState settled;   // base cell at the stimulation, when every parameter acts after it
+    Spikes settled_spikes;
+    int use_settled;
+} SobolProblem;
+
+typedef struct {
+    int dim;
+    long num;
+    long capacity;
+    double *records;     // num x (dim + SOBOL_NUM_OUTPUTS): normalized point, outputs
+    long *table;         // open addressing, record index or -1
+    long table_size;
+} Cache;
+
+
+// ###################################################################
+// ############                 Model                   ##############
+// ###################################################################
+
+void sobol_outputs(const SobolProblem *problem, const double *spike_times, int num_spikes, double *out) {
+    double baseline = 0, first = INFINITY;
+    for (int i = 0; i < num_spikes; i++) {
+        double t = spike_times[i];
+        if (t >= SUMMARY_baseline_start && t < SUMMARY_baseline_end) baseline += 1;
+        if (t >= problem->stim_time && t < first) first = t;
+    }
+    double rebound = 0;
+    for (int i = 0; i < num_spikes && isfinite(first); i++) {
+        if (spike_times[i] >= first && spike_times[i] < first + SOBOL_rebound_window) rebound += 1;
+    }
+    out[0] = 1e3 * baseline / (SUMMARY_baseline_end - SUMMARY_baseline_start);
+    out[1] = isfinite(first) ? fmin(first - problem->stim_time, SOBOL_response_window) : SOBOL_response_window;
+    out[2] = 1e3 * rebound / SOBOL_rebound_window;
+}
+
+// outputs at the normalized point u
+void sobol_evaluate(const SobolProblem *problem, const double *u, double *out) {
+    State s = problem->base;
+    for (int k = 0; k < problem->num_params; k++) {
+        *(double *)((char *)&s + problem->params[k].offset) = fit_param_value(&problem->params[k], u[k]);
+    }
+    const CellParams p = params_from_state(&s);
+    CellState c;
+    Spikes spikes = {0};
+    spikes.spike_times = (double *)malloc(CONFIG_spikes_init_size * sizeof(double));
+    if (problem->use_settled) {
+        c = problem->settled;
+        spikes.num_spikes = problem->settled_spikes.num_spikes;
+        memcpy(spikes.spike_times, problem->settled_spikes.spike_times, spikes.num_spikes * sizeof(double));
+    } else {
+        c = cell_from_state(&s);
+        fit_run(&p, &c, 0, problem->stim_step, -1, -1, &spikes);
+    }
+    fit_run(&p, &c, problem->stim_step, problem->num_steps, problem->condition, problem->stim_time, &spikes);
+    sobol_outputs(problem, spikes.spike_times, spikes.num_spikes, out);
+    free(spikes.spike_times);
+}
+
+
+// ###################################################################
+// ############                 Cache                   ##############
+// ###################################################################
+
+// everything the outputs depend on besides the sample point
+uint64_t setup_fingerprint(const SobolProblem *problem) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    hash = checkpoint_hash(kernel_name, strlen(kernel_name), hash);
+    hash = checkpoint_hash_state(&problem->base, hash);
+    double setup[7] = {problem->condition, problem->stim_time, problem->num_steps, SOBOL_rebound_window,
+                       SOBOL_response_window, SUMMARY_baseline_start, SUMMARY_baseline_end};
+    hash = checkpoint_hash(setup, sizeof(setup), hash);
+    for (int k = 0; k < problem->num_params; k++) {
+        const FitParam *param = &problem->params[k];
+        hash = checkpoint_hash(param->name, strlen(param->name), hash);
+        double range[3] = {param->low, param->high, param->log_scale};
+        hash = checkpoint_hash(range, sizeof(range), hash);
+    }
+    return hash;
+}
+
+static long cache_slot(const Cache *cache, const double *u) {
+    long slot = (long)(checkpoint_hash(u, cache->dim * sizeof(double), 0xCBF29CE484222325ULL) & (cache->table_size - 1));
+    while (cache->table[slot] >= 0 &&
+           memcmp(cache->records + cache->table[slot] * (cache->dim + SOBOL_NUM_OUTPUTS), u, cache->dim * sizeof(double))) {
+        slot = (slot + 1) & (cache->table_size - 1);
+    }
+    return slot;
+}
+
+// cached outputs of u, NULL if not cached
+const double *cache_find(const Cache *cache, const double *u) {
+    if (cache->num == 0) return NULL;
+    long index = cache->table[cache_slot(cache, u)];
+    return index >= 0 ? cache->records + index * (cache->dim + SOBOL_NUM_OUTPUTS) + cache->dim : NULL;
+}
+
+void cache_insert(Cache *cache, const double *u, const double *out) {
+    int width = cache->dim + SOBOL_NUM_OUTPUTS;
+    if (2 * (cache->num + 1) > cache->table_size) {
+        free(cache->table);
+        cache->table_size = cache->table_size ? 2 * cache->table_size : 1024;
+        cache->table = (long *)malloc(cache->table_size * sizeof(long));
+        for (long i = 0; i < cache->table_size; i++) cache->table[i] = -1;
+        for (long n = 0; n < cache->num; n++) cache->table[cache_slot(cache, cache->records + n * width)] = n;
+    }
+    long slot = cache_slot(cache, u);
+    if (cache->table[slot] >= 0) return;
+    if (cache->num == cache->capacity) {
+        cache->capacity = cache->capacity ? 2 * cache->capacity : 1024;
+        cache->records = (double *)realloc(cache->records, cache->capacity * width * sizeof(double));
+    }
+    memcpy(cache->records + cache->num * width, u, cache->dim * sizeof(double));
+    memcpy(cache->records + cache->num * width + cache->dim, out, SOBOL_NUM_OUTPUTS * sizeof(double));
+    cache->table[slot] = cache->num++;
+}
+
+// layout (all float64): version, dim, num_outputs, fingerprint >> 32, fingerprint & 0xffffffff,
+//   then records of dim + num_outputs values appended in chunks (a partly written last record is cut off, so the
+//   next append stays aligned)
+// return the number of records loaded, -1 if the file belongs to another setup
+long cache_load(Cache *cache, const char *filename, uint64_t fingerprint) {
+    FILE *file = fopen(filename, "r+b");
+    if (file == NULL) return 0;
+    double header[5];
+    int width = cache->dim + SOBOL_NUM_OUTPUTS;
+    if (fread(header, sizeof(double), 5, file) != 5 || header[0] != SOBOL_CACHE_VERSION || header[1] != cache->dim ||
+        header[2] != SOBOL_NUM_OUTPUTS || header[3] != (double)(fingerprint >> 32) ||
+        header[4] != (double)(fingerprint & 0xffffffffULL)) {
+        fclose(file);
+        return -1;
+    }
+    double record[SOBOL_MAX_DIM / 2 + SOBOL_NUM_OUTPUTS];
+    long num = 0;
+    while (fread(record, sizeof(double), width, file) == (size_t)width) {
+        cache_insert(cache, record, record + cache->dim);
+        num++;
+    }
+    long size = (5 + num * width) * (long)sizeof(double);
+    if (fseek(file, 0, SEEK_END) == 0 && ftell(file) > size && CHECKPOINT_TRUNCATE(file, size) != 0) {
+        perror("Error truncating cache");
+    }
+    fclose(file);
+    return num;
+}
+
+// append records [first, cache->num) to the cache file, a new file (with header) if `create`
+int cache_append(const Cache *cache, const char *filename, uint64_t fingerprint, long first, int create) {
+    FILE *file = fopen(filename, create ? "wb" : "ab");
+    if (file == NULL) {
+        perror("Error writing cache");
+        return 1;
+    }
+    int width = cache->dim + SOBOL_NUM_OUTPUTS;
+    if (create) {
+        double header[5] = {SOBOL_CACHE_VERSION, cache->dim, SOBOL_NUM_OUTPUTS, (double)(fingerprint >> 32),
+                            (double)(fingerprint & 0xffffffffULL)};
+        fwrite(header, sizeof(double), 5, file);
+    }
+    size_t size = (size_t)(cache->num - first) * width;
+    int status = fwrite(cache->records + first * width, sizeof(double), size, file) != size;
+    status |= fclose(file) != 0;
+    INSTR_COUNT(INSTR_BYTES_WRITTEN, size * sizeof(double));
+    return status;
+}
+
+
+int main(int argc, char *argv[]) {
+    struct timeval start_time, stop_time, elapsed_time;
+    gettimeofday(&start_time, NULL);
+    INSTR_INIT();
+
+    char isa[16] = "auto", HCN[8] = "den", stim[8] = "GPe", output_dir[512] = SAVE_DIR;
+    char param_spec[1024] = "prop_m_HCN.V_z,prop_m_HCN.k_z,W_GPe,W_Str,tau_GABA_som,tau_GABA_den";
+    double g_HCN = DEFAULT_g_HCN, I_app = DEFAULT_I_app, stim_time = 1000, confidence = 0.95;
+    long N = 1024;
+    int num_bootstrap = 500, use_cache = 1;
+    unsigned long seed = 0;
+    for (int i = 1; i + 1 < argc; i+=2) {
+        if (strcmp(argv[i], "-params") == 0) {
+            snprintf(param_spec, sizeof(param_spec), "%s", argv[i + 1]);
+        } else if (strcmp(argv[i], "-N") == 0) {
+            N = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-HCN") == 0) {
+            snprintf(HCN, sizeof(HCN), "%s", argv[i + 1]);
+        } else if (strcmp(argv[i], "-g_HCN") == 0) {
+            g_HCN = strtod(argv[i + 1], NULL);
+        } else if (strcmp(argv[i], "-I_app") == 0) {
+            I_app = strtod(argv[i + 1], NULL);
+        } else if (strcmp(argv[i], "-stim") == 0) {
+            snprintf(stim, sizeof(stim), "%s", argv[i + 1]);
+        } else if (strcmp(argv[i], "-stim_time") == 0) {
+            stim_time = strtod(argv[i + 1], NULL);
+        } else if (strcmp(argv[i], "-bootstrap") == 0) {
+            num_bootstrap = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-confidence") == 0) {
+            confidence = strtod(argv[i + 1], NULL);
+        } else if (strcmp(argv[i], "-seed") == 0) {
+            seed = strtoul(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-cache") == 0) {
+            use_cache = strtol(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-o") == 0) {
+            snprintf(output_dir, sizeof(output_dir), "%s", argv[i + 1]);
+        } else if (strcmp(argv[i], "-isa") == 0) {
+            strncpy(isa, argv[i + 1], sizeof(isa) - 1);
+            isa[sizeof(isa) - 1] = '\0';
+        } else {
+            printf("Unimplemented option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (select_kernel(isa)) return 1;
+    if (strcmp(stim, "GPe") != 0 && strcmp(stim, "Str") != 0) {
+        printf("-stim must be GPe or Str\n");
+        return 1;
+    }
+    if (stim_time < SUMMARY_baseline_end) {
+        // the baseline rate is taken over [SUMMARY_baseline_start, SUMMARY_baseline_end) before the stimulation
+        printf("-stim_time must be at least SUMMARY_baseline_end (%g ms)\n", SUMMARY_baseline_end);
+        return 1;
+    }
+
+    // parameter box, comma separated "name" or "name:low:high" as in step4_fit_params
+    SobolProblem *problem = (SobolProblem *)calloc(1, sizeof(SobolProblem));
+    for (char *spec = strtok(param_spec, ","); spec != NULL; spec = strtok(NULL, ",")) {
+        if (problem->num_params == SOBOL_MAX_DIM / 2) {
+            printf("Sobol: at most %d parameters\n", SOBOL_MAX_DIM / 2);
+            return 1;
+        }
+        if (fit_param_parse(&problem->params[problem->num_params++], spec)) return 1;
+    }
+    int dim = problem->num_params;
+    long rounded = 1;
+    while (rounded < N) rounded *= 2;  // balance properties of the Sobol' sequence
+    N = rounded;
+
+    State base = init_state();
+    base.I_app = I_app;
+    if (strcmp(HCN, "som") == 0) base.g_HCN_som = g_HCN;
+    if (strcmp(HCN, "den") == 0) base.g_HCN_den = g_HCN;
+    problem->base = base;
+    problem->condition = strcmp(stim, "Str") == 0;
+    problem->stim_time = stim_time;
+    problem->stim_step = (int)ceil(stim_time * CONFIG_1ms_step_num);
+    problem->num_steps = (int)ceil((stim_time + SOBOL_response_window + SOBOL_rebound_window) * CONFIG_1ms_step_num);
+    problem->use_settled = 1;
+    for (int k = 0; k < dim; k++) problem->use_settled &= problem->params[k].after_stim;
+    if (problem->use_settled) {
+        const CellParams p = params_from_state(&base);
+        problem->settled = cell_from_state(&base);
+        problem->settled_spikes.spike_times = (double *)malloc(CONFIG_spikes_init_size * sizeof(double));
+        fit_run(&p, &problem->settled, 0, problem->stim_step, -1, -1, &problem->settled_spikes);
+    }
+    long num_rows = N * (dim + 2);
+    printf("Step4 Sobol indices: %d parameter(s), N = %ld, %ld evaluations, %s stimulation, HCN %s, %s \n", dim, N,
+           num_rows, stim, HCN, problem->use_settled ? "responses only" : "full runs");
+
+    // Saltelli design, rows [n][block]
+    Sobol sobol;
+    sobol_init(&sobol, 2 * dim);
+    double *u = (double *)malloc(num_rows * dim * sizeof(double));
+    double *f = (double *)malloc(num_rows * SOBOL_NUM_OUTPUTS * sizeof(double));
+    for (long n = 0; n < N; n++) {
+        for (int block = 0; block < dim + 2; block++) {
+            saltelli_point(&sobol, dim, (uint32_t)n, block, u + (n * (dim + 2) + block) * dim);
+        }
+    }
+
+    // cached points, the rest is evaluated in parallel chunks and appended to the cache after each chunk
+    Cache cache = {dim, 0, 0, NULL, NULL, 0};
+    char cache_filename[600];
+    snprintf(cache_filename, sizeof(cache_filename), "%ssobol_cache.bin", output_dir);
+    uint64_t fingerprint = setup_fingerprint(problem);
+    int create = 1;
+    if (use_cache) {
+        long num_loaded = cache_load(&cache, cache_filename, fingerprint);
+        if (num_loaded < 0) printf("Cache %s belongs to another setup, starting a new one \n", cache_filename);
+        if (num_loaded > 0) printf("Cache: %ld evaluations loaded from %s \n", num_loaded, cache_filename);
+        create = num_loaded < 0 || cache.num == 0;
+    }
+    long *missing = (long *)malloc(num_rows * sizeof(long));
+    long num_missing = 0;
+    for (long row = 0; row < num_rows; row++) {
+        const double *out = cache_find(&cache, u + row * dim);
+        if (out) {
+            memcpy(f + row * SOBOL_NUM_OUTPUTS, out, SOBOL_NUM_OUTPUTS * sizeof(double));
+        } else {
+            missing[num_missing++] = row;
+        }
+    }
+    printf("%ld evaluations from the cache, %ld to simulate \n", num_rows - num_missing, num_missing);
+    double evaluation_start = wall_time();
+    for (long first = 0; first < num_missing; first += SOBOL_chunk) {
+        long last = first + SOBOL_chunk < num_missing ? first + SOBOL_chunk : num_missing;
+        #pragma omp parallel for schedule(dynamic)
+        for (long m = first; m < last; m++) {
+            sobol_evaluate(problem, u + missing[m] * dim, f + missing[m] * SOBOL_NUM_OUTPUTS);
+        }
+        long cached = cache.num;
+        for (long m = first; m < last; m++) cache_insert(&cache, u + missing[m] * dim, f + missing[m] * SOBOL_NUM_OUTPUTS);
+        if (use_cache && cache_append(&cache, cache_filename, fingerprint, create ? 0 : cached, create) == 0) create = 0;
+        double seconds = wall_time() - evaluation_start;
+        printf("%ld / %ld evaluations, %.1f evaluations/s \n", last, num_missing, last / seconds);
+    }
+
+    // indices of each output
+    char result_filename[600];
+    snprintf(result_filename, sizeof(result_filename), "%ssobol_indices.csv", output_dir);
+    FILE *result = fopen(result_filename, "w");
+    if (result == NULL) {
+        perror("Error writing indices");
+        return 1;
+    }
+    fprintf(result, "output,parameter,S1,S1_low,S1_high,ST,ST_low,ST_high\n");
+    double *y = (double *)malloc(num_rows * sizeof(double));
+    for (int o = 0; o < SOBOL_NUM_OUTPUTS; o++) {
+        for (long row = 0; row < num_rows; row++) y[row] = f[row * SOBOL_NUM_OUTPUTS + o];
+        SobolIndices indices;
+        sobol_indices(y, N, dim, num_bootstrap, confidence, seed, &indices);
+        printf("%s: mean %g, variance %g \n", SOBOL_OUTPUT_NAMES[o], indices.mean, indices.variance);
+        for (int k = 0; k < dim; k++) {
+            printf("  %-20s S1 %6.3f [%6.3f, %6.3f]  ST %6.3f [%6.3f, %6.3f] \n", problem->params[k].name,
+                   indices.S1[k], indices.S1_low[k], indices.S1_high[k], indices.ST[k], indices.ST_low[k],
+                   indices.ST_high[k]);
+            fprintf(result, "%s,%s,%g,%g,%g,%g,%g,%g\n", SOBOL_OUTPUT_NAMES[o], problem->params[k].name, indices.S1[k],
+                    indices.S1_low[k], indices.S1_high[k], indices.ST[k], indices.ST_low[k], indices.ST_high[k]);
+        }
+    }
+    fclose(result);
+    printf("Saved %s \n", result_filename);
+    free(y);
+    free(u);
+    free(f);
+    free(missing);
+    free(cache.records);
+    free(cache.table);
+    free(problem->settled_spikes.spike_times);
+    free(problem);
+
+    gettimeofday(&stop_time, NULL);
+    timersub(&stop_time, &start_time, &elapsed_time);
+    printf("Running time: %f seconds.\n", elapsed_time.tv_sec + elapsed_time.tv_usec * 1e-6);
+    INSTR_REPORT(SAVE_DIR "step4_sobol_instrument.json");
+    return 0;
+}
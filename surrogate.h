@@ -0,0 +1,524 @@
+// surrogate.h
+// Emulator of the step1 firing rate (calculate_firing_rate()) over up to SURROGATE_MAX_DIM parameters of a base
+// State, e.g. (I_app, g_HCN_den), answering rate queries in microseconds with an error bound per query.
+// The surrogate is a local Gaussian process (kriging): a query is predicted from its SURROGATE_neighbors nearest
+// training points, found in a uniform bucket grid over the unit box, with a Matern 3/2 correlation (rates have a
+// kink at the rheobase, where smoother kernels ring). Axes are scaled to [0, 1], conductances on a log2 scale.
+// surrogate_fit() picks the correlation length of every axis by leave-one-out error over the training points, then
+// scales the process variance so that the leave-one-out residuals match the predicted variances; the error bound
+// (95%, SURROGATE_z standard deviations) is therefore calibrated on the training data rather than assumed.
+// The noise of the training rates starts from SURROGATE_nugget: step1 counts spikes in 1 s, so rates are whole Hz.
+// surrogate_rates() simulates the queries whose bound exceeds the tolerance and adds them to the training set, so the
+// surrogate refines itself where it is used. Training points come from step1 (surrogate_from_step1()) or any sweep
+// (surrogate_add()). surrogate_write() saves the fitted surrogate, see the layout there.
+// Queries are thread-safe, adding points is not.
+#ifndef SURROGATE_H
+#define SURROGATE_H
+#include "simulation.h"
+#include "params.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+    #include <omp.h>
+    #define SURROGATE_THREADS(n) ((n) > 0 ? (n) : omp_get_max_threads())
+#endif
+
+#define SURROGATE_VERSION 1
+#define SURROGATE_HEADER 8
+#define SURROGATE_MAX_DIM 4
+#define SURROGATE_MAX_NEIGHBORS 32
+#define SURROGATE_z 1.96
+
+// candidate correlation lengths in unit coordinates
+static const double SURROGATE_LENGTHS[] = {1. / 32, 1. / 16, 1. / 8, 1. / 4, 1. / 2, 1};
+#define SURROGATE_NUM_LENGTHS ((int)(sizeof(SURROGATE_LENGTHS) / sizeof(SURROGATE_LENGTHS[0])))
+
+typedef struct {
+    int field;          // index in STATE_FIELDS
+    double low;         // range of the unit coordinate, in parameter units
+    double high;
+    int log_scale;      // 1: unit coordinate linear in log2(parameter)
+    double length;      // correlation length in unit coordinates
+} SurrogateAxis;
+
+typedef struct {
+    State base;         // the other parameters of the simulated cells
+    int dim;
+    SurrogateAxis axes[SURROGATE_MAX_DIM];
+    int neighbors;
+    double noise;       // noise variance of the training rates assumed by surrogate_fit(), Hz^2
+    double sigma2;      // process variance, Hz^2
+    double nugget;      // noise variance, Hz^2, calibrated together with sigma2
+    long num;
+    long capacity;
+    double *u;          // [capacity][dim], unit coordinates of the training points
+    double *rate;       // [capacity]
+    // bucket grid of cells_per_dim^dim cells over the unit box, one linked list of points per cell
+    int cells_per_dim;
+    long *head;
+    long *next;         // [capacity]
+    long num_indexed;   // num at the last rebuild of the grid
+} Surrogate;
+
+
+void surrogate_init(Surrogate *s, const State *base) {
+    memset(s, 0, sizeof(Surrogate));
+    s->base = *base;
+    s->neighbors = SURROGATE_neighbors;
+    s->noise = s->nugget = SURROGATE_nugget;
+    s->sigma2 = 1;
+}
+
+void surrogate_free(Surrogate *s) {
+    free(s->u);
+    free(s->rate);
+    free(s->head);
+    free(s->next);
+    s->u = s->rate = NULL;
+    s->head = s->next = NULL;
+    s->num = s->capacity = 0;
+}
+
+// add an axis over the State field `name` (see params.h); 0 on success, -1 for an unknown name, a full surrogate,
+// an empty range or a log scale over non-positive values, or once points were added
+int surrogate_add_axis(Surrogate *s, const char *name, double low, double high, int log_scale) {
+    int field = -1;
+    for (int i = 0; i < NUM_STATE_FIELDS; i++) {
+        if (strcmp(STATE_FIELDS[i].name, name) == 0) field = i;
+    }
+    if (field < 0 || s->dim == SURROGATE_MAX_DIM || s->num > 0 || !(high > low) || (log_scale && !(low > 0))) {
+        return -1;
+    }
+    SurrogateAxis axis = {field, low, high, log_scale != 0, SURROGATE_LENGTHS[SURROGATE_NUM_LENGTHS / 2]};
+    s->axes[s->dim++] = axis;
+    return 0;
+}
+
+static inline void surrogate_to_unit(const Surrogate *s, const double *x, double *u) {
+    for (int i = 0; i < s->dim; i++) {
+        const SurrogateAxis *a = &s->axes[i];
+        u[i] = a->log_scale ? log2(x[i] / a->low) / log2(a->high / a->low) : (x[i] - a->low) / (a->high - a->low);
+    }
+}
+
+static inline void surrogate_from_unit(const Surrogate *s, const double *u, double *x) {
+    for (int i = 0; i < s->dim; i++) {
+        const SurrogateAxis *a = &s->axes[i];
+        x[i] = a->log_scale ? a->low * exp2(u[i] * log2(a->high / a->low)) : a->low + u[i] * (a->high - a->low);
+    }
+}
+
+
+// ###################################################################
+// ############          Neighbor search                ##############
+// ###################################################################
+
+static inline long surrogate_cell(const Surrogate *s, const double *u) {
+    long cell = 0;
+    for (int i = 0; i < s->dim; i++) {
+        int c = (int)floor(u[i] * s->cells_per_dim);
+        c = c < 0 ? 0 : c >= s->cells_per_dim ? s->cells_per_dim - 1 : c;
+        cell = cell * s->cells_per_dim + c;
+    }
+    return cell;
+}
+
+// about 2 points per cell
+static void surrogate_index(Surrogate *s) {
+    int cells_per_dim = (int)pow(fmax(s->num / 2., 1), 1. / s->dim);
+    while (cells_per_dim > 1 && pow(cells_per_dim, s->dim) > (1 << 20)) cells_per_dim--;
+    s->cells_per_dim = cells_per_dim > 1 ? cells_per_dim : 1;
+    long num_cells = 1;
+    for (int i = 0; i < s->dim; i++) num_cells *= s->cells_per_dim;
+    free(s->head);
+    s->head = (long *)malloc(num_cells * sizeof(long));
+    for (long c = 0; c < num_cells; c++) s->head[c] = -1;
+    for (long n = 0; n < s->num; n++) {
+        long c = surrogate_cell(s, s->u + n * s->dim);
+        s->next[n] = s->head[c];
+        s->head[c] = n;
+    }
+    s->num_indexed = s->num;
+}
+
+// the `k` nearest training points of u (Euclidean in unit coordinates) other than `exclude`, by increasing
+// distance; the number found
+static int surrogate_neighbors(const Surrogate *s, const double *u, long exclude, int k, long *index) {
+    double dist2[SURROGATE_MAX_NEIGHBORS];
+    int found = 0, dim = s->dim, n_cells = s->cells_per_dim;
+    int center[SURROGATE_MAX_DIM], offset[SURROGATE_MAX_DIM];
+    for (int i = 0; i < dim; i++) {
+        int c = (int)floor(u[i] * n_cells);
+        center[i] = c < 0 ? 0 : c >= n_cells ? n_cells - 1 : c;
+    }
+    // rings of cells at Chebyshev distance r from the center cell, until the k-th point is closer than any
+    // point of the next ring can be
+    for (int r = 0; r < n_cells; r++) {
+        for (int i = 0; i < dim; i++) offset[i] = -r;
+        for (;;) {
+            int on_ring = 0, inside = 1;
+            long cell = 0;
+            for (int i = 0; i < dim; i++) {
+                int c = center[i] + offset[i];
+                on_ring |= offset[i] == -r || offset[i] == r;
+                inside &= c >= 0 && c < n_cells;
+                cell = cell * n_cells + c;
+            }
+            if (on_ring && inside) {
+                for (long n = s->head[cell]; n >= 0; n = s->next[n]) {
+                    if (n == exclude) continue;
+                    double d = 0;
+                    for (int i = 0; i < dim; i++) d += (s->u[n * dim + i] - u[i]) * (s->u[n * dim + i] - u[i]);
+                    if (found == k && d >= dist2[k - 1]) continue;
+                    int j = found < k ? found++ : k - 1;
+                    for (; j > 0 && dist2[j - 1] > d; j--) {
+                        dist2[j] = dist2[j - 1];
+                        index[j] = index[j - 1];
+                    }
+                    dist2[j] = d;
+                    index[j] = n;
+                }
+            }
+            // next offset in [-r, r]^dim
+            int i = dim - 1;
+            for (; i >= 0 && offset[i] == r; i--) offset[i] = -r;
+            if (i < 0) break;
+            offset[i]++;
+        }
+        double reach = (double)r / n_cells;
+        if (found == k && dist2[k - 1] <= reach * reach) break;
+    }
+    return found;
+}
+
+
+// ###################################################################
+// ############              Kriging                    ##############
+// ###################################################################
+
+// Matern 3/2 correlation of two points in unit coordinates
+static inline double surrogate_correlation(const Surrogate *s, const double *a, const double *b) {
+    double d = 0;
+    for (int i = 0; i < s->dim; i++) {
+        double t = (a[i] - b[i]) / s->axes[i].length;
+        d += t * t;
+    }
+    d = sqrt(3 * d);
+    return (1 + d) * exp(-d);
+}
+
+// mean and variance (Hz^2, of the rate itself, without the nugget) at u from the neighbors other than `exclude`;
+// 1 without training points
+static int surrogate_krige(const Surrogate *s, const double *u, long exclude, double *mean, double *variance) {
+    long index[SURROGATE_MAX_NEIGHBORS];
+    int k = surrogate_neighbors(s, u, exclude, s->neighbors, index);
+    if (k == 0) {
+        *mean = NAN;
+        *variance = INFINITY;
+        return 1;
+    }
+    // simple kriging around the neighbors' mean: R = L L^T, mean += (L^-1 r).(L^-1 (y - local)),
+    // variance = sigma2 (1 - |L^-1 r|^2)
+    double L[SURROGATE_MAX_NEIGHBORS * SURROGATE_MAX_NEIGHBORS], r[SURROGATE_MAX_NEIGHBORS];
+    double y[SURROGATE_MAX_NEIGHBORS], local = 0, eta = s->nugget / s->sigma2 + 1e-10;
+    for (int i = 0; i < k; i++) local += s->rate[index[i]] / k;
+    for (int i = 0; i < k; i++) {
+        const double *u_i = s->u + index[i] * s->dim;
+        r[i] = surrogate_correlation(s, u, u_i);
+        y[i] = s->rate[index[i]] - local;
+        for (int j = 0; j < i; j++) L[i * k + j] = surrogate_correlation(s, u_i, s->u + index[j] * s->dim);
+        L[i * k + i] = 1 + eta;
+    }
+    for (int j = 0; j < k; j++) {  // Cholesky, lower triangle in place
+        for (int m = 0; m < j; m++) L[j * k + j] -= L[j * k + m] * L[j * k + m];
+        L[j * k + j] = sqrt(L[j * k + j]);
+        for (int i = j + 1; i < k; i++) {
+            for (int m = 0; m < j; m++) L[i * k + j] -= L[i * k + m] * L[j * k + m];
+            L[i * k + j] /= L[j * k + j];
+        }
+    }
+    double fit = 0, explained = 0;
+    for (int i = 0; i < k; i++) {  // forward substitution of r and y together
+        for (int m = 0; m < i; m++) {
+            r[i] -= L[i * k + m] * r[m];
+            y[i] -= L[i * k + m] * y[m];
+        }
+        r[i] /= L[i * k + i];
+        y[i] /= L[i * k + i];
+        fit += r[i] * y[i];
+        explained += r[i] * r[i];
+    }
+    *mean = local + fit;
+    *variance = s->sigma2 * fmax(1 - explained, 0);
+    return 0;
+}
+
+// rate in Hz at the parameters x[dim], `error`: 95% error bound in Hz of the rate a simulation would give, so at
+// least SURROGATE_z sqrt(nugget) (may be NULL)
+double surrogate_predict(const Surrogate *s, const double *x, double *error) {
+    double u[SURROGATE_MAX_DIM], mean, variance;
+    surrogate_to_unit(s, x, u);
+    surrogate_krige(s, u, -1, &mean, &variance);
+    if (error) *error = SURROGATE_z * sqrt(variance + s->nugget);
+    return fmax(mean, 0);
+}
+
+
+// ###################################################################
+// ############          Training and fit               ##############
+// ###################################################################
+
+// training rates at the parameters x[num][dim]
+void surrogate_add(Surrogate *s, long num, const double *x, const double *rates) {
+    if (s->num + num > s->capacity) {
+        while (s->num + num > s->capacity) s->capacity = s->capacity ? 2 * s->capacity : 1024;
+        s->u = (double *)realloc(s->u, s->capacity * s->dim * sizeof(double));
+        s->rate = (double *)realloc(s->rate, s->capacity * sizeof(double));
+        s->next = (long *)realloc(s->next, s->capacity * sizeof(long));
+    }
+    for (long n = 0; n < num; n++) {
+        long j = s->num++;
+        surrogate_to_unit(s, x + n * s->dim, s->u + j * s->dim);
+        s->rate[j] = rates[n];
+        if (s->head) {
+            long c = surrogate_cell(s, s->u + j * s->dim);
+            s->next[j] = s->head[c];
+            s->head[c] = j;
+        }
+    }
+    if (s->head == NULL || s->num > 2 * s->num_indexed) surrogate_index(s);
+}
+
+// leave-one-out squared error and squared error / predicted variance, averaged over every `stride`-th point
+static void surrogate_leave_one_out(const Surrogate *s, long stride, double *error2, double *z2) {
+    long count = 0;
+    *error2 = *z2 = 0;
+    for (long n = 0; n < s->num; n += stride) {
+        double mean, variance;
+        if (surrogate_krige(s, s->u + n * s->dim, n, &mean, &variance)) continue;
+        double e = s->rate[n] - mean;
+        *error2 += e * e;
+        *z2 += e * e / (variance + s->nugget);
+        count++;
+    }
+    if (count > 0) {
+        *error2 /= count;
+        *z2 /= count;
+    }
+}
+
+// correlation lengths (one axis at a time, two passes, best leave-one-out error over SURROGATE_LENGTHS), then the
+// process and noise variances scaled together so that the leave-one-out residuals / predicted standard deviations
+// have unit RMS (the weights only depend on their ratio, which starts as noise / variance of the rates); the noise
+// variance stays at least `noise`
+void surrogate_fit(Surrogate *s) {
+    if (s->num < 2) return;
+    long stride = s->num > SURROGATE_fit_points ? s->num / SURROGATE_fit_points : 1;
+    double mean = 0, variance = 0, error2, z2;
+    for (long n = 0; n < s->num; n++) mean += s->rate[n] / s->num;
+    for (long n = 0; n < s->num; n++) variance += (s->rate[n] - mean) * (s->rate[n] - mean) / s->num;
+    s->nugget = s->noise;
+    s->sigma2 = fmax(variance, s->noise);
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < s->dim; i++) {
+            double best = INFINITY, best_length = s->axes[i].length;
+            for (int l = 0; l < SURROGATE_NUM_LENGTHS; l++) {
+                s->axes[i].length = SURROGATE_LENGTHS[l];
+                surrogate_leave_one_out(s, stride, &error2, &z2);
+                if (error2 < best) {
+                    best = error2;
+                    best_length = SURROGATE_LENGTHS[l];
+                }
+            }
+            s->axes[i].length = best_length;
+        }
+    }
+    surrogate_leave_one_out(s, stride, &error2, &z2);
+    if (z2 > 0) {
+        s->sigma2 *= z2;
+        s->nugget = fmax(s->nugget * z2, s->noise);  // the rates of new points are no less noisy
+    }
+}
+
+static double *surrogate_read_doubles(const char *filename, long *num) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        perror(filename);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    *num = ftell(file) / (long)sizeof(double);
+    rewind(file);
+    double *data = (double *)malloc((*num > 0 ? *num : 1) * sizeof(double));
+    if (fread(data, sizeof(double), *num, file) != (size_t)*num) *num = 0;
+    fclose(file);
+    return data;
+}
+
+// surrogate of init_state() over I_app and, for `hcn` "som" / "den", log2 g_HCN_som / g_HCN_den, trained on the
+// step1 grid in `dir` (prepared_*.bin) and fitted; 0 on success
+int surrogate_from_step1(Surrogate *s, const char *dir, const char *hcn) {
+    State base = init_state();
+    surrogate_init(s, &base);
+    int zero = strcmp(hcn, "zero") == 0;
+    if (!zero && strcmp(hcn, "som") != 0 && strcmp(hcn, "den") != 0) return 1;
+    char filename[600];
+    long num_I, num_g = 1, num_r;
+    snprintf(filename, sizeof(filename), "%sprepared_I.bin", dir);
+    double *I = surrogate_read_doubles(filename, &num_I);
+    snprintf(filename, sizeof(filename), "%sprepared_g.bin", dir);
+    double *g = zero ? NULL : surrogate_read_doubles(filename, &num_g);
+    snprintf(filename, sizeof(filename), "%sprepared_r_%s.bin", dir, zero ? "0" : hcn);
+    double *r = surrogate_read_doubles(filename, &num_r);
+    int status = I == NULL || (!zero && g == NULL) || r == NULL || num_I < 2 || num_g < (zero ? 1 : 2) ||
+                 num_r != num_I * num_g;
+    if (status) {
+        printf("Step1 grid in %s: missing or inconsistent prepared_*.bin \n", dir);
+    } else {
+        char name[32];
+        surrogate_add_axis(s, "I_app", I[0], I[num_I - 1], 0);
+        snprintf(name, sizeof(name), "g_HCN_%s", hcn);
+        if (!zero) surrogate_add_axis(s, name, g[0], g[num_g - 1], 1);
+        // prepared_r_som/den are [g][I]
+        double *x = (double *)malloc(num_r * 2 * sizeof(double));
+        for (long i = 0; i < num_g; i++) {
+            for (long j = 0; j < num_I; j++) {
+                x[(i * num_I + j) * s->dim] = I[j];
+                if (!zero) x[(i * num_I + j) * s->dim + 1] = g[i];
+            }
+        }
+        surrogate_add(s, num_r, x, r);
+        surrogate_fit(s);
+        free(x);
+    }
+    free(I);
+    free(g);
+    free(r);
+    return status;
+}
+
+
+// ###################################################################
+// ############        Queries with refinement          ##############
+// ###################################################################
+
+// calculate_firing_rate() of the base state with the parameters x[dim]
+double surrogate_simulate(const Surrogate *s, const double *x) {
+    State state = s->base;
+    for (int i = 0; i < s->dim; i++) *(double *)((char *)&state + STATE_FIELDS[s->axes[i].field].offset) = x[i];
+    return calculate_firing_rate(&state);
+}
+
+// rates at x[num][dim] with their 95% error bounds; queries whose bound exceeds `tol` Hz (none for tol <= 0) are
+// simulated in parallel (`num_threads`, 0 for all cores) and added to the training set, their error is 0.
+// The number of simulations.
+long surrogate_rates(Surrogate *s, long num, const double *x, double tol, double *rates, double *errors,
+                     int num_threads) {
+    long *uncertain = (long *)malloc((num > 0 ? num : 1) * sizeof(long)), num_uncertain = 0;
+    #pragma omp parallel for schedule(static) num_threads(SURROGATE_THREADS(num_threads))
+    for (long j = 0; j < num; j++) rates[j] = surrogate_predict(s, x + j * s->dim, &errors[j]);
+    if (tol > 0) {
+        for (long j = 0; j < num; j++) {
+            if (!(errors[j] <= tol)) uncertain[num_uncertain++] = j;
+        }
+    }
+    #pragma omp parallel for schedule(dynamic) num_threads(SURROGATE_THREADS(num_threads))
+    for (long k = 0; k < num_uncertain; k++) {
+        long j = uncertain[k];
+        rates[j] = surrogate_simulate(s, x + j * s->dim);
+        errors[j] = 0;
+    }
+    for (long k = 0; k < num_uncertain; k++) surrogate_add(s, 1, x + uncertain[k] * s->dim, &rates[uncertain[k]]);
+    free(uncertain);
+    return num_uncertain;
+}
+
+
+// ###################################################################
+// ############               Files                     ##############
+// ###################################################################
+
+// layout (all float64):
+//   version, num_fields, dim, num, neighbors, noise, sigma2, nugget,
+//   base state[num_fields] (in the order of STATE_FIELDS),
+//   dim x (field index, low, high, log_scale, length),
+//   u[num][dim] (unit coordinates, see surrogate_to_unit()), rate[num]
+int surrogate_write(const Surrogate *s, const char *filename) {
+    size_t size = SURROGATE_HEADER + NUM_STATE_FIELDS + 5 * s->dim + s->num * (s->dim + 1);
+    double *data = (double *)malloc(size * sizeof(double));
+    double header[SURROGATE_HEADER] = {SURROGATE_VERSION, NUM_STATE_FIELDS, s->dim, s->num, s->neighbors, s->noise,
+                                       s->sigma2, s->nugget};
+    memcpy(data, header, sizeof(header));
+    double *values = data + SURROGATE_HEADER;
+    for (int k = 0; k < NUM_STATE_FIELDS; k++) {
+        values[k] = *(const double *)((const char *)&s->base + STATE_FIELDS[k].offset);
+    }
+    values += NUM_STATE_FIELDS;
+    for (int i = 0; i < s->dim; i++, values += 5) {
+        const SurrogateAxis *a = &s->axes[i];
+        values[0] = a->field;
+        values[1] = a->low;
+        values[2] = a->high;
+        values[3] = a->log_scale;
+        values[4] = a->length;
+    }
+    memcpy(values, s->u, s->num * s->dim * sizeof(double));
+    memcpy(values + s->num * s->dim, s->rate, s->num * sizeof(double));
+
+    int status = atomic_write(filename, data, size);
+    if (status) perror("Error writing surrogate");
+    free(data);
+    return status;
+}
+
+// 0 on success, `s` is initialized either way
+int surrogate_read(Surrogate *s, const char *filename) {
+    State base = init_state();
+    surrogate_init(s, &base);
+    long size;
+    double *data = surrogate_read_doubles(filename, &size);
+    if (data == NULL) return 1;
+    const double *header = data;
+    int dim = size >= SURROGATE_HEADER ? (int)header[2] : 0;
+    long num = size >= SURROGATE_HEADER ? (long)header[3] : 0;
+    if (size < SURROGATE_HEADER || (int)header[0] != SURROGATE_VERSION || (int)header[1] != NUM_STATE_FIELDS ||
+        dim < 1 || dim > SURROGATE_MAX_DIM || num < 0 ||
+        size != SURROGATE_HEADER + NUM_STATE_FIELDS + 5 * dim + num * (dim + 1)) {
+        printf("Unsupported surrogate %s \n", filename);
+        free(data);
+        return 1;
+    }
+    s->neighbors = (int)header[4];
+    if (s->neighbors < 1 || s->neighbors > SURROGATE_MAX_NEIGHBORS) s->neighbors = SURROGATE_neighbors;
+    s->noise = header[5];
+    s->sigma2 = header[6];
+    s->nugget = header[7];
+    const double *values = data + SURROGATE_HEADER;
+    for (int k = 0; k < NUM_STATE_FIELDS; k++) {
+        *(double *)((char *)&s->base + STATE_FIELDS[k].offset) = values[k];
+    }
+    values += NUM_STATE_FIELDS;
+    for (int i = 0; i < dim; i++, values += 5) {
+        SurrogateAxis axis = {(int)values[0], values[1], values[2], values[3] != 0, values[4]};
+        if (axis.field < 0 || axis.field >= NUM_STATE_FIELDS) {
+            printf("Unsupported surrogate %s \n", filename);
+            free(data);
+            return 1;
+        }
+        s->axes[s->dim++] = axis;
+    }
+    s->capacity = num > 0 ? num : 1;
+    s->u = (double *)malloc(s->capacity * dim * sizeof(double));
+    s->rate = (double *)malloc(s->capacity * sizeof(double));
+    s->next = (long *)malloc(s->capacity * sizeof(long));
+    memcpy(s->u, values, num * dim * sizeof(double));
+    memcpy(s->rate, values + num * dim, num * sizeof(double));
+    s->num = num;
+    surrogate_index(s);
+    free(data);
+    return 0;
+}
+
+#endif
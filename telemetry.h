@@ -0,0 +1,167 @@
+// telemetry.h
+// Live progress of long sweeps: a small JSON status file, rewritten atomically (temporary file + rename) at most every
+// TELEMETRY_interval seconds, with the items (grid cells, trials) done and in total, the error count, the ETA and the
+// simulated ms per wall second, in total and per thread. snr_status.py polls the status files of all running jobs.
+// Counters are kept per thread (no atomics); the status file is written by thread 0 only, reading the other threads'
+// slots without synchronization, which at worst shows a count that is one item behind.
+// Errors are simulations that ended with a non-finite membrane potential or fired above TELEMETRY_max_rate.
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+#include "simulation.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+    #include <direct.h>
+    #include <process.h>
+    #define TELEMETRY_GETPID() _getpid()
+    #define TELEMETRY_MKDIR(path) _mkdir(path)
+#else
+    #include <unistd.h>
+    #define TELEMETRY_GETPID() getpid()
+    #define TELEMETRY_MKDIR(path) mkdir(path, 0777)
+#endif
+#ifdef _OPENMP
+    #include <omp.h>
+#endif
+
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_MAX_THREADS 256
+
+typedef struct {
+    long items;
+    long errors;
+    double simulated_ms;
+    char padding[64 - 2 * sizeof(long) - sizeof(double)];  // one cache line per thread
+} TelemetrySlot;
+
+typedef struct {
+    int enabled;
+    int automatic;          // the "auto" file, removed when the job is done
+    char filename[512];
+    char job[256];
+    long total;
+    double start;
+    double last_write;
+    TelemetrySlot slots[TELEMETRY_MAX_THREADS];
+} Telemetry;
+
+static Telemetry telemetry;
+
+static inline int telemetry_thread() {
+#ifdef _OPENMP
+    int thread = omp_get_thread_num();
+    return thread < TELEMETRY_MAX_THREADS ? thread : TELEMETRY_MAX_THREADS - 1;
+#else
+    return 0;
+#endif
+}
+
+// whether the last simulation of a cell went wrong, `num_spikes` over `duration` ms
+static inline int telemetry_error(double V_s, int num_spikes, double duration) {
+    return !isfinite(V_s) || num_spikes > duration * TELEMETRY_max_rate / 1e3;
+}
+
+// `text` as a JSON string: quotes, backslashes and control characters escaped
+static void telemetry_json_string(FILE *file, const char *text) {
+    fputc('"', file);
+    for (const unsigned char *c = (const unsigned char *)text; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(file, "\\%c", *c);
+        } else if (*c < 0x20) {
+            fprintf(file, "\\u%04x", *c);
+        } else {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+// status file of the current counters, `state` is "running", "done" or "failed"
+void telemetry_write(const char *state) {
+    if (!telemetry.enabled) return;
+    double now = wall_time(), elapsed = now - telemetry.start;
+    long items = 0, errors = 0;
+    double simulated_ms = 0;
+    int num_threads = 1;
+#ifdef _OPENMP
+    num_threads = omp_get_max_threads() < TELEMETRY_MAX_THREADS ? omp_get_max_threads() : TELEMETRY_MAX_THREADS;
+#endif
+    for (int t = 0; t < TELEMETRY_MAX_THREADS; t++) {
+        items += telemetry.slots[t].items;
+        errors += telemetry.slots[t].errors;
+        simulated_ms += telemetry.slots[t].simulated_ms;
+    }
+    double eta = items > 0 ? elapsed * (telemetry.total - items) / items : -1;
+
+    char tmp_filename[600];
+    FILE *file = atomic_open(telemetry.filename, "w", tmp_filename, sizeof(tmp_filename));
+    if (file == NULL) {
+        perror("Error writing status file");
+        telemetry.enabled = 0;
+        return;
+    }
+    fprintf(file, "{\n  \"version\": %d,\n  \"job\": ", TELEMETRY_VERSION);
+    telemetry_json_string(file, telemetry.job);
+    fprintf(file, ",\n  \"pid\": %d,\n  \"state\": \"%s\",\n", (int)TELEMETRY_GETPID(), state);
+    fprintf(file, "  \"kernel\": \"%s\",\n  \"updated\": %.3f,\n  \"elapsed\": %.3f,\n", kernel_name, now, elapsed);
+    fprintf(file, "  \"done\": %ld,\n  \"total\": %ld,\n  \"errors\": %ld,\n  \"eta\": %.1f,\n", items,
+            telemetry.total, errors, eta);
+    fprintf(file, "  \"simulated_ms_per_s\": %.1f,\n  \"threads\": [", elapsed > 0 ? simulated_ms / elapsed : 0);
+    for (int t = 0; t < num_threads; t++) {
+        const TelemetrySlot *slot = &telemetry.slots[t];
+        fprintf(file, "%s\n    {\"items\": %ld, \"errors\": %ld, \"simulated_ms_per_s\": %.1f}", t ? "," : "",
+                slot->items, slot->errors, elapsed > 0 ? slot->simulated_ms / elapsed : 0);
+    }
+    fprintf(file, "\n  ]\n}\n");
+    if (atomic_commit(file, tmp_filename, telemetry.filename, ferror(file))) perror("Error writing status file");
+    telemetry.last_write = now;
+}
+
+// start reporting `total` items of `job` to `filename`: "none" disables it, "auto" is
+// SAVE_DIR "status/<job>_<pid>.json" (characters other than letters, digits, '-' and '.' replaced by '_'), which
+// telemetry_finish() removes again unless the job failed
+void telemetry_start(const char *job, long total, const char *filename) {
+    memset(&telemetry, 0, sizeof(Telemetry));
+    if (strcmp(filename, "none") == 0) return;
+    snprintf(telemetry.job, sizeof(telemetry.job), "%s", job);
+    if (strcmp(filename, "auto") == 0) {
+        char name[256];
+        snprintf(name, sizeof(name), "%s", job);
+        for (char *c = name; *c; c++) {
+            if (!isalnum((unsigned char)*c) && *c != '-' && *c != '.') *c = '_';
+        }
+        TELEMETRY_MKDIR(SAVE_DIR "status");
+        snprintf(telemetry.filename, sizeof(telemetry.filename), SAVE_DIR "status/%s_%d.json", name,
+                 (int)TELEMETRY_GETPID());
+        telemetry.automatic = 1;
+    } else {
+        snprintf(telemetry.filename, sizeof(telemetry.filename), "%s", filename);
+    }
+    telemetry.total = total;
+    telemetry.start = wall_time();
+    telemetry.enabled = 1;
+    telemetry_write("running");
+    if (telemetry.enabled) printf("Status: %s \n", telemetry.filename);
+}
+
+// one item done by the calling thread after `simulated_ms` of model time
+static inline void telemetry_add(double simulated_ms, int error) {
+    if (!telemetry.enabled) return;
+    TelemetrySlot *slot = &telemetry.slots[telemetry_thread()];
+    slot->items++;
+    slot->errors += error;
+    slot->simulated_ms += simulated_ms;
+    if (telemetry_thread() == 0 && wall_time() - telemetry.last_write >= TELEMETRY_interval) telemetry_write("running");
+}
+
+// the final state; a finished "auto" file is removed, so only running and failed jobs leave one behind
+void telemetry_finish(int status) {
+    if (!telemetry.enabled) return;
+    telemetry_write(status ? "failed" : "done");
+    if (!status && telemetry.automatic && remove(telemetry.filename) != 0) perror("Error removing status file");
+    telemetry.enabled = 0;
+}
+
+#endif
@@ -59,6 +59,98 @@ def csv_reader_single(table_dir):
     return values
 
 
+def summary_reader(table_dir):
+    """streaming summary written by step3_simulation (<task_id>_summary.bin, see analysis.h)"""
+    raw_data = np.fromfile(table_dir, dtype=np.float64)
+    version, num_trials, num_bins = int(raw_data[0]), int(raw_data[1]), int(raw_data[2])
+    assert version == 1, f"Unsupported summary version {version}: {table_dir}"
+    bin_size, stim_time, baseline_start, baseline_end, baseline_count = raw_data[3:8]
+    return {
+        "num_trials": num_trials,
+        "bin_size": bin_size,
+        "stim_time": stim_time,
+        "baseline_range": (baseline_start, baseline_end),
+        "baseline_count": baseline_count,
+        "psth": raw_data[8:8 + num_bins],
+        "latency": raw_data[8 + num_bins:8 + num_bins + num_trials],
+    }
+
+
+ENSEMBLE_VARS = ("Vs", "m_HCN_som", "m_HCN_den", "E_GABA_som", "E_GABA_den", "g_GABA_som", "g_GABA_den", "D", "F")
+
+
+def ensemble_reader(table_dir):
+    """ensemble trace statistics written by step3_simulation -ensemble 1 (<task_id>_ensemble.bin, see analysis.h)"""
+    raw_data = np.fromfile(table_dir, dtype=np.float64)
+    version, num_cells, num_bins, num_vars, num_quantiles = (int(raw_data[i]) for i in (0, 1, 2, 4, 5))
+    assert version == 1, f"Unsupported ensemble version {version}: {table_dir}"
+    assert num_vars == len(ENSEMBLE_VARS), f"Unexpected variables in {table_dir}"
+    bin_size = raw_data[3]
+    quantiles = raw_data[6:6 + num_quantiles]
+    cnt = 6 + num_quantiles
+    result = {"num_cells": num_cells, "ts": (np.arange(num_bins) + 1) * bin_size, "quantiles": quantiles}
+    for name in ENSEMBLE_VARS:
+        result[name] = {}
+        for key in ("mean", "var", "min", "max"):
+            result[name][key] = raw_data[cnt:cnt + num_bins]
+            cnt += num_bins
+        result[name]["out_of_range"] = raw_data[cnt:cnt + 2]
+        cnt += 2
+        result[name]["quantile"] = raw_data[cnt:cnt + num_quantiles * num_bins].reshape(num_quantiles, num_bins)
+        cnt += num_quantiles * num_bins
+    assert cnt == raw_data.shape[0], f"Truncated ensemble file: {table_dir}"
+    return result
+
+
+# field order of params.h STATE_FIELDS, the State block of a checkpoint
+_GATES = ("prop_m_Na_f", "prop_h_Na_f", "prop_s_Na_f", "prop_m_Na_p", "prop_h_Na_p", "prop_m_K", "prop_h_K",
+          "prop_m_Ca", "prop_h_Ca", "prop_m_HCN")
+STATE_FIELDS = (("time", "V_s", "V_d", "m_Na_f", "h_Na_f", "s_Na_f", "m_Na_p", "h_Na_p", "m_K", "h_K", "m_Ca", "h_Ca",
+                 "m_HCN_som", "m_HCN_den", "D", "F", "Ca_in", "Cl_som", "Cl_den", "g_GABA_som", "g_GABA_den") +
+                tuple(f"{gate}.{key}" for gate in _GATES
+                      for key in ("V_z", "k_z", "x_min", "V_tau", "tau_0", "tau_1", "sig_0", "sig_1")) +
+                ("D_0", "F_0", "D_m", "F_m", "g_HCN_som", "g_HCN_den", "W_GPe", "W_Str", "W_SNr", "tau_GABA_som",
+                 "tau_GABA_den", "V_th", "I_app", "I_den", "E_leak"))
+
+
+def checkpoint_reader(table_dir):
+    """checkpoint of a step3_simulation batch run (<task_id>_checkpoint.bin, see checkpoint.h), the cell in progress
+    with its state by field name and its spikes so far, and the streaming summary up to the last finished cell"""
+    raw_data = np.fromfile(table_dir, dtype=np.float64)
+    version, num_fields = int(raw_data[0]), int(raw_data[3])
+    assert version == 1, f"Unsupported checkpoint version {version}: {table_dir}"
+    assert num_fields == len(STATE_FIELDS), f"Unexpected state fields in {table_dir}"
+    num_sim, cell, step = int(raw_data[4]), int(raw_data[5]), int(raw_data[6])
+    simulated_ms, raster_offset = raw_data[7], int(raw_data[8])
+    num_spikes, num_bins, num_trials = int(raw_data[9]), int(raw_data[10]), int(raw_data[11])
+    cnt = 14
+    state = dict(zip(STATE_FIELDS, raw_data[cnt:cnt + num_fields]))
+    cnt += num_fields
+    result = {
+        "fingerprint": (int(raw_data[1]) << 32) | int(raw_data[2]),
+        "num_sim": num_sim,
+        "cell": cell,
+        "step": step,
+        "simulated_ms": simulated_ms,
+        "raster_offset": raster_offset if raster_offset >= 0 else None,
+        "state": state,
+        "spike_times": raw_data[cnt:cnt + num_spikes],
+        "summary": None,
+    }
+    cnt += num_spikes
+    if num_bins > 0:
+        result["summary"] = {
+            "num_trials": num_trials,
+            "stim_time": raw_data[13],
+            "baseline_count": raw_data[12],
+            "psth": raw_data[cnt:cnt + num_bins],
+            "latency": raw_data[cnt + num_bins:cnt + num_bins + num_trials],
+        }
+        cnt += num_bins + num_trials
+    assert cnt == raw_data.shape[0], f"Truncated checkpoint file: {table_dir}"
+    return result
+
+
 def sync_column(data_dict: dict):
     max_len = np.max([len(value) for value in data_dict.values()])
     for key in data_dict.keys():
@@ -46,6 +46,16 @@ def calculate_firing_rate(ts, window_size, spike_series, baseline_range=None):
         return np.array(firing_rates)
 
 
+def calculate_firing_rate_summary(ts, window_size, summary):
+    """calculate_firing_rate() with baseline_range from a step3 summary (pooled PSTH) instead of the raster"""
+    bin_edges = np.arange(len(summary["psth"]) + 1) * summary["bin_size"]
+    cumulative = np.concatenate(([0.], np.cumsum(summary["psth"])))
+    counts = (np.interp(ts + window_size / 2, bin_edges, cumulative) -
+              np.interp(ts - window_size / 2, bin_edges, cumulative))
+    baseline_fr = summary["baseline_count"] / (summary["baseline_range"][1] - summary["baseline_range"][0])
+    return counts / window_size / baseline_fr
+
+
 def plot_firing_rate(ax, GPe_cells_of_trials, Str_cells_of_trials, ax_title=None):
     ts = np.arange(800, 1200, STEP_SIZE)
 
@@ -83,6 +93,15 @@ def calculate_cdf(cells_of_trials, start_point, inf_value=10000):
     return first_spikes, p
 
 
+def calculate_cdf_summary(summaries, inf_value=10000):
+    """calculate_cdf() from the first-spike latencies of step3 summaries, start point is the summary stim time"""
+    first_spikes = np.concatenate([np.where(np.isnan(summary["latency"]), inf_value,
+                                            summary["latency"] + summary["stim_time"]) for summary in summaries])
+    first_spikes = np.sort(first_spikes)
+    p = 1. * np.arange(len(first_spikes)) / (len(first_spikes) - 1)
+    return first_spikes, p
+
+
 def plot_time2recover(ax, baseline_GPe, baseline_Str, target_GPe, target_Str,
                       label_baseline, label_target,
                       ax_title=None):